@@ -0,0 +1,170 @@
+/*
+** Microbenchmark of the number to string conversions.
+**
+** Build with "make fmtbench" and run "./fmtbench [calls]". For several
+** kinds of numbers it prints the time per conversion with the default
+** "%.14g" format, the shortest round-trip format and "%.17g", which is
+** the shortest fixed precision that always reads back exactly. The next
+** column is snprintf("%.17g") of the C library, for reference. The last
+** one is the conversion of the shortest strings back to numbers.
+*/
+
+#define LUA_CORE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "lj_obj.h"
+#include "lj_buf.h"
+#include "lj_strfmt.h"
+#include "lj_strscan.h"
+
+#define NNUM		4096	/* Number of numbers, must be a power of 2. */
+
+#define STRFMT_G17	(STRFMT_G | ((17+1) << STRFMT_SH_PREC))
+
+typedef struct BenchDist {
+  const char *name;
+  double (*gen)(void);
+} BenchDist;
+
+static double bench_rand(void)
+{
+  return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+/* Gauges and counters with a few decimals, e.g. latencies in ms. */
+static double bench_gen_metrics(void)
+{
+  static const double scale[] = { 1, 10, 100, 1000, 10000 };
+  return (double)(rand() % 1000000) / scale[rand() % 5];
+}
+
+/* Results of divisions, which need all 17 digits. */
+static double bench_gen_ratios(void)
+{
+  return (double)(rand() % 10000 + 1) / (double)(rand() % 10000 + 1);
+}
+
+/* Integral values beyond the int32_t range, e.g. byte counts. */
+static double bench_gen_large(void)
+{
+  return (double)(int64_t)(bench_rand() * 1e15);
+}
+
+/* Random mantissas over the whole exponent range. */
+static double bench_gen_wide(void)
+{
+  TValue o;
+  o.u32.lo = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+  o.u32.hi = (uint32_t)rand() % 0x7fe00000u;
+  return o.n;
+}
+
+static const BenchDist bench_dists[] = {
+  { "metrics", bench_gen_metrics },
+  { "ratios", bench_gen_ratios },
+  { "large", bench_gen_large },
+  { "wide", bench_gen_wide }
+};
+
+static double nums[NNUM];
+static char strs[NNUM][STRFMT_MAXBUF_NUM];
+static MSize strlens[NNUM];
+static SBuf bench_sb;
+
+static double bench_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+#define BENCH_FMT(name, sf) \
+  static uint32_t name(uint32_t n) \
+  { \
+    uint32_t i, x = 0; \
+    for (i = 0; i < n; i++) { \
+      lj_buf_reset(&bench_sb); \
+      x += sbuflen(lj_strfmt_putfnum(&bench_sb, (sf), nums[i & (NNUM-1)])); \
+    } \
+    return x; \
+  }
+
+BENCH_FMT(bench_g14, STRFMT_G14)
+BENCH_FMT(bench_short, STRFMT_SHORT)
+BENCH_FMT(bench_g17, STRFMT_G17)
+
+static uint32_t bench_libc(uint32_t n)
+{
+  char buf[STRFMT_MAXBUF_NUM];
+  uint32_t i, x = 0;
+  for (i = 0; i < n; i++)
+    x += (uint32_t)snprintf(buf, sizeof(buf), "%.17g", nums[i & (NNUM-1)]);
+  return x;
+}
+
+static uint32_t bench_scan(uint32_t n)
+{
+  uint32_t i, x = 0;
+  for (i = 0; i < n; i++) {
+    TValue o;
+    uint32_t j = i & (NNUM-1);
+    x += lj_strscan_scan((const uint8_t *)strs[j], strlens[j], &o,
+			 STRSCAN_OPT_TONUM);
+  }
+  return x;
+}
+
+static volatile uint32_t bench_sink;
+
+/* Print the ns per call of a conversion. */
+static void bench_run(uint32_t (*f)(uint32_t), uint32_t n)
+{
+  double t;
+  bench_sink += f(NNUM);  /* Warm up. */
+  t = bench_time();
+  bench_sink += f(n);
+  printf(" %9.2f", (bench_time() - t) / n);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t calls = argc > 1 ? (uint32_t)atol(argv[1]) : 1u << 21;
+  lua_State *L = luaL_newstate();
+  size_t i;
+  if (!L) {
+    fprintf(stderr, "fmtbench: cannot create state\n");
+    return 1;
+  }
+  lj_buf_init(L, &bench_sb);
+  printf("%-8s %9s %9s %9s %9s %9s   (ns per call)\n", "NUMBERS", "%.14g",
+	 "shortest", "%.17g", "libc", "scan");
+  for (i = 0; i < sizeof(bench_dists)/sizeof(bench_dists[0]); i++) {
+    const BenchDist *d = &bench_dists[i];
+    int j;
+    for (j = 0; j < NNUM; j++) {
+      nums[j] = d->gen();
+      lj_buf_reset(&bench_sb);
+      lj_strfmt_putfnum(&bench_sb, STRFMT_SHORT, nums[j]);
+      strlens[j] = sbuflen(&bench_sb);
+      memcpy(strs[j], sbufB(&bench_sb), strlens[j]);
+      strs[j][strlens[j]] = '\0';
+    }
+    printf("%-8s", d->name);
+    bench_run(bench_g14, calls);
+    bench_run(bench_short, calls);
+    bench_run(bench_g17, calls);
+    bench_run(bench_libc, calls);
+    bench_run(bench_scan, calls);
+    printf("\n");
+  }
+  lj_buf_free(G(L), &bench_sb);
+  lua_close(L);
+  return 0;
+}
@@ -0,0 +1,254 @@
+----------------------------------------------------------------------------
+-- LuaJIT heap dump analyzer.
+--
+-- Released under the MIT license. See Copyright Notice in luajit.h
+----------------------------------------------------------------------------
+--
+-- This module reads a heap snapshot written by misc.heapdump.start(file)
+-- and misc.heapdump.finish() or the luaM_heapdump_* C API. It computes
+-- the dominator tree of the object graph and the retained size of every
+-- object: the memory which would be freed if the object was unreachable.
+--
+-- Example usage:
+--
+--   luajit -e 'require("jit.heapdump").report("heap.bin")'
+--   luajit -e 'require("jit.heapdump").report("heap.bin", 0.1, 8)'
+--
+-- The report shows the memory per object type and the dominator tree
+-- down to the given depth (default: 6) for all objects retaining at least
+-- the given percentage (default: 1) of the reachable memory.
+--
+----------------------------------------------------------------------------
+
+-- Cache some library functions and objects.
+local jit = require("jit")
+assert(jit.version_num == 20100, "LuaJIT core/library version mismatch")
+local byte, sub, format = string.byte, string.sub, string.format
+local sort = table.sort
+local stdout = io.stdout
+
+-- Record tags, see lj_heapdump.h.
+local HD_ROOT, HD_END = 0x00, 0x80
+
+local typenames = {
+  [4] = "string", [5] = "upvalue", [6] = "thread", [7] = "proto",
+  [8] = "function", [9] = "trace", [10] = "cdata", [11] = "table",
+  [12] = "userdata",
+}
+
+------------------------------------------------------------------------------
+
+-- Parse a heap dump. Node 0 is a virtual root referencing the GC roots.
+local function parse(fname)
+  local fp, err = io.open(fname, "rb")
+  if not fp then return nil, err end
+  local s = fp:read("*a")
+  fp:close()
+  if sub(s, 1, 3) ~= "ljh" or byte(s, 4) ~= 1 then
+    return nil, fname..": not a heap dump"
+  end
+  local pos = 5
+
+  local function uleb()
+    local v, m = 0, 1
+    repeat
+      local b = byte(s, pos)
+      if not b then error(fname..": truncated heap dump", 0) end
+      pos = pos + 1
+      v = v + (b % 128) * m
+      m = m * 128
+    until b < 128
+    return v
+  end
+
+  local ids, addr, typ, size, label = {}, { [0] = 0 }, { [0] = 0 },
+				      { [0] = 0 }, { [0] = "" }
+  local rstart, refs, roots = {}, {}, {}
+  local n = 0
+  while true do
+    local tag = uleb()
+    if tag == HD_END then break end
+    if tag == HD_ROOT then
+      roots[#roots+1] = uleb()
+    else
+      n = n + 1
+      local a = uleb()
+      ids[a] = n
+      addr[n], typ[n], size[n] = a, tag, uleb()
+      rstart[n] = #refs + 1
+      while true do
+	local r = uleb()
+	if r == 0 then break end
+	refs[#refs+1] = r
+      end
+      local len = uleb()
+      label[n] = sub(s, pos, pos+len-1)
+      pos = pos + len
+    end
+  end
+  -- Turn the addresses into node ids. Objects created while the heap was
+  -- being dumped are not part of it.
+  local edges, estart = {}, { [0] = 1 }
+  local function edge(a)
+    local id = ids[a]
+    if id then edges[#edges+1] = id end
+  end
+  for _, r in ipairs(roots) do edge(r) end
+  for i = 1, n do
+    estart[i] = #edges + 1
+    for j = rstart[i], (rstart[i+1] or #refs+1) - 1 do edge(refs[j]) end
+  end
+  estart[n+1] = #edges + 1
+  return { n = n, addr = addr, typ = typ, size = size, label = label,
+	   edges = edges, estart = estart }
+end
+
+------------------------------------------------------------------------------
+
+-- Compute the immediate dominators and the retained sizes.
+-- See Cooper, Harvey, Kennedy: "A Simple, Fast Dominance Algorithm".
+local function dominators(h)
+  local edges, estart = h.edges, h.estart
+  -- Depth-first search from the root, numbering the nodes in postorder.
+  local po, post = {}, {}
+  local seen = { [0] = true }
+  local stack, spos = { 0 }, { estart[0] }
+  local sp = 1
+  while sp > 0 do
+    local v, e = stack[sp], spos[sp]
+    if e < estart[v+1] then
+      spos[sp] = e + 1
+      local w = edges[e]
+      if not seen[w] then
+	seen[w] = true
+	sp = sp + 1
+	stack[sp], spos[sp] = w, estart[w]
+      end
+    else
+      post[#post+1] = v
+      po[v] = #post
+      sp = sp - 1
+    end
+  end
+  -- Predecessors of the reachable nodes.
+  local preds = {}
+  for _, v in ipairs(post) do
+    for e = estart[v], estart[v+1]-1 do
+      local w = edges[e]
+      local p = preds[w]
+      if not p then p = {}; preds[w] = p end
+      p[#p+1] = v
+    end
+  end
+  -- Iterate to the fixpoint in reverse postorder.
+  local idom = { [0] = 0 }
+  local changed = true
+  while changed do
+    changed = false
+    for i = #post-1, 1, -1 do
+      local v = post[i]
+      local new
+      for _, p in ipairs(preds[v]) do
+	if idom[p] then
+	  if not new then
+	    new = p
+	  else
+	    local a, b = p, new
+	    while a ~= b do
+	      while po[a] < po[b] do a = idom[a] end
+	      while po[b] < po[a] do b = idom[b] end
+	    end
+	    new = a
+	  end
+	end
+      end
+      if idom[v] ~= new then idom[v] = new; changed = true end
+    end
+  end
+  -- Dominated nodes precede their dominators in postorder.
+  local retained, size = {}, h.size
+  for _, v in ipairs(post) do retained[v] = size[v] end
+  for i = 1, #post-1 do
+    local v = post[i]
+    retained[idom[v]] = retained[idom[v]] + retained[v]
+  end
+  h.idom, h.retained, h.post = idom, retained, post
+  return h
+end
+
+------------------------------------------------------------------------------
+
+local function describe(h, v)
+  local t = typenames[h.typ[v]] or tostring(h.typ[v])
+  local l = h.label[v]
+  if t == "string" then
+    l = format(" %q", l):gsub("\\\n", "\\n")
+  elseif l ~= "" then
+    l = " "..l
+  end
+  return format("%s %#x%s", t, h.addr[v], l)
+end
+
+-- Print the report for a heap dump.
+local function report(fname, minpct, maxdepth, out)
+  out = out or stdout
+  minpct = minpct or 1
+  maxdepth = maxdepth or 6
+  local h, err = parse(fname)
+  if not h then error(err, 0) end
+  dominators(h)
+  local idom, retained = h.idom, h.retained
+  local total = retained[0]
+
+  -- Summary per type.
+  local count, bytes, all = {}, {}, 0
+  for v = 1, h.n do
+    local t = h.typ[v]
+    count[t] = (count[t] or 0) + 1
+    bytes[t] = (bytes[t] or 0) + h.size[v]
+    all = all + h.size[v]
+  end
+  local types = {}
+  for t in pairs(count) do types[#types+1] = t end
+  sort(types, function(a, b) return bytes[a] > bytes[b] end)
+  out:write(format("%-10s %10s %14s\n", "TYPE", "OBJECTS", "BYTES"))
+  for _, t in ipairs(types) do
+    out:write(format("%-10s %10d %14d\n", typenames[t] or t, count[t],
+		     bytes[t]))
+  end
+  out:write(format("%-10s %10d %14d (%d reachable)\n\n", "TOTAL", h.n, all,
+		   total))
+
+  -- Dominator tree.
+  local children = {}
+  for _, v in ipairs(h.post) do
+    if v ~= 0 then
+      local d = idom[v]
+      local c = children[d]
+      if not c then c = {}; children[d] = c end
+      c[#c+1] = v
+    end
+  end
+  local min = total * minpct / 100
+  local function dump(v, depth)
+    local c = children[v]
+    if not c or depth > maxdepth then return end
+    sort(c, function(a, b) return retained[a] > retained[b] end)
+    for _, w in ipairs(c) do
+      if retained[w] < min then break end
+      out:write(format("%14d %5.1f%% %s%s\n", retained[w],
+		       retained[w] * 100 / total, ("  "):rep(depth),
+		       describe(h, w)))
+      dump(w, depth + 1)
+    end
+  end
+  out:write(format("%14s %6s %s\n", "RETAINED", "", "DOMINATOR TREE"))
+  dump(0, 0)
+end
+
+-- Public module functions.
+return {
+  parse = parse,
+  dominators = dominators,
+  report = report
+}
@@ -0,0 +1,206 @@
+----------------------------------------------------------------------------
+-- LuaJIT allocation profiler.
+--
+-- Released under the MIT license. See Copyright Notice in luajit.h
+----------------------------------------------------------------------------
+--
+-- This module reads the event stream written by the allocation profiler
+-- and prints where the memory has been allocated and freed.
+--
+-- The profiler itself is started and stopped with misc.memprof.start(file)
+-- and misc.memprof.stop() or the luaM_memprof_* C API.
+--
+-- Example usage:
+--
+--   luajit -jmemprof myapp.lua
+--   luajit -jmemprof=myapp.bin myapp.lua
+--   luajit -e 'require("jit.memprof").report("myapp.bin")'
+--
+-- The -j option writes the events to the given file (default: memprof.bin)
+-- and prints the report when the program exits.
+--
+-- The report has one line per source of allocations: a line of a Lua
+-- function, a builtin, a C function, a trace or the VM itself. It shows the
+-- number of allocations and the allocated bytes, and how much of it has
+-- been freed (possibly by other code) before the profiler was stopped.
+-- Reallocations count as a free of the old and an allocation of the new
+-- block. The sources are sorted by the allocated bytes.
+--
+----------------------------------------------------------------------------
+
+-- Cache some library functions and objects.
+local jit = require("jit")
+assert(jit.version_num == 20100, "LuaJIT core/library version mismatch")
+local vmdef = require("jit.vmdef")
+local byte, sub, format = string.byte, string.sub, string.format
+local sort = table.sort
+local stdout, stderr = io.stdout, io.stderr
+
+-- Record tags, see lj_memprof.h.
+local MP_SYM, MP_ALLOC, MP_FREE, MP_REALLOC = 0, 1, 2, 3
+local MP_SRC_INTERNAL, MP_SRC_LFUNC, MP_SRC_CFUNC = 0x00, 0x04, 0x08
+local MP_SRC_TRACE, MP_SRC_FFUNC = 0x0c, 0x10
+local MP_SYM_PROTO = 0x00
+local MP_END = 0x80
+
+------------------------------------------------------------------------------
+
+-- Strip the chunk name like lj_debug_shortname().
+local function chunkname(name)
+  local c = sub(name, 1, 1)
+  if c == "@" or c == "=" then return sub(name, 2) end
+  name = name:match("^[^\n]*")
+  if #name > 40 then name = sub(name, 1, 37).."..." end
+  return '[string "'..name..'"]'
+end
+
+-- Parse a profile. Returns a table of sources and the totals.
+local function parse(fname)
+  local fp, err = io.open(fname, "rb")
+  if not fp then return nil, err end
+  local s = fp:read("*a")
+  fp:close()
+  if sub(s, 1, 3) ~= "ljm" or byte(s, 4) ~= 1 then
+    return nil, fname..": not an allocation profile"
+  end
+  local pos, len = 5, #s
+
+  local function uleb()
+    local v, m = 0, 1
+    repeat
+      local b = byte(s, pos)
+      if not b then error(fname..": truncated profile", 0) end
+      pos = pos + 1
+      v = v + (b % 128) * m
+      m = m * 128
+    until b < 128
+    return v
+  end
+
+  local protos, traces, sources, owner = {}, {}, {}, {}
+  local total = { alloc = 0, abytes = 0, free = 0, fbytes = 0 }
+
+  local function source(key)
+    local src = sources[key]
+    if not src then
+      src = { name = key, alloc = 0, abytes = 0, free = 0, fbytes = 0 }
+      sources[key] = src
+    end
+    return src
+  end
+
+  local function free(ptr, size)
+    local src = owner[ptr]
+    if src then
+      owner[ptr] = nil
+      src.free = src.free + 1
+      src.fbytes = src.fbytes + size
+    end
+    total.free = total.free + 1
+    total.fbytes = total.fbytes + size
+  end
+
+  local function alloc(src, ptr, size)
+    owner[ptr] = src
+    src.alloc = src.alloc + 1
+    src.abytes = src.abytes + size
+    total.alloc = total.alloc + 1
+    total.abytes = total.abytes + size
+  end
+
+  while pos <= len do
+    local tag = byte(s, pos)
+    pos = pos + 1
+    if tag == MP_END then break end
+    local ev = tag % 4
+    local kind = tag - ev
+    if ev == MP_SYM then
+      if kind == MP_SYM_PROTO then
+	local addr, line = uleb(), uleb()
+	local n = uleb()
+	protos[addr] = chunkname(sub(s, pos, pos+n-1))
+	pos = pos + n
+      else
+	local traceno, addr, line = uleb(), uleb(), uleb()
+	traces[traceno] = format("TRACE #%d %s:%d",
+				 traceno, protos[addr] or "?", line)
+      end
+    else
+      local key
+      if kind == MP_SRC_LFUNC then
+	local addr, line = uleb(), uleb()
+	key = (protos[addr] or "?")..":"..line
+      elseif kind == MP_SRC_CFUNC then
+	key = format("CFUNC %#x", uleb())
+      elseif kind == MP_SRC_TRACE then
+	local traceno = uleb()
+	key = traces[traceno] or format("TRACE #%d", traceno)
+      elseif kind == MP_SRC_FFUNC then
+	local ffid = uleb()
+	key = "BUILTIN "..(vmdef.ffnames[ffid] or ffid)
+      else
+	key = "INTERNAL"
+      end
+      local src = source(key)
+      if ev ~= MP_ALLOC then free(uleb(), uleb()) end
+      if ev ~= MP_FREE then alloc(src, uleb(), uleb()) end
+    end
+  end
+  return sources, total
+end
+
+------------------------------------------------------------------------------
+
+-- Print the report for a profile.
+local function report(fname, out)
+  out = out or stdout
+  local sources, total = parse(fname)
+  if not sources then error(total, 0) end
+  local list = {}
+  for _, src in pairs(sources) do
+    if src.alloc > 0 then list[#list+1] = src end
+  end
+  sort(list, function(a, b)
+    if a.abytes ~= b.abytes then return a.abytes > b.abytes end
+    return a.name < b.name
+  end)
+  local fmt = "%-40s %9s %12s %9s %12s\n"
+  out:write(format(fmt, "SOURCE", "ALLOCS", "BYTES", "FREED", "BYTES"))
+  for _, src in ipairs(list) do
+    out:write(format(fmt, src.name, src.alloc, src.abytes,
+		     src.free, src.fbytes))
+  end
+  out:write(format(fmt, "TOTAL", total.alloc, total.abytes,
+		   total.free, total.fbytes))
+end
+
+------------------------------------------------------------------------------
+
+local prof_ud, prof_file
+
+-- Stop profiling and print the report.
+local function prof_finish()
+  if prof_ud then
+    prof_ud = nil
+    local ok, err = misc.memprof.stop()
+    if not ok then error(err, 0) end
+    report(prof_file, stderr)
+  end
+end
+
+-- Start profiling.
+local function start(fname)
+  prof_file = fname or "memprof.bin"
+  local ok, err = misc.memprof.start(prof_file)
+  if not ok then error(err, 0) end
+  prof_ud = newproxy(true)
+  getmetatable(prof_ud).__gc = prof_finish
+end
+
+-- Public module functions.
+return {
+  start = start, -- For -j command line option.
+  stop = prof_finish,
+  parse = parse,
+  report = report
+}
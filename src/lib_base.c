@@ -436,13 +436,18 @@ LJLIB_CF(gcinfo)
 LJLIB_CF(collectgarbage)
 {
   int opt = lj_lib_checkopt(L, 1, LUA_GCCOLLECT,  /* ORDER LUA_GC* */
-    "\4stop\7restart\7collect\5count\1\377\4step\10setpause\12setstepmul\1\377\11isrunning");
+    "\4stop\7restart\7collect\5count\1\377\4step\10setpause\12setstepmul\1\377\11isrunning\14generational\13incremental\7bgsweep\11setbudget\10setlimit\10finalize\13setfinbatch");
   int32_t data = lj_lib_optint(L, 2, 0);
   if (opt == LUA_GCCOUNT) {
     setnumV(L->top, (lua_Number)G(L)->gc.total/1024.0);
+  } else if (opt == LUA_GCGEN || opt == LUA_GCINC) {
+    /* Return the name of the previous mode. */
+    int res = lua_gc(L, opt, data);
+    setstrV(L, L->top, lj_str_newz(L, res == LUA_GCGEN ? "generational" :
+						       "incremental"));
   } else {
     int res = lua_gc(L, opt, data);
-    if (opt == LUA_GCSTEP || opt == LUA_GCISRUNNING)
+    if (opt == LUA_GCSTEP || opt == LUA_GCISRUNNING || opt == LUA_GCBGSWEEP)
       setboolV(L->top, res);
     else
       setintV(L->top, res);
@@ -0,0 +1,252 @@
+/*
+** String buffer library.
+** Copyright (C) 2005-2017 Mike Pall. See Copyright Notice in luajit.h
+*/
+
+#define lib_buffer_c
+#define LUA_LIB
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "lj_obj.h"
+#include "lj_gc.h"
+#include "lj_err.h"
+#include "lj_buf.h"
+#include "lj_str.h"
+#include "lj_state.h"
+#include "lj_strfmt.h"
+#if LJ_HASFFI
+#include "lj_ctype.h"
+#include "lj_cdata.h"
+#endif
+#include "lj_lib.h"
+
+/* -- Helper functions ---------------------------------------------------- */
+
+/* Get the buffer object. Any allocation uses the current thread. */
+static SBufExt *buffer_tobuf(lua_State *L)
+{
+  SBufExt *sbx;
+  if (!(L->base < L->top && tvisudata(L->base) &&
+	udataV(L->base)->udtype == UDTYPE_BUFFER))
+    lj_err_argtype(L, 1, "buffer");
+  sbx = (SBufExt *)uddata(udataV(L->base));
+  setsbufL(&sbx->sb, L);
+  return sbx;
+}
+
+static MSize buffer_checklen(lua_State *L, int narg)
+{
+  int32_t len = lj_lib_checkint(L, narg);
+  if (len < 0)
+    lj_err_arg(L, narg, LJ_ERR_IDXRNG);
+  return (MSize)len;
+}
+
+/* Push a pointer into the buffer, to be read or written with the FFI. */
+static void buffer_pushptr(lua_State *L, char *p)
+{
+#if LJ_HASFFI
+  GCcdata *cd;
+  if (!ctype_ctsG(G(L))) {
+    ptrdiff_t oldtop = savestack(L, L->top);
+    luaopen_ffi(L);  /* Load FFI library on-demand. */
+    L->top = restorestack(L, oldtop);
+  }
+  cd = lj_cdata_new_(L, CTID_P_UINT8, CTSIZE_PTR);
+  *(char **)cdataptr(cd) = p;
+  setcdataV(L, L->top++, cd);
+#else
+  UNUSED(p);
+  lj_err_caller(L, LJ_ERR_BUFPTR);
+#endif
+}
+
+static int buffer_tostring(lua_State *L)
+{
+  SBufExt *sbx = buffer_tobuf(L);
+  setstrV(L, L->top++, lj_bufx_str(sbx, LJ_MAX_BUF));
+  lj_gc_check(L);
+  return 1;
+}
+
+static void buffer_free(lua_State *L, SBufExt *sbx)
+{
+  lj_buf_free(G(L), &sbx->sb);
+  lj_buf_init(L, &sbx->sb);
+  sbx->r = 0;
+}
+
+/* -- Buffer methods ------------------------------------------------------ */
+
+#define LJLIB_MODULE_buffer_method
+
+LJLIB_CF(buffer_method_put)		LJLIB_REC(.)
+{
+  SBufExt *sbx = buffer_tobuf(L);
+  SBuf *sb = &sbx->sb;
+  cTValue *o;
+  for (o = L->base+1; o < L->top; o++) {
+    if (tvisudata(o) && udataV(o)->udtype == UDTYPE_BUFFER) {
+      SBufExt *sbx2 = (SBufExt *)uddata(udataV(o));
+      MSize len = sbufxlen(sbx2);
+      char *p = lj_buf_more(sb, len);  /* May move the data if sbx2 == sbx. */
+      setsbufP(sb, lj_buf_wmem(p, sbufxR(sbx2), len));
+    } else {
+      MSize len;
+      const char *p = lj_strfmt_wstrnum(L, o, &len);
+      if (!p)
+	lj_err_argt(L, (int)(o - L->base) + 1, LUA_TSTRING);
+      lj_buf_putmem(sb, p, len);
+    }
+  }
+  L->top = L->base+1;  /* Return the buffer, for chained calls. */
+  return 1;
+}
+
+LJLIB_CF(buffer_method_putf)		LJLIB_REC(.)
+{
+  SBuf *sb = &buffer_tobuf(L)->sb;
+  MSize len = sbuflen(sb);
+  int retry = 0;
+  do {
+    setsbufP(sb, sbufB(sb) + len);  /* Drop the output of the first try. */
+    retry = lj_strfmt_putarg(L, sb, 2, retry);
+  } while (retry++ == 1);
+  L->top = L->base+1;
+  return 1;
+}
+
+LJLIB_CF(buffer_method_get)		LJLIB_REC(.)
+{
+  SBufExt *sbx = buffer_tobuf(L);
+  int narg = (int)(L->top - L->base) - 1, arg;
+  if (narg == 0) {  /* Get everything. */
+    setnilV(L->top++);
+    narg = 1;
+  }
+  for (arg = 2; arg <= narg+1; arg++) {
+    MSize len = tvisnil(L->base+arg-1) ? LJ_MAX_BUF : buffer_checklen(L, arg);
+    setstrV(L, L->base+arg-1, lj_bufx_str(sbx, len));
+    lj_bufx_skip(sbx, len);
+  }
+  lj_gc_check(L);
+  return narg;
+}
+
+LJLIB_CF(buffer_method_skip)		LJLIB_REC(.)
+{
+  SBufExt *sbx = buffer_tobuf(L);
+  lj_bufx_skip(sbx, buffer_checklen(L, 2));
+  L->top = L->base+1;
+  return 1;
+}
+
+LJLIB_CF(buffer_method_reset)		LJLIB_REC(.)
+{
+  SBufExt *sbx = buffer_tobuf(L);
+  lj_buf_reset(&sbx->sb);
+  sbx->r = 0;
+  L->top = L->base+1;
+  return 1;
+}
+
+LJLIB_CF(buffer_method_free)
+{
+  buffer_free(L, buffer_tobuf(L));
+  return 0;
+}
+
+LJLIB_CF(buffer_method_reserve)
+{
+  SBuf *sb = &buffer_tobuf(L)->sb;
+  char *p = lj_buf_more(sb, buffer_checklen(L, 2));
+  buffer_pushptr(L, p);
+  setintV(L->top++, (int32_t)sbufleft(sb));
+  return 2;
+}
+
+LJLIB_CF(buffer_method_commit)
+{
+  SBuf *sb = &buffer_tobuf(L)->sb;
+  MSize len = buffer_checklen(L, 2);
+  if (len > sbufleft(sb))
+    lj_err_arg(L, 2, LJ_ERR_IDXRNG);
+  setsbufP(sb, sbufP(sb) + len);
+  L->top = L->base+1;
+  return 1;
+}
+
+LJLIB_CF(buffer_method_ref)
+{
+  SBufExt *sbx = buffer_tobuf(L);
+  buffer_pushptr(L, sbufxR(sbx));
+  setintV(L->top++, (int32_t)sbufxlen(sbx));
+  return 2;
+}
+
+LJLIB_CF(buffer_method_tostring)	LJLIB_REC(.)
+{
+  return buffer_tostring(L);
+}
+
+LJLIB_CF(buffer_method___tostring)
+{
+  return buffer_tostring(L);
+}
+
+LJLIB_CF(buffer_method___len)
+{
+  SBufExt *sbx = buffer_tobuf(L);
+  setintV(L->top++, (int32_t)sbufxlen(sbx));
+  return 1;
+}
+
+LJLIB_CF(buffer_method___gc)
+{
+  buffer_free(L, buffer_tobuf(L));
+  return 0;
+}
+
+LJLIB_PUSH(top-1) LJLIB_SET(__index)
+
+#include "lj_libdef.h"
+
+/* -- Buffer library functions -------------------------------------------- */
+
+#define LJLIB_MODULE_buffer
+
+LJLIB_PUSH(top-2) LJLIB_SET(!)  /* Set environment. */
+
+LJLIB_CF(buffer_new)
+{
+  int32_t sz = lj_lib_optint(L, 1, 0);
+  SBufExt *sbx;
+  GCudata *ud;
+  if (sz < 0)
+    lj_err_arg(L, 1, LJ_ERR_IDXRNG);
+  sbx = (SBufExt *)lua_newuserdata(L, sizeof(SBufExt));
+  ud = udataV(L->top-1);
+  ud->udtype = UDTYPE_BUFFER;
+  /* NOBARRIER: The GCudata is new (marked white). */
+  setgcrefr(ud->metatable, curr_func(L)->c.env);
+  lj_buf_init(L, &sbx->sb);
+  sbx->r = 0;
+  if (sz > 0)
+    lj_buf_need(&sbx->sb, (MSize)sz);
+  return 1;
+}
+
+#include "lj_libdef.h"
+
+/* ------------------------------------------------------------------------ */
+
+LUALIB_API int luaopen_string_buffer(lua_State *L)
+{
+  LJ_LIB_REG(L, NULL, buffer_method);
+  LJ_LIB_REG(L, NULL, buffer);
+  return 1;
+}
+
@@ -35,6 +35,7 @@ static const luaL_Reg lj_lib_preload[] = {
 #if LJ_HASFFI
   { LUA_FFILIBNAME,	luaopen_ffi },
 #endif
+  { LUA_BUFFERLIBNAME,	luaopen_string_buffer },
   { NULL,		NULL }
 };
 
@@ -27,6 +27,7 @@
 #include "lj_ircall.h"
 #include "lj_iropt.h"
 #include "lj_target.h"
+#include "lj_snap.h"
 #endif
 #include "lj_trace.h"
 #include "lj_dispatch.h"
@@ -294,12 +295,14 @@ LJLIB_CF(jit_util_traceinfo)
   GCtrace *T = jit_checktrace(L);
   if (T) {
     GCtab *t;
-    lua_createtable(L, 0, 8);  /* Increment hash size if fields are added. */
+    lua_createtable(L, 0, 9);  /* Increment hash size if fields are added. */
     t = tabV(L->top-1);
     setintfield(L, t, "nins", (int32_t)T->nins - REF_BIAS - 1);
     setintfield(L, t, "nk", REF_BIAS - (int32_t)T->nk);
     setintfield(L, t, "link", T->link);
     setintfield(L, t, "nexit", T->nsnap);
+    setintfield(L, t, "snapsize", (int32_t)(T->nsnap*sizeof(SnapShot) +
+					    T->nsnapmap*sizeof(SnapEntry)));
     setstrV(L, L->top++, lj_str_newz(L, jit_trlinkname[T->linktype]));
     lua_setfield(L, -2, "linktype");
     /* There are many more fields. Add them only when needed. */
@@ -362,7 +365,8 @@ LJLIB_CF(jit_util_tracesnap)
   SnapNo sn = (SnapNo)lj_lib_checkint(L, 2);
   if (T && sn < T->nsnap) {
     SnapShot *snap = &T->snap[sn];
-    SnapEntry *map = &T->snapmap[snap->mapofs];
+    SnapEntry ubuf[2*SNAP_MAXENT];
+    SnapEntry *map = lj_snap_unpack(T, sn, ubuf);
     MSize n, nent = snap->nent;
     GCtab *t;
     lua_createtable(L, nent+2, 0);
@@ -15,6 +15,7 @@
 #include "lj_str.h"
 #include "lj_tab.h"
 #include "lj_lib.h"
+#include "lauxlib.h"
 
 /* ------------------------------------------------------------------------ */
 
@@ -31,7 +32,7 @@ LJLIB_CF(misc_getmetrics)
   struct luam_Metrics metrics;
   GCtab *m;
 
-  lua_createtable(L, 0, 19);
+  lua_createtable(L, 0, 31);
   m = tabV(L->top - 1);
 
   luaM_metrics(L, &metrics);
@@ -55,14 +56,126 @@ LJLIB_CF(misc_getmetrics)
   setnumfield(L, m, "gc_steps_sweep", metrics.gc_steps_sweep);
   setnumfield(L, m, "gc_steps_finalize", metrics.gc_steps_finalize);
 
+  {
+    GCtab *h = lj_tab_new(L, LUAM_GCPAUSE_HIST+1, 0);
+    int i;
+    settabV(L, lj_tab_setstr(L, m, lj_str_newlit(L, "gc_pause_hist")), h);
+    for (i = 0; i < LUAM_GCPAUSE_HIST; i++)
+      setnumV(lj_tab_setint(L, h, i+1), (double)metrics.gc_pause_hist[i]);
+  }
+  setnumfield(L, m, "gc_atomic_ns", metrics.gc_atomic_ns);
+  setnumfield(L, m, "gc_atomic_max_ns", metrics.gc_atomic_max_ns);
+
+  setnumfield(L, m, "gc_limit", metrics.gc_limit);
+  setnumfield(L, m, "gc_limit_errors", metrics.gc_limit_errors);
+  setnumfield(L, m, "gc_emergency", metrics.gc_emergency);
+
+  setnumfield(L, m, "gc_finalize_queue", metrics.gc_finalize_queue);
+  setnumfield(L, m, "gc_finalized", metrics.gc_finalized);
+  setnumfield(L, m, "gc_finalize_ns", metrics.gc_finalize_ns);
+
+  setnumfield(L, m, "patcache_hit", metrics.patcache_hit);
+  setnumfield(L, m, "patcache_miss", metrics.patcache_miss);
+
   setnumfield(L, m, "jit_snap_restore", metrics.jit_snap_restore);
   setnumfield(L, m, "jit_trace_abort", metrics.jit_trace_abort);
   setnumfield(L, m, "jit_mcode_size", metrics.jit_mcode_size);
+  setnumfield(L, m, "jit_snap_size", metrics.jit_snap_size);
   setnumfield(L, m, "jit_trace_num", metrics.jit_trace_num);
 
   return 1;
 }
 
+/* local old = misc.numfmt([fmt]) */
+LJLIB_CF(misc_numfmt)
+{
+  int fmt = L->base < L->top && !tvisnil(L->base) ?
+	    lj_lib_checkopt(L, 1, -1, "\005%.14g\010shortest") : -1;
+  if (luaM_numfmt(L, fmt) == LUAM_NUMFMT_SHORTEST)
+    lua_pushliteral(L, "shortest");
+  else
+    lua_pushliteral(L, "%.14g");
+  return 1;
+}
+
+/* ----- misc.memprof module ---------------------------------------------- */
+
+#define LJLIB_MODULE_misc_memprof
+
+/* local ok, err = misc.memprof.start(fname) */
+LJLIB_CF(misc_memprof_start)
+{
+  const char *fname = strdata(lj_lib_checkstr(L, 1));
+  switch (luaM_memprof_start(L, fname)) {
+  case LUAM_MEMPROF_SUCCESS:
+    setboolV(L->top++, 1);
+    return 1;
+  case LUAM_MEMPROF_ERRRUN:
+    setnilV(L->top++);
+    lua_pushliteral(L, "profiler is already running");
+    return 2;
+  default:
+    return luaL_fileresult(L, 0, fname);
+  }
+}
+
+/* local ok, err = misc.memprof.stop() */
+LJLIB_CF(misc_memprof_stop)
+{
+  switch (luaM_memprof_stop(L)) {
+  case LUAM_MEMPROF_SUCCESS:
+    setboolV(L->top++, 1);
+    return 1;
+  case LUAM_MEMPROF_ERRRUN:
+    setnilV(L->top++);
+    lua_pushliteral(L, "profiler is not running");
+    return 2;
+  default:
+    setnilV(L->top++);
+    lua_pushliteral(L, "cannot write the profile");
+    return 2;
+  }
+}
+
+/* ----- misc.heapdump module --------------------------------------------- */
+
+#define LJLIB_MODULE_misc_heapdump
+
+/* local ok, err = misc.heapdump.start(fname) */
+LJLIB_CF(misc_heapdump_start)
+{
+  const char *fname = strdata(lj_lib_checkstr(L, 1));
+  switch (luaM_heapdump_start(L, fname)) {
+  case LUAM_HEAPDUMP_SUCCESS:
+    setboolV(L->top++, 1);
+    return 1;
+  case LUAM_HEAPDUMP_ERRRUN:
+    setnilV(L->top++);
+    lua_pushliteral(L, "heap dump is already in progress");
+    return 2;
+  default:
+    return luaL_fileresult(L, 0, fname);
+  }
+}
+
+/* local ok, err = misc.heapdump.finish() */
+LJLIB_CF(misc_heapdump_finish)
+{
+  switch (luaM_heapdump_finish(L)) {
+  case LUAM_HEAPDUMP_SUCCESS:
+    setboolV(L->top++, 1);
+    return 1;
+  case LUAM_HEAPDUMP_ERRRUN:
+    setnilV(L->top++);
+    lua_pushliteral(L, "heap dump is not in progress");
+    return 2;
+  default:
+    setnilV(L->top++);
+    lua_pushliteral(L, "cannot write the heap dump");
+    return 2;
+  }
+}
+
 /* ------------------------------------------------------------------------ */
 
 #include "lj_libdef.h"
@@ -70,5 +183,8 @@ LJLIB_CF(misc_getmetrics)
 LUALIB_API int luaopen_misc(struct lua_State *L)
 {
   LJ_LIB_REG(L, LUAM_MISCLIBNAME, misc);
+  LJ_LIB_REG(L, LUAM_MISCLIBNAME ".memprof", misc_memprof);
+  LJ_LIB_REG(L, LUAM_MISCLIBNAME ".heapdump", misc_heapdump);
+  L->top -= 2;
   return 1;
 }
@@ -447,6 +447,409 @@ static int push_captures(MatchState *ms, const char *s, const char *e)
   return nlevels;  /* number of strings pushed */
 }
 
+/* -- Compiled patterns --------------------------------------------------- */
+
+/*
+** A pattern is compiled into a list of items on first use. The program is
+** cached with the interned pattern string as the key, see lj_str_patget().
+** Char classes and sets become bitmaps, so each char is matched with a
+** single test. The matcher mirrors match(), down to the recursion depth.
+** Patterns which may throw an error while matching aren't compiled, so
+** they still throw only when the bad item is reached.
+*/
+
+#define PAT_MAXLEN	256	/* Longer patterns are not compiled. */
+
+enum {
+  PAT_END, PAT_EOS,		/* End of pattern, '$' at the end. */
+  PAT_CHAR, PAT_ANY, PAT_SET,	/* Single char items. */
+  PAT_CAPOPEN, PAT_CAPPOS, PAT_CAPCLOSE,  /* Captures. */
+  PAT_BALANCE, PAT_FRONTIER, PAT_BACKREF  /* %b, %f and %1-%9. */
+};
+
+typedef struct PatItem {
+  uint8_t op;		/* Item type, PAT_*. */
+  uint8_t rep;		/* Repetition: '?', '*', '+', '-' or 0. */
+  uint8_t a, b;		/* Char, chars of %b or digit of a back reference. */
+  uint32_t set;		/* Index of the char set of PAT_SET or PAT_FRONTIER. */
+} PatItem;
+
+typedef uint32_t PatSet[8];
+
+typedef struct PatProg {
+  MSize size;		/* Size of the program. */
+  MSize nitem;		/* Number of items, 0 if not compiled. */
+  MSize nprefix;	/* Length of the literal prefix of all matches. */
+  int32_t fixlen;	/* Length of all matches or -1, see pat_fixmatch(). */
+  int32_t first;	/* Index of the item matching the first char or -1. */
+  PatSet *set;		/* Char sets. */
+  char *prefix;		/* Literal prefix. */
+  PatItem item[1];	/* Items, ending with PAT_END or PAT_EOS. */
+} PatProg;
+
+#define pat_inset(set, c)	(((set)[(c) >> 5] >> ((c) & 31)) & 1)
+
+/* Like classend(), but return NULL for a malformed item. */
+static const char *pat_classend(const char *p)
+{
+  switch (*p++) {
+  case L_ESC:
+    return *p == '\0' ? NULL : p+1;
+  case '[':
+    if (*p == '^') p++;
+    do {  /* look for a `]' */
+      if (*p == '\0')
+	return NULL;
+      if (*(p++) == L_ESC && *p != '\0')
+	p++;  /* skip escapes (e.g. `%]') */
+    } while (*p != ']');
+    return p+1;
+  default:
+    return p;
+  }
+}
+
+/*
+** Parse a pattern into items and char sets. Only count them if pp is NULL.
+** Returns 0 if matching the pattern may throw an error.
+*/
+static int pat_parse(const char *p, PatProg *pp, MSize *nitem, MSize *nset)
+{
+  MSize ni = 0, ns = 0;
+  int ncap = 0, nopen = 0, closed = 0;  /* Bit i: capture i is closed. */
+  int open[LUA_MAXCAPTURES];
+  for (;;) {
+    PatItem it;
+    const char *ep;
+    it.rep = it.a = it.b = 0;
+    it.set = 0;
+    switch (*p) {
+    case '(':
+      if (ncap == LUA_MAXCAPTURES)
+	return 0;
+      if (*(p+1) == ')') {
+	it.op = PAT_CAPPOS;
+	closed |= 1 << ncap;
+	p += 2;
+      } else {
+	it.op = PAT_CAPOPEN;
+	open[nopen++] = ncap;
+	p++;
+      }
+      ncap++;
+      break;
+    case ')':
+      if (nopen == 0)
+	return 0;
+      it.op = PAT_CAPCLOSE;
+      closed |= 1 << open[--nopen];
+      p++;
+      break;
+    case '\0':
+      it.op = PAT_END;
+      break;
+    case '$':
+      if (*(p+1) == '\0') {
+	it.op = PAT_EOS;
+	break;
+      }
+      goto single;
+    case L_ESC:
+      if (*(p+1) == 'b') {
+	if (*(p+2) == '\0' || *(p+3) == '\0')
+	  return 0;
+	it.op = PAT_BALANCE;
+	it.a = uchar(*(p+2));
+	it.b = uchar(*(p+3));
+	p += 4;
+	break;
+      } else if (*(p+1) == 'f') {
+	if (*(p+2) != '[' || !(ep = pat_classend(p+2)))
+	  return 0;
+	it.op = PAT_FRONTIER;
+	it.set = ns++;
+	if (pp) {
+	  uint32_t *set = pp->set[it.set];
+	  int c;
+	  memset(set, 0, sizeof(PatSet));
+	  for (c = 0; c < 256; c++)
+	    if (matchbracketclass(c, p+2, ep-1)) set[c >> 5] |= 1u << (c & 31);
+	}
+	p = ep;
+	break;
+      } else if (lj_char_isdigit(uchar(*(p+1)))) {
+	int l = *(p+1) - '1';
+	if (l < 0 || l >= ncap || !(closed & (1 << l)))
+	  return 0;
+	it.op = PAT_BACKREF;
+	it.a = uchar(*(p+1));
+	p += 2;
+	break;
+      }
+      /* fallthrough */
+    default: single: {
+      uint32_t set[8];
+      int c, n = 0;
+      if (!(ep = pat_classend(p)))
+	return 0;
+      memset(set, 0, sizeof(set));
+      for (c = 0; c < 256; c++)
+	if (singlematch(c, p, ep)) { set[c >> 5] |= 1u << (c & 31); n++; it.a = c; }
+      if (n == 256) {
+	it.op = PAT_ANY;
+      } else if (n == 1) {
+	it.op = PAT_CHAR;
+      } else {
+	it.op = PAT_SET;
+	it.set = ns++;
+	if (pp) memcpy(pp->set[it.set], set, sizeof(set));
+      }
+      if (*ep == '?' || *ep == '*' || *ep == '+' || *ep == '-')
+	it.rep = uchar(*ep++);
+      p = ep;
+      break;
+      }
+    }
+    if (pp) pp->item[ni] = it;
+    ni++;
+    if (it.op <= PAT_EOS) break;
+  }
+  *nitem = ni;
+  *nset = ns;
+  return 1;
+}
+
+/* Compile a pattern, skipping the anchor. Leaves nitem = 0 on failure. */
+static PatProg *pat_compile(lua_State *L, GCstr *ps)
+{
+  const char *p = strdata(ps) + (*strdata(ps) == '^');
+  MSize nitem, nset, size, i;
+  PatProg *pp;
+  if (!pat_parse(p, NULL, &nitem, &nset)) {
+    pp = lj_mem_newt(L, sizeof(PatProg), PatProg);
+    memset(pp, 0, sizeof(PatProg));
+    pp->size = sizeof(PatProg);
+    return pp;
+  }
+  size = (MSize)(sizeof(PatProg) + (nitem-1)*sizeof(PatItem) +
+		 nset*sizeof(PatSet) + nitem);
+  pp = lj_mem_newt(L, size, PatProg);
+  pp->size = size;
+  pp->set = (PatSet *)&pp->item[nitem];
+  pp->prefix = (char *)&pp->set[nset];
+  pat_parse(p, pp, &nitem, &nset);
+  pp->nitem = nitem;
+  for (i = 0; pp->item[i].op == PAT_CHAR && pp->item[i].rep == 0; i++)
+    pp->prefix[i] = (char)pp->item[i].a;
+  pp->nprefix = i;
+  for (i = 0; pp->item[i].op >= PAT_CHAR && pp->item[i].op <= PAT_SET &&
+	      pp->item[i].rep == 0; i++) ;
+  pp->fixlen = pp->item[i].op <= PAT_EOS ? (int32_t)i : -1;
+  for (i = 0; pp->item[i].op == PAT_CAPOPEN || pp->item[i].op == PAT_CAPPOS;
+       i++) ;
+  pp->first = pp->item[i].op >= PAT_CHAR && pp->item[i].op <= PAT_SET &&
+	      (pp->item[i].rep == 0 || pp->item[i].rep == '+') ? (int32_t)i : -1;
+  return pp;
+}
+
+/* Get the compiled program of a pattern or NULL. */
+static const PatProg *pat_get(lua_State *L, GCstr *ps)
+{
+  global_State *g = G(L);
+  PatProg *pp;
+  if (ps->len > PAT_MAXLEN)
+    return NULL;
+  pp = (PatProg *)lj_str_patget(&g->patcache, ps);
+  if (!pp) {
+    pp = pat_compile(L, ps);
+    lj_str_patset(g, &g->patcache, ps, pp, pp->size);
+  }
+  return pp->nitem ? pp : NULL;
+}
+
+static LJ_AINLINE int pat_single(const PatProg *pp, const PatItem *p, int c)
+{
+  switch (p->op) {
+  case PAT_CHAR: return c == p->a;
+  case PAT_ANY: return 1;
+  default: return pat_inset(pp->set[p->set], c);
+  }
+}
+
+static const char *pat_match(MatchState *ms, const PatProg *pp,
+			     const char *s, const PatItem *p);
+
+static const char *pat_max_expand(MatchState *ms, const PatProg *pp,
+				  const char *s, const PatItem *p)
+{
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  if (p->op == PAT_ANY)
+    i = ms->src_end - s;
+  else
+    while ((s+i)<ms->src_end && pat_single(pp, p, uchar(*(s+i))))
+      i++;
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = pat_match(ms, pp, (s+i), p+1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+static const char *pat_min_expand(MatchState *ms, const PatProg *pp,
+				  const char *s, const PatItem *p)
+{
+  for (;;) {
+    const char *res = pat_match(ms, pp, s, p+1);
+    if (res != NULL)
+      return res;
+    else if (s<ms->src_end && pat_single(pp, p, uchar(*s)))
+      s++;  /* try with one more repetition */
+    else
+      return NULL;
+  }
+}
+
+static const char *pat_start_capture(MatchState *ms, const PatProg *pp,
+				     const char *s, const PatItem *p, int what)
+{
+  const char *res;
+  int level = ms->level;
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=pat_match(ms, pp, s, p)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+static const char *pat_end_capture(MatchState *ms, const PatProg *pp,
+				   const char *s, const PatItem *p)
+{
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = pat_match(ms, pp, s, p)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+/* Match a compiled pattern, like match(). */
+static const char *pat_match(MatchState *ms, const PatProg *pp,
+			     const char *s, const PatItem *p)
+{
+  if (++ms->depth > LJ_MAX_XLEVEL)
+    lj_err_caller(ms->L, LJ_ERR_STRPATX);
+  for (;;) {
+    switch (p->op) {
+    case PAT_END:
+      break;  /* match succeeded */
+    case PAT_EOS:
+      if (s != ms->src_end) s = NULL;  /* check end of string */
+      break;
+    case PAT_CAPOPEN:
+      s = pat_start_capture(ms, pp, s, p+1, CAP_UNFINISHED);
+      break;
+    case PAT_CAPPOS:
+      s = pat_start_capture(ms, pp, s, p+1, CAP_POSITION);
+      break;
+    case PAT_CAPCLOSE:
+      s = pat_end_capture(ms, pp, s, p+1);
+      break;
+    case PAT_BALANCE: {
+      char pb[2];
+      pb[0] = (char)p->a; pb[1] = (char)p->b;
+      s = matchbalance(ms, s, pb);
+      if (s == NULL) break;
+      p++;
+      continue;
+      }
+    case PAT_FRONTIER: {
+      int previous = (s == ms->src_init) ? '\0' : uchar(*(s-1));
+      if (pat_inset(pp->set[p->set], previous) ||
+	  !pat_inset(pp->set[p->set], uchar(*s))) { s = NULL; break; }
+      p++;
+      continue;
+      }
+    case PAT_BACKREF:
+      s = match_capture(ms, s, p->a);
+      if (s == NULL) break;
+      p++;
+      continue;
+    default: {  /* it is a single char item */
+      int m = s<ms->src_end && pat_single(pp, p, uchar(*s));
+      switch (p->rep) {
+      case '?': {  /* optional */
+	const char *res;
+	if (m && ((res=pat_match(ms, pp, s+1, p+1)) != NULL)) {
+	  s = res;
+	  break;
+	}
+	p++;
+	continue;
+	}
+      case '*':  /* 0 or more repetitions */
+	s = pat_max_expand(ms, pp, s, p);
+	break;
+      case '+':  /* 1 or more repetitions */
+	s = (m ? pat_max_expand(ms, pp, s+1, p) : NULL);
+	break;
+      case '-':  /* 0 or more repetitions (minimum) */
+	s = pat_min_expand(ms, pp, s, p);
+	break;
+      default:
+	if (m) { s++; p++; continue; }
+	s = NULL;
+	break;
+      }
+      break;
+      }
+    }
+    break;
+  }
+  ms->depth--;
+  return s;
+}
+
+/* Match a pattern of single char items without repetitions or captures. */
+static const char *pat_fixmatch(MatchState *ms, const PatProg *pp,
+				const char *s)
+{
+  const PatItem *p = pp->item;
+  if (ms->src_end - s < pp->fixlen)
+    return NULL;
+  for (; p->op > PAT_EOS; p++, s++)
+    if (!pat_single(pp, p, uchar(*s)))
+      return NULL;
+  return (p->op == PAT_EOS && s != ms->src_end) ? NULL : s;
+}
+
+/* Match a compiled pattern at s. */
+static LJ_AINLINE const char *pat_exec(MatchState *ms, const PatProg *pp,
+				       const char *s)
+{
+  if (pp->fixlen >= 0)
+    return pat_fixmatch(ms, pp, s);
+  return pat_match(ms, pp, s, pp->item);
+}
+
+/* Skip to the next position where a match may start, or return NULL. */
+static LJ_AINLINE const char *pat_next(const PatProg *pp, const char *s,
+				       const char *e)
+{
+  if (pp->nprefix > 0) {
+    return lj_str_find(s, pp->prefix, (MSize)(e - s), pp->nprefix);
+  } else if (pp->first >= 0) {  /* Skip chars not matching the first item. */
+    const PatItem *p = &pp->item[pp->first];
+    for (; s < e; s++)
+      if (pat_single(pp, p, uchar(*s)))
+	return s;
+    return NULL;
+  }
+  return s;
+}
+
 static int str_find_aux(lua_State *L, int find)
 {
   GCstr *s = lj_lib_checkstr(L, 1);
@@ -476,6 +879,7 @@ static int str_find_aux(lua_State *L, int find)
     MatchState ms;
     const char *pstr = strdata(p);
     const char *sstr = strdata(s) + st;
+    const PatProg *pp = pat_get(L, p);
     int anchor = 0;
     if (*pstr == '^') { pstr++; anchor = 1; }
     ms.L = L;
@@ -484,7 +888,13 @@ static int str_find_aux(lua_State *L, int find)
     do {  /* Loop through string and try to match the pattern. */
       const char *q;
       ms.level = ms.depth = 0;
-      q = match(&ms, sstr, pstr);
+      if (pp) {
+	if (!anchor && !(sstr = pat_next(pp, sstr, ms.src_end)))
+	  break;
+	q = pat_exec(&ms, pp, sstr);
+      } else {
+	q = match(&ms, sstr, pstr);
+      }
       if (q) {
 	if (find) {
 	  setintV(L->top++, (int32_t)(sstr-(strdata(s)-1)));
@@ -512,11 +922,14 @@ LJLIB_CF(string_match)
 
 LJLIB_NOREG LJLIB_CF(string_gmatch_aux)
 {
-  const char *p = strVdata(lj_lib_upvalue(L, 2));
+  GCstr *pat = strV(lj_lib_upvalue(L, 2));
+  const char *p = strdata(pat);
   GCstr *str = strV(lj_lib_upvalue(L, 1));
   const char *s = strdata(str);
   TValue *tvpos = lj_lib_upvalue(L, 3);
   const char *src = s + tvpos->u32.lo;
+  /* Note: '^' isn't an anchor here, so it's not compiled. */
+  const PatProg *pp = *p == '^' ? NULL : pat_get(L, pat);
   MatchState ms;
   ms.L = L;
   ms.src_init = s;
@@ -524,7 +937,14 @@ LJLIB_NOREG LJLIB_CF(string_gmatch_aux)
   for (; src <= ms.src_end; src++) {
     const char *e;
     ms.level = ms.depth = 0;
-    if ((e = match(&ms, src, p)) != NULL) {
+    if (pp) {
+      if (!(src = pat_next(pp, src, ms.src_end)))
+	break;
+      e = pat_exec(&ms, pp, src);
+    } else {
+      e = match(&ms, src, p);
+    }
+    if (e != NULL) {
       int32_t pos = (int32_t)(e - s);
       if (e == src) pos++;  /* Ensure progress for empty match. */
       tvpos->u32.lo = (uint32_t)pos;
@@ -602,15 +1022,20 @@ LJLIB_CF(string_gsub)
   size_t srcl;
   const char *src = luaL_checklstring(L, 1, &srcl);
   const char *p = luaL_checkstring(L, 2);
+  GCstr *pat = strV(L->base+1);
   int  tr = lua_type(L, 3);
   int max_s = luaL_optint(L, 4, (int)(srcl+1));
   int anchor = (*p == '^') ? (p++, 1) : 0;
   int n = 0;
+  const PatProg *pp;
+  uint32_t gen;
   MatchState ms;
   luaL_Buffer b;
   if (!(tr == LUA_TNUMBER || tr == LUA_TSTRING ||
 	tr == LUA_TFUNCTION || tr == LUA_TTABLE))
     lj_err_arg(L, 3, LJ_ERR_NOSFT);
+  pp = pat_get(L, pat);
+  gen = G(L)->patcache.gen;
   luaL_buffinit(L, &b);
   ms.L = L;
   ms.src_init = src;
@@ -618,10 +1043,26 @@ LJLIB_CF(string_gsub)
   while (n < max_s) {
     const char *e;
     ms.level = ms.depth = 0;
-    e = match(&ms, src, p);
+    if (pp) {
+      if (!anchor) {  /* Copy the text up to the next candidate at once. */
+	const char *q = pat_next(pp, src, ms.src_end);
+	if (!q)
+	  break;
+	luaL_addlstring(&b, src, (size_t)(q-src));
+	src = q;
+      }
+      e = pat_exec(&ms, pp, src);
+    } else {
+      e = match(&ms, src, p);
+    }
     if (e) {
       n++;
       add_value(&ms, &b, src, e);
+      /* The replacement may have evicted the program from the cache. */
+      if (LJ_UNLIKELY(G(L)->patcache.gen != gen)) {
+	pp = pat_get(L, pat);
+	gen = G(L)->patcache.gen;
+      }
     }
     if (e && e>src) /* non empty match? */
       src = e;  /* skip it */
@@ -640,89 +1081,14 @@ LJLIB_CF(string_gsub)
 
 /* ------------------------------------------------------------------------ */
 
-/* Emulate tostring() inline. */
-static GCstr *string_fmt_tostring(lua_State *L, int arg, int retry)
-{
-  TValue *o = L->base+arg-1;
-  cTValue *mo;
-  lua_assert(o < L->top);  /* Caller already checks for existence. */
-  if (LJ_LIKELY(tvisstr(o)))
-    return strV(o);
-  if (retry != 2 && !tvisnil(mo = lj_meta_lookup(L, o, MM_tostring))) {
-    copyTV(L, L->top++, mo);
-    copyTV(L, L->top++, o);
-    lua_call(L, 1, 1);
-    copyTV(L, L->base+arg-1, --L->top);
-    return NULL;  /* Buffer may be overwritten, retry. */
-  }
-  return lj_strfmt_obj(L, o);
-}
-
 LJLIB_CF(string_format)		LJLIB_REC(.)
 {
-  int arg, top = (int)(L->top - L->base);
-  GCstr *fmt;
   SBuf *sb;
-  FormatState fs;
-  SFormat sf;
   int retry = 0;
-again:
-  arg = 1;
-  sb = lj_buf_tmp_(L);
-  fmt = lj_lib_checkstr(L, arg);
-  lj_strfmt_init(&fs, strdata(fmt), fmt->len);
-  while ((sf = lj_strfmt_parse(&fs)) != STRFMT_EOF) {
-    if (sf == STRFMT_LIT) {
-      lj_buf_putmem(sb, fs.str, fs.len);
-    } else if (sf == STRFMT_ERR) {
-      lj_err_callerv(L, LJ_ERR_STRFMT, strdata(lj_str_new(L, fs.str, fs.len)));
-    } else {
-      if (++arg > top)
-	luaL_argerror(L, arg, lj_obj_typename[0]);
-      switch (STRFMT_TYPE(sf)) {
-      case STRFMT_INT:
-	if (tvisint(L->base+arg-1)) {
-	  int32_t k = intV(L->base+arg-1);
-	  if (sf == STRFMT_INT)
-	    lj_strfmt_putint(sb, k);  /* Shortcut for plain %d. */
-	  else
-	    lj_strfmt_putfxint(sb, sf, k);
-	} else {
-	  lj_strfmt_putfnum_int(sb, sf, lj_lib_checknum(L, arg));
-	}
-	break;
-      case STRFMT_UINT:
-	if (tvisint(L->base+arg-1))
-	  lj_strfmt_putfxint(sb, sf, intV(L->base+arg-1));
-	else
-	  lj_strfmt_putfnum_uint(sb, sf, lj_lib_checknum(L, arg));
-	break;
-      case STRFMT_NUM:
-	lj_strfmt_putfnum(sb, sf, lj_lib_checknum(L, arg));
-	break;
-      case STRFMT_STR: {
-	GCstr *str = string_fmt_tostring(L, arg, retry);
-	if (str == NULL)
-	  retry = 1;
-	else if ((sf & STRFMT_T_QUOTED))
-	  lj_strfmt_putquoted(sb, str);  /* No formatting. */
-	else
-	  lj_strfmt_putfstr(sb, sf, str);
-	break;
-	}
-      case STRFMT_CHAR:
-	lj_strfmt_putfchar(sb, sf, lj_lib_checkint(L, arg));
-	break;
-      case STRFMT_PTR:  /* No formatting. */
-	lj_strfmt_putptr(sb, lj_obj_ptr(L->base+arg-1));
-	break;
-      default:
-	lua_assert(0);
-	break;
-      }
-    }
-  }
-  if (retry++ == 1) goto again;
+  do {
+    sb = lj_buf_tmp_(L);
+    retry = lj_strfmt_putarg(L, sb, 1, retry);
+  } while (retry++ == 1);
   setstrV(L, L->top-1, lj_buf_str(L, sb));
   lj_gc_check(L);
   return 1;
@@ -42,6 +42,19 @@
 #define DEFAULT_MMAP_THRESHOLD	((size_t)128U * (size_t)1024U)
 #define MAX_RELEASE_CHECK_RATE	255
 
+/* Small blocks are carved from pages of fixed size classes. */
+#define SLAB_PAGE		((size_t)16U * (size_t)1024U)
+#define SLAB_SHIFT		3
+#define SLAB_MAXSIZE		((size_t)256U)
+#define NSLABCLASSES		(SLAB_MAXSIZE >> SLAB_SHIFT)
+#define SLAB_AREA		((size_t)4U * (size_t)1024U * (size_t)1024U)
+#define NSLABAREAS		8
+#if LJ_GC64
+#define SLAB_AREAMAX		(SLAB_AREA << (NSLABAREAS-1))
+#else
+#define SLAB_AREAMAX		(SLAB_AREA << 4)  /* Don't waste low memory. */
+#endif
+
 /* ------------------- size_t and alignment properties -------------------- */
 
 /* The byte and bit size of a size_t */
@@ -552,6 +565,16 @@ struct malloc_state {
   mchunkptr  smallbins[(NSMALLBINS+1)*2];
   tbinptr    treebins[NTREEBINS];
   msegment   seg;
+  struct slab_page *slabs[NSLABCLASSES];  /* Pages with free blocks. */
+  struct slab_page *slabspare;  /* Empty page kept for reuse. */
+  struct slab_page *slabfree;  /* Other empty pages, memory released. */
+  char       *slabtop;  /* Never used pages of the last area. */
+  char       *slabend;
+  uint32_t   nslabarea;
+  struct {
+    char     *base;
+    size_t   size;
+  } slabarea[NSLABAREAS];  /* Mappings holding all slab pages. */
 };
 
 typedef struct malloc_state *mstate;
@@ -1262,6 +1285,9 @@ void lj_alloc_destroy(void *msp)
 {
   mstate ms = (mstate)msp;
   msegmentptr sp = &ms->seg;
+  uint32_t i;
+  for (i = 0; i < ms->nslabarea; i++)
+    CALL_MUNMAP(ms->slabarea[i].base, ms->slabarea[i].size);
   while (sp != 0) {
     char *base = sp->base;
     size_t size = sp->size;
@@ -1474,15 +1500,173 @@ static LJ_NOINLINE void *lj_alloc_realloc(void *msp, void *ptr, size_t nsize)
   }
 }
 
+/* ----------------------------------------------------------------------- */
+
+/*
+** Blocks of up to SLAB_MAXSIZE bytes come from pages holding blocks of a
+** single size class. They need no per-block header and no coalescing.
+** Pages are aligned to their size, so a block finds its page by masking
+** its address. All pages live in a few areas mapped for them alone. So a
+** block is told from a chunk of the regular heap by its address, without
+** trusting the old size passed to lj_alloc_f(). Each area is twice as big
+** as the previous one, up to SLAB_AREAMAX. Once they are used up, small
+** blocks come from the regular heap, too.
+*/
+
+typedef struct slab_page {
+  struct slab_page *next;	/* Links for the list of non-full pages. */
+  struct slab_page *prev;
+  void *free;			/* List of freed blocks. */
+  char *bump;			/* Start of never used blocks. */
+  uint32_t nused;		/* Number of blocks in use. */
+  uint32_t cls;			/* Size class. */
+} slab_page;
+
+#define slab_class(sz)		(((sz) - 1) >> SLAB_SHIFT)
+#define slab_size(cls)		(((size_t)(cls) + 1) << SLAB_SHIFT)
+#define slab_first(pg)		((char *)(pg) + \
+				 ((sizeof(slab_page) + 7) & ~(size_t)7))
+#define slab_cap(cls) \
+  ((uint32_t)((SLAB_PAGE - ((sizeof(slab_page) + 7) & ~(size_t)7)) / \
+	      slab_size(cls)))
+#define slab_pageof(p)		((slab_page *)((size_t)(p) & ~(SLAB_PAGE-1)))
+
+/* Check whether a block belongs to a slab page. */
+static LJ_AINLINE int slab_owns(mstate m, void *ptr)
+{
+  uint32_t i;
+  for (i = 0; i < m->nslabarea; i++)
+    if ((size_t)((char *)ptr - m->slabarea[i].base) < m->slabarea[i].size)
+      return 1;
+  return 0;
+}
+
+/* Map the next area for slab pages. */
+static int slab_newarea(mstate m)
+{
+  size_t size;
+  char *mem;
+  if (m->nslabarea == NSLABAREAS)
+    return 0;
+  size = SLAB_AREA << m->nslabarea;
+  if (size > SLAB_AREAMAX) size = SLAB_AREAMAX;
+  mem = (char *)CALL_MMAP(size);
+  if (mem == CMFAIL)
+    return 0;
+  m->slabarea[m->nslabarea].base = mem;
+  m->slabarea[m->nslabarea].size = size;
+  m->nslabarea++;
+  m->slabtop = (char *)(((size_t)mem + SLAB_PAGE-1) & ~(SLAB_PAGE-1));
+  m->slabend = mem + size;
+  return 1;
+}
+
+static LJ_NOINLINE void *slab_newpage(mstate m, uint32_t cls)
+{
+  slab_page *pg = m->slabspare;
+  if (pg) {
+    m->slabspare = NULL;
+  } else if ((pg = m->slabfree) != NULL) {
+    m->slabfree = pg->next;
+  } else {
+    if ((size_t)(m->slabend - m->slabtop) < SLAB_PAGE && !slab_newarea(m))
+      return NULL;
+    pg = (slab_page *)m->slabtop;
+    m->slabtop += SLAB_PAGE;
+  }
+  pg->next = pg->prev = NULL;
+  pg->free = NULL;
+  pg->bump = slab_first(pg);
+  pg->nused = 0;
+  pg->cls = cls;
+  m->slabs[cls] = pg;
+  return pg;
+}
+
+static LJ_AINLINE void *slab_malloc(mstate m, size_t nsize)
+{
+  uint32_t cls = (uint32_t)slab_class(nsize);
+  slab_page *pg = m->slabs[cls];
+  void *mem;
+  if (LJ_UNLIKELY(pg == NULL) && (pg = slab_newpage(m, cls)) == NULL)
+    return lj_alloc_malloc(m, nsize);  /* Out of slab areas. */
+  if (pg->free) {
+    mem = pg->free;
+    pg->free = *(void **)mem;
+  } else {
+    mem = pg->bump;
+    pg->bump += slab_size(cls);
+  }
+  if (++pg->nused == slab_cap(cls)) {  /* Page is full now. */
+    m->slabs[cls] = pg->next;
+    if (pg->next) pg->next->prev = NULL;
+    pg->next = NULL;
+  }
+  return mem;
+}
+
+static LJ_AINLINE void slab_free(mstate m, void *ptr)
+{
+  slab_page *pg = slab_pageof(ptr);
+  uint32_t cls = pg->cls;
+  *(void **)ptr = pg->free;
+  pg->free = ptr;
+  if (pg->nused-- == slab_cap(cls)) {  /* Page was full. */
+    pg->prev = NULL;
+    pg->next = m->slabs[cls];
+    if (pg->next) pg->next->prev = pg;
+    m->slabs[cls] = pg;
+  } else if (pg->nused == 0) {  /* Page is empty. */
+    if (pg->prev) pg->prev->next = pg->next; else m->slabs[cls] = pg->next;
+    if (pg->next) pg->next->prev = pg->prev;
+    if (m->slabspare == NULL) {
+      m->slabspare = pg;
+    } else {
+      pg->next = m->slabfree;
+      m->slabfree = pg;
+#if !LJ_ALLOC_VIRTUALALLOC
+      /* Release the memory, except for the OS page holding the link. */
+      madvise((char *)pg + LJ_PAGESIZE, SLAB_PAGE - LJ_PAGESIZE,
+	      MADV_DONTNEED);
+#endif
+    }
+  }
+}
+
+#if LJ_HASGCTHREAD
+/* Check for a directly mapped block. Freeing it is thread-safe. */
+int lj_alloc_isdirect(void *ptr)
+{
+  return is_direct(mem2chunk(ptr));
+}
+#endif
+
 void *lj_alloc_f(void *msp, void *ptr, size_t osize, size_t nsize)
 {
-  (void)osize;
+  mstate m = (mstate)msp;
+  UNUSED(osize);
   if (nsize == 0) {
+    if (slab_owns(m, ptr)) {
+      slab_free(m, ptr);
+      return NULL;
+    }
     return lj_alloc_free(msp, ptr);
   } else if (ptr == NULL) {
-    return lj_alloc_malloc(msp, nsize);
-  } else {
+    return nsize <= SLAB_MAXSIZE ? slab_malloc(m, nsize) :
+				   lj_alloc_malloc(msp, nsize);
+  } else if (!slab_owns(m, ptr)) {
     return lj_alloc_realloc(msp, ptr, nsize);
+  } else if (nsize <= SLAB_MAXSIZE &&
+	     slab_pageof(ptr)->cls == slab_class(nsize)) {
+    return ptr;  /* Same size class. */
+  } else {  /* Move to another size class or to the regular heap. */
+    size_t sz = slab_size(slab_pageof(ptr)->cls);
+    void *mem = lj_alloc_f(msp, NULL, 0, nsize);
+    if (mem != NULL) {
+      memcpy(mem, ptr, sz < nsize ? sz : nsize);
+      slab_free(m, ptr);
+    }
+    return mem;
   }
 }
 
@@ -7,11 +7,15 @@
 #define _LJ_ALLOC_H
 
 #include "lj_def.h"
+#include "lj_arch.h"
 
 #ifndef LUAJIT_USE_SYSMALLOC
 LJ_FUNC void *lj_alloc_create(void);
 LJ_FUNC void lj_alloc_destroy(void *msp);
 LJ_FUNC void *lj_alloc_f(void *msp, void *ptr, size_t osize, size_t nsize);
+#if LJ_HASGCTHREAD
+LJ_FUNC int lj_alloc_isdirect(void *ptr);
+#endif
 #endif
 
 #endif
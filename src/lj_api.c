@@ -1306,6 +1306,40 @@ LUA_API int lua_gc(lua_State *L, int what, int data)
   case LUA_GCISRUNNING:
     res = (g->gc.threshold != LJ_MAX_MEM);
     break;
+  case LUA_GCSETBUDGET:
+    res = (int)(g->gc.budget);
+    g->gc.budget = data > 0 ? (MSize)data : 0;
+    g->gc.budgetlim = 0;
+    break;
+  case LUA_GCGEN:
+    if (data > 0) g->gc.minormul = (MSize)data;
+    res = lj_gc_setkind(L, GCKgen) == GCKgen ? LUA_GCGEN : LUA_GCINC;
+    break;
+  case LUA_GCINC:
+    res = lj_gc_setkind(L, GCKinc) == GCKgen ? LUA_GCGEN : LUA_GCINC;
+    break;
+  case LUA_GCSETLIMIT: {
+    uint64_t lim = data > 0 ? (uint64_t)data << 10 : LJ_MAX_MEM;
+    res = g->gc.limit == LJ_MAX_MEM ? 0 : (int)(g->gc.limit >> 10);
+    g->gc.limit = lim < LJ_MAX_MEM ? (GCSize)lim : LJ_MAX_MEM;
+    if (g->gc.threshold != LJ_MAX_MEM && g->gc.threshold > g->gc.limit)
+      g->gc.threshold = g->gc.total;  /* Let the next GC step adapt it. */
+    break;
+  }
+  case LUA_GCFINALIZE: {
+    size_t n = lj_gc_finalize_queue(L, data > 0 ? (MSize)data : 0);
+    res = n < LJ_MAX_MEM32 ? (int)n : (int)LJ_MAX_MEM32;
+    break;
+  }
+  case LUA_GCSETFINBATCH:
+    res = (int)(g->gc.finbatch);
+    g->gc.finbatch = data > 0 ? (MSize)data : 0;
+    break;
+  case LUA_GCBGSWEEP:
+#if LJ_HASGCTHREAD
+    res = lj_gc_bgsweep(L, data);
+#endif
+    break;
   default:
     res = -1;  /* Invalid option. */
   }
@@ -505,6 +505,21 @@
 #define LJ_HASPROFILE		0
 #endif
 
+/* Sub-allocate all machine code from a single reserved region. */
+#if defined(LUAJIT_ENABLE_MCODE_POOL) && LJ_TARGET_POSIX
+#define LJ_HASMCODEPOOL		1
+#else
+#define LJ_HASMCODEPOOL		0
+#endif
+
+/* Unmap big blocks of the built-in allocator on a helper thread. */
+#if defined(LUAJIT_ENABLE_GC_THREAD) && LJ_TARGET_POSIX && \
+    !defined(LUAJIT_USE_SYSMALLOC)
+#define LJ_HASGCTHREAD		1
+#else
+#define LJ_HASGCTHREAD		0
+#endif
+
 #ifndef LJ_ARCH_HASFPU
 #define LJ_ARCH_HASFPU		1
 #endif
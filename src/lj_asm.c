@@ -886,7 +886,8 @@ static void asm_snap_alloc1(ASMState *as, IRRef ref)
 	  asm_snap_alloc1(as, (ir+1)->op2);
       } else
 #endif
-      {  /* Allocate stored values for TNEW, TDUP and CNEW. */
+      if (ir->o != IR_BUFSTR) {  /* Sunk strings are left in the buffer. */
+	/* Allocate stored values for TNEW, TDUP and CNEW. */
 	IRIns *irs;
 	lua_assert(ir->o == IR_TNEW || ir->o == IR_TDUP || ir->o == IR_CNEW);
 	for (irs = IR(as->snapref-1); irs > ir; irs--)
@@ -1097,7 +1098,7 @@ static void asm_bufhdr(ASMState *as, IRIns *ir)
 	ir = irp;
       }
     }
-  } else {
+  } else if (!(ir->op2 & IRBUFHDR_WRITE)) {
     Reg tmp = ra_scratch(as, rset_exclude(RSET_GPR, sb));
     /* Passing ir isn't strictly correct, but it's an IRT_PGC, too. */
     emit_storeofs(as, ir, tmp, sb, offsetof(SBuf, p));
@@ -1531,8 +1532,11 @@ static void asm_phi(ASMState *as, IRIns *ir)
   RegSet afree = (as->freeset & allow);
   IRIns *irl = IR(ir->op1);
   IRIns *irr = IR(ir->op2);
-  if (ir->r == RID_SINK)  /* Sink PHI. */
+  if (ir->r == RID_SINK) {  /* Sink PHI. */
+    if (irr->o == IR_BUFSTR)  /* But still append to the buffer. */
+      asm_snap_alloc1(as, irr->op1);
     return;
+  }
   /* Spill slot shuffling is not implemented yet (but rarely needed). */
   if (ra_hasspill(irl->s) || ra_hasspill(irr->s))
     lj_trace_err(as->J, LJ_TRERR_NYIPHI);
@@ -51,8 +51,9 @@ void LJ_FASTCALL lj_buf_shrink(lua_State *L, SBuf *sb)
 {
   char *b = sbufB(sb);
   MSize osz = (MSize)(sbufE(sb) - b);
-  if (osz > 2*LJ_MIN_SBUF) {
-    MSize n = (MSize)(sbufP(sb) - b);
+  MSize n = (MSize)(sbufP(sb) - b);
+  /* Keep the contents. A trace may still append to the temp. buffer. */
+  if (osz > 2*LJ_MIN_SBUF && n <= (osz >> 1)) {
     b = lj_mem_realloc(L, b, osz, (osz >> 1));
     setmref(sb->b, b);
     setmref(sb->p, b + n);
@@ -184,7 +185,8 @@ SBuf *lj_buf_puttab(SBuf *sb, GCtab *t, GCstr *sep, int32_t i, int32_t e)
       } else if (tvisint(o)) {
 	p = lj_strfmt_wint(lj_buf_more(sb, STRFMT_MAXBUF_INT+seplen), intV(o));
       } else if (tvisnum(o)) {
-	p = lj_buf_more(lj_strfmt_putfnum(sb, STRFMT_G14, numV(o)), seplen);
+	p = lj_buf_more(lj_strfmt_putfnum(sb, G(sbufL(sb))->numfmt, numV(o)),
+			seplen);
       } else {
 	goto badtype;
       }
@@ -230,3 +232,33 @@ uint32_t LJ_FASTCALL lj_buf_ruleb128(const char **pp)
   return v;
 }
 
+/* -- String buffer objects ----------------------------------------------- */
+
+/* Get a string of the next len bytes, without consuming them. */
+GCstr * LJ_FASTCALL lj_bufx_str(SBufExt *sbx, MSize len)
+{
+  MSize n = sbufxlen(sbx);
+  return lj_str_new(sbufL(&sbx->sb), sbufxR(sbx), len < n ? len : n);
+}
+
+/* Consume the next len bytes. The rest is moved down once more has been
+** consumed than is left, so alternating puts and gets don't grow the buffer.
+*/
+void LJ_FASTCALL lj_bufx_skip(SBufExt *sbx, MSize len)
+{
+  SBuf *sb = &sbx->sb;
+  MSize n = sbufxlen(sbx);
+  if (len >= n) {
+    lj_buf_reset(sb);
+    sbx->r = 0;
+  } else {
+    sbx->r += len;
+    n -= len;
+    if (sbx->r >= n) {
+      char *b = sbufB(sb);
+      memmove(b, b + sbx->r, n);
+      setsbufP(sb, b + n);
+      sbx->r = 0;
+    }
+  }
+}
@@ -100,4 +100,16 @@ static LJ_AINLINE GCstr *lj_buf_str(lua_State *L, SBuf *sb)
   return lj_str_new(L, sbufB(sb), sbuflen(sb));
 }
 
+/* String buffer objects. The payload of a userdata with UDTYPE_BUFFER. */
+typedef struct SBufExt {
+  SBuf sb;		/* Buffer. The data left to read is [b+r, p). */
+  MSize r;		/* Read offset. */
+} SBufExt;
+
+#define sbufxR(sbx)	(sbufB(&(sbx)->sb) + (sbx)->r)
+#define sbufxlen(sbx)	(sbuflen(&(sbx)->sb) - (sbx)->r)
+
+LJ_FUNCA GCstr * LJ_FASTCALL lj_bufx_str(SBufExt *sbx, MSize len);
+LJ_FUNCA void LJ_FASTCALL lj_bufx_skip(SBufExt *sbx, MSize len);
+
 #endif
@@ -66,6 +66,7 @@ void LJ_FASTCALL lj_cdata_free(global_State *g, GCcdata *cd)
     GCobj *root;
     makewhite(g, obj2gco(cd));
     markfinalized(obj2gco(cd));
+    g->gc.finnum++;
     if ((root = gcref(g->gc.mmudata)) != NULL) {
       setgcrefr(cd->nextgc, root->gch.nextgc);
       setgcref(root->gch.nextgc, obj2gco(cd));
@@ -579,9 +579,9 @@ GCstr *lj_ctype_repr_complex(lua_State *L, void *sp, CTSize size)
   } else {
     re.n = (double)*(float *)sp; im.n = (double)((float *)sp)[1];
   }
-  lj_strfmt_putfnum(sb, STRFMT_G14, re.n);
+  lj_strfmt_putfnum(sb, G(L)->numfmt, re.n);
   if (!(im.u32.hi & 0x80000000u) || im.n != im.n) lj_buf_putchar(sb, '+');
-  lj_strfmt_putfnum(sb, STRFMT_G14, im.n);
+  lj_strfmt_putfnum(sb, G(L)->numfmt, im.n);
   lj_buf_putchar(sb, sbufP(sb)[-1] >= 'a' ? 'I' : 'i');
   return lj_buf_str(L, sb);
 }
@@ -11,6 +11,7 @@
 #if LJ_HASJIT
 
 #include "lj_err.h"
+#include "lj_buf.h"
 #include "lj_str.h"
 #include "lj_tab.h"
 #include "lj_frame.h"
@@ -964,26 +965,98 @@ static void LJ_FASTCALL recff_string_find(jit_State *J, RecordFFData *rd)
   }
 }
 
-static void LJ_FASTCALL recff_string_format(jit_State *J, RecordFFData *rd)
+/* Put the type and address of an object, like tostring() does. */
+static TRef recff_format_putobj(jit_State *J, TRef tr, TRef tra, cTValue *o,
+				int withtype)
+{
+  if (withtype) {
+    const char *tn = lj_typename(o);
+    SBuf *sb = lj_buf_tmp_(J->L);
+    lj_buf_putmem(lj_buf_putmem(sb, tn, (MSize)strlen(tn)), ": ", 2);
+    tr = emitir(IRT(IR_BUFPUT, IRT_PGC), tr,
+		lj_ir_kstr(J, lj_buf_str(J->L, sb)));
+  }
+  if (tref_isudata(tra))  /* Same pointer as lj_obj_ptr(). */
+    tra = emitir(IRT(IR_ADD, IRT_PTR), tra, lj_ir_kintp(J, sizeof(GCudata)));
+  return lj_ir_call(J, IRCALL_lj_strfmt_putptr, tr, tra);
+}
+
+/* Check the arguments of a format and emit all of its guards. The puts must
+** follow them, because an exit redoes the whole call in the interpreter and
+** a buffer object must not see the output twice.
+*/
+static int recff_format_check(jit_State *J, RecordFFData *rd,
+			      const FormatProg *fp, int arg)
+{
+  MSize i;
+  for (i = 0; i < fp->nitem; i++) {
+    SFormat sf = fp->item[i].sf;
+    TRef tra;
+    cTValue *o;
+    if (sf == STRFMT_LIT)
+      continue;
+    if (sf == STRFMT_ERR || !(tra = J->base[arg]))
+      return 0;  /* Interpreter will throw. */
+    o = &rd->argv[arg++];
+    switch (STRFMT_TYPE(sf)) {
+    case STRFMT_INT: case STRFMT_UINT: case STRFMT_NUM:
+      if (tref_isstr(tra))
+	lj_ir_tonum(J, tra);  /* Same guard is CSEd below. */
+      break;
+    case STRFMT_STR:
+      if (!tref_isstr(tra)) {  /* Emulate tostring(). */
+	RecordIndex ix;
+	ix.tab = tra;
+	copyTV(J->L, &ix.tabv, o);
+	if (lj_record_mm_lookup(J, &ix, MM_tostring))
+	  return 0;  /* NYI: __tostring. */
+	if (!(tref_isnumber(tra) || tref_ispri(tra) ||
+	      (sf == STRFMT_STR && (tref_istab(tra) || tref_isudata(tra)))))
+	  return 0;  /* NYI: other types or formatted objects. */
+      }
+      break;
+    case STRFMT_CHAR:
+      lj_opt_narrow_toint(J, tra);  /* Same guard is CSEd below. */
+      break;
+    case STRFMT_PTR:
+      if (!(tref_isstr(tra) || tref_istab(tra) || tref_isfunc(tra) ||
+	    tref_isudata(tra) || tref_isnumber(tra) || tref_ispri(tra)))
+	return 0;  /* NYI: light userdata and cdata. */
+      break;
+    default:
+      break;
+    }
+  }
+  return 1;
+}
+
+/* Record the format string at base[arg] and the arguments following it.
+** Returns the last buffer op or 0 if recording is NYI.
+*/
+static TRef recff_format(jit_State *J, TRef hdr, RecordFFData *rd, int arg)
 {
-  TRef trfmt = lj_ir_tostr(J, J->base[0]);
-  GCstr *fmt = argv2str(J, &rd->argv[0]);
-  int arg = 1;
-  TRef hdr, tr;
-  FormatState fs;
-  SFormat sf;
+  TRef trfmt = lj_ir_tostr(J, J->base[arg]);
+  GCstr *fmt = argv2str(J, &rd->argv[arg]);
+  const FormatProg *fp = lj_strfmt_prog(J->L, fmt);
+  TRef tr = hdr;
+  MSize i;
   /* Specialize to the format string. */
   emitir(IRTG(IR_EQ, IRT_STR), trfmt, lj_ir_kstr(J, fmt));
-  tr = hdr = recff_bufhdr(J);
-  lj_strfmt_init(&fs, strdata(fmt), fmt->len);
-  while ((sf = lj_strfmt_parse(&fs)) != STRFMT_EOF) {  /* Parse format. */
+  if (!recff_format_check(J, rd, fp, ++arg)) {
+    recff_nyiu(J, rd);
+    return 0;
+  }
+  for (i = 0; i < fp->nitem; i++) {  /* Use the parsed format. */
+    const FormatItem *fi = &fp->item[i];
+    SFormat sf = fi->sf;
     TRef tra = sf == STRFMT_LIT ? 0 : J->base[arg++];
+    cTValue *o = &rd->argv[arg-1];
     TRef trsf = lj_ir_kint(J, (int32_t)sf);
     IRCallID id;
     switch (STRFMT_TYPE(sf)) {
     case STRFMT_LIT:
       tr = emitir(IRT(IR_BUFPUT, IRT_PGC), tr,
-		  lj_ir_kstr(J, lj_str_new(J->L, fs.str, fs.len)));
+		  lj_ir_kstr(J, lj_str_new(J->L, strfmt_text(fp, fi), fi->len)));
       break;
     case STRFMT_INT:
       id = IRCALL_lj_strfmt_putfnum_int;
@@ -1000,8 +1073,7 @@ static void LJ_FASTCALL recff_string_format(jit_State *J, RecordFFData *rd)
 	tr = lj_ir_call(J, IRCALL_lj_strfmt_putfxint, tr, trsf, tra);
 	lj_needsplit(J);
 #else
-	recff_nyiu(J, rd);  /* Don't bother working around this NYI. */
-	return;
+	goto handle_num;  /* Same result, an int32_t is exact as a number. */
 #endif
       }
       break;
@@ -1016,9 +1088,16 @@ static void LJ_FASTCALL recff_string_format(jit_State *J, RecordFFData *rd)
       if (LJ_SOFTFP) lj_needsplit(J);
       break;
     case STRFMT_STR:
-      if (!tref_isstr(tra)) {
-	recff_nyiu(J, rd);  /* NYI: __tostring and non-string types for %s. */
-	return;
+      if (!tref_isstr(tra)) {  /* Checked above, there's no __tostring. */
+	if (tref_isnumber(tra)) {
+	  tra = emitir(IRT(IR_TOSTR, IRT_STR), tra,
+		       tref_isnum(tra) ? IRTOSTR_NUM : IRTOSTR_INT);
+	} else if (tref_ispri(tra)) {
+	  tra = lj_ir_kstr(J, lj_strfmt_obj(J->L, o));
+	} else {
+	  tr = recff_format_putobj(J, tr, tra, o, 1);
+	  break;
+	}
       }
       if (sf == STRFMT_STR)  /* Shortcut for plain %s. */
 	tr = emitir(IRT(IR_BUFPUT, IRT_PGC), tr, tra);
@@ -1035,14 +1114,27 @@ static void LJ_FASTCALL recff_string_format(jit_State *J, RecordFFData *rd)
       else
 	tr = lj_ir_call(J, IRCALL_lj_strfmt_putfchar, tr, trsf, tra);
       break;
-    case STRFMT_PTR:  /* NYI */
-    case STRFMT_ERR:
+    case STRFMT_PTR:  /* No formatting. */
+      if (tref_isnumber(tra) || tref_ispri(tra))
+	tr = emitir(IRT(IR_BUFPUT, IRT_PGC), tr, lj_ir_kstr(J,
+		    lj_str_newlit(J->L, "NULL")));  /* lj_obj_ptr() is NULL. */
+      else
+	tr = recff_format_putobj(J, tr, tra, o, 0);
+      break;
     default:
-      recff_nyiu(J, rd);
-      return;
+      lua_assert(0);
+      break;
     }
   }
-  J->base[0] = emitir(IRT(IR_BUFSTR, IRT_STR), tr, hdr);
+  return tr;
+}
+
+static void LJ_FASTCALL recff_string_format(jit_State *J, RecordFFData *rd)
+{
+  TRef hdr = recff_bufhdr(J);
+  TRef tr = recff_format(J, hdr, rd, 0);
+  if (tr)
+    J->base[0] = emitir(IRT(IR_BUFSTR, IRT_STR), tr, hdr);
 }
 
 /* -- Table library fast functions ---------------------------------------- */
@@ -1171,6 +1263,118 @@ static void LJ_FASTCALL recff_io_flush(jit_State *J, RecordFFData *rd)
   J->base[0] = TREF_TRUE;
 }
 
+/* -- Buffer library fast functions --------------------------------------- */
+
+/* Get a pointer to the SBufExt of a buffer object. The SBuf must use the
+** current thread for its allocations, same as in buffer_tobuf().
+*/
+static TRef recff_sbufx(jit_State *J)
+{
+  TRef tr, trl, ud = J->base[0];
+  if (!tref_isudata(ud))
+    lj_trace_err(J, LJ_TRERR_BADTYPE);
+  tr = emitir(IRT(IR_FLOAD, IRT_U8), ud, IRFL_UDATA_UDTYPE);
+  emitir(IRTGI(IR_EQ), tr, lj_ir_kint(J, UDTYPE_BUFFER));
+#if LJ_GC64
+  trl = lj_ir_ggfload(J, IRT_THREAD, GG_OFS(g.cur_L));
+#else
+  trl = emitir(IRT(IR_XLOAD, IRT_THREAD), lj_ir_kptr(J, &J2G(J)->cur_L), 0);
+#endif
+  tr = emitir(IRT(IR_ADD, IRT_PTR), ud,
+	      lj_ir_kintp(J, sizeof(GCudata) + offsetof(SBuf, L)));
+  emitir(IRT(IR_XSTORE, IRT_THREAD), tr, trl);
+  return emitir(IRT(IR_ADD, IRT_PTR), ud, lj_ir_kintp(J, sizeof(GCudata)));
+}
+
+/* Get the length argument of get() or skip(). Negative lengths throw. */
+static TRef recff_sbufx_len(jit_State *J, RecordFFData *rd, ptrdiff_t arg)
+{
+  TRef tr = J->base[arg];
+  if (!tr || tref_isnil(tr))
+    return lj_ir_kint(J, LJ_MAX_BUF);
+  if (!tref_isnumber(tr)) {
+    recff_nyiu(J, rd);
+    return 0;
+  }
+  tr = lj_opt_narrow_toint(J, tr);
+  emitir(IRTGI(IR_GE), tr, lj_ir_kint(J, 0));
+  return tr;
+}
+
+/* The buffer ops have no result, but must not be eliminated. */
+static void recff_sbufx_use(jit_State *J, TRef tr)
+{
+  emitir(IRT(IR_USE, IRT_NIL), tr, 0);
+  J->needsnap = 1;
+}
+
+static void LJ_FASTCALL recff_buffer_method_put(jit_State *J, RecordFFData *rd)
+{
+  TRef sbx = recff_sbufx(J), tr;
+  ptrdiff_t i;
+  for (i = 1; J->base[i]; i++)
+    if (!(tref_isstr(J->base[i]) || tref_isnumber(J->base[i]))) {
+      recff_nyiu(J, rd);  /* NYI: buffer objects. Interpreter throws else. */
+      return;
+    }
+  tr = emitir(IRT(IR_BUFHDR, IRT_PGC), sbx, IRBUFHDR_WRITE);
+  for (i = 1; J->base[i]; i++)
+    tr = emitir(IRT(IR_BUFPUT, IRT_PGC), tr, lj_ir_tostr(J, J->base[i]));
+  recff_sbufx_use(J, tr);
+}
+
+static void LJ_FASTCALL recff_buffer_method_putf(jit_State *J, RecordFFData *rd)
+{
+  TRef sbx = recff_sbufx(J);
+  TRef tr = recff_format(J, emitir(IRT(IR_BUFHDR, IRT_PGC), sbx,
+				   IRBUFHDR_WRITE), rd, 1);
+  if (tr)
+    recff_sbufx_use(J, tr);
+}
+
+static void LJ_FASTCALL recff_buffer_method_get(jit_State *J, RecordFFData *rd)
+{
+  TRef sbx = recff_sbufx(J);
+  TRef len[LJ_MAX_JSLOTS];
+  ptrdiff_t i, n = 1;
+  while (J->base[n]) n++;
+  if (n > 1) n--;  /* Without arguments, get everything. */
+  for (i = 0; i < n; i++)  /* Check all arguments before any side effect. */
+    if (!(len[i] = recff_sbufx_len(J, rd, i+1)))
+      return;
+  for (i = 0; i < n; i++) {
+    J->base[i] = lj_ir_call(J, IRCALL_lj_bufx_str, sbx, len[i]);
+    lj_ir_call(J, IRCALL_lj_bufx_skip, sbx, len[i]);
+  }
+  rd->nres = n;
+}
+
+static void LJ_FASTCALL recff_buffer_method_skip(jit_State *J, RecordFFData *rd)
+{
+  TRef sbx = recff_sbufx(J);
+  if (J->base[1] && !tref_isnil(J->base[1])) {
+    TRef len = recff_sbufx_len(J, rd, 1);
+    if (len)
+      lj_ir_call(J, IRCALL_lj_bufx_skip, sbx, len);
+  }  /* else: Interpreter will throw. */
+}
+
+static void LJ_FASTCALL recff_buffer_method_reset(jit_State *J, RecordFFData *rd)
+{
+  TRef sbx = recff_sbufx(J);
+  lj_ir_call(J, IRCALL_lj_bufx_skip, sbx, lj_ir_kint(J, LJ_MAX_BUF));
+  UNUSED(rd);
+}
+
+static void LJ_FASTCALL recff_buffer_method_tostring(jit_State *J,
+						     RecordFFData *rd)
+{
+  TRef sbx = recff_sbufx(J);
+  J->base[0] = lj_ir_call(J, IRCALL_lj_bufx_str, sbx,
+			  lj_ir_kint(J, LJ_MAX_BUF));
+  UNUSED(rd);
+}
+
 /* -- Debug library fast functions ---------------------------------------- */
 
 static void LJ_FASTCALL recff_debug_getmetatable(jit_State *J, RecordFFData *rd)
@@ -26,17 +26,57 @@
 #endif
 #include "lj_trace.h"
 #include "lj_vm.h"
+#include "lj_heapdump.h"
+
+#if LJ_TARGET_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if LJ_HASGCTHREAD
+#include <pthread.h>
+#include "lj_alloc.h"
+#endif
 
 #define GCSTEPSIZE	1024u
 #define GCSWEEPMAX	40
 #define GCSWEEPCOST	10
 #define GCFINALIZECOST	100
+#define GCTRAVSLOTS	1024	/* Traverse bigger objects in chunks. */
+#define GCBUDGETMIN	256	/* Minimum work limit of a GC step with a budget. */
+#define GCSTEPSAMPLE	16	/* Without a budget, time every n-th GC step. */
+#define GCSTRREHASH	64	/* String hash chains rehashed per GC step. */
 
 /* Macros to set GCobj colors and flags. */
 #define white2gray(x)		((x)->gch.marked &= (uint8_t)~LJ_GC_WHITES)
 #define gray2black(x)		((x)->gch.marked |= LJ_GC_BLACK)
 #define isfinalized(u)		((u)->marked & LJ_GC_FINALIZED)
 
+/*
+** Generational mode keeps the objects that survived a sweep black ("old")
+** instead of turning them white again. A minor cycle only marks from the
+** roots, the gray threads and weak tables left over from the last atomic
+** phase and the objects put on the gray lists by the write barriers (the
+** remembered set). Old objects are never traversed again, unless a barrier
+** makes them gray. The sweep stops at the first old object of the root list,
+** the userdata list and each string chain, since new objects are always
+** added to the head of these lists.
+**
+** Unreachable old objects are only freed by a major cycle. It first sweeps
+** everything to white and then runs a regular cycle from scratch.
+*/
+#define gc_isminor(g) \
+  ((g)->gc.kind == GCKgen && (g)->gc.genphase == GCGminor)
+#define gc_keepold(g) \
+  ((g)->gc.kind == GCKgen && (g)->gc.genphase != GCGwhiten)
+
+/* Barriers need to preserve the invariant: no black to white references. */
+#define gc_keepinvariant(g) \
+  ((g)->gc.state == GCSpropagate || (g)->gc.state == GCSatomic || \
+   gc_keepold(g))
+
 /* -- Mark phase ---------------------------------------------------------- */
 
 /* Mark a TValue (if needed). */
@@ -87,9 +127,12 @@ static void gc_mark_gcroot(global_State *g)
 /* Start a GC cycle and mark the root set. */
 static void gc_mark_start(global_State *g)
 {
-  setgcrefnull(g->gc.gray);
-  setgcrefnull(g->gc.grayagain);
-  setgcrefnull(g->gc.weak);
+  g->gc.remarked = 0;
+  if (!gc_isminor(g)) {  /* Minor cycles keep the remembered set. */
+    setgcrefnull(g->gc.gray);
+    setgcrefnull(g->gc.grayagain);
+    setgcrefnull(g->gc.weak);
+  }
   gc_markobj(g, mainthread(g));
   gc_markobj(g, tabref(mainthread(g)->env));
   gc_marktv(g, &g->registrytv);
@@ -127,8 +170,8 @@ size_t lj_gc_separateudata(global_State *g, int all)
 {
   size_t m = 0;
   GCRef *p = &mainthread(g)->nextgc;
-  GCobj *o;
-  while ((o = gcref(*p)) != NULL) {
+  GCobj *o, *old = all ? NULL : gcref(g->gc.oldudata);
+  while ((o = gcref(*p)) != NULL && o != old) {
     if (!(iswhite(o) || all) || isfinalized(gco2ud(o))) {
       p = &o->gch.nextgc;  /* Nothing to do. */
     } else if (!lj_meta_fastg(g, tabref(gco2ud(o)->metatable), MM_gc)) {
@@ -137,6 +180,7 @@ size_t lj_gc_separateudata(global_State *g, int all)
     } else {  /* Otherwise move userdata to be finalized to mmudata list. */
       m += sizeudata(gco2ud(o));
       markfinalized(o);
+      g->gc.finnum++;
       *p = o->gch.nextgc;
       if (gcref(g->gc.mmudata)) {  /* Link to end of mmudata list. */
 	GCobj *root = gcref(g->gc.mmudata);
@@ -186,6 +230,16 @@ static int gc_traverse_tab(global_State *g, GCtab *t)
   }
   if (weak == LJ_GC_WEAK)  /* Nothing to mark if both keys/values are weak. */
     return 1;
+  if (!weak && g->gc.state == GCSpropagate &&
+      t->asize + t->hmask >= GCTRAVSLOTS) {
+    /* Huge table: mark it in chunks with the table already black. A store
+    ** or a new key turns it gray again for the atomic phase, like for any
+    ** other black table.
+    */
+    setgcref(g->gc.trav, obj2gco(t));
+    g->gc.travpos = 0;
+    return 0;
+  }
   if (!(weak & LJ_GC_WEAKVAL)) {  /* Mark array part. */
     MSize i, asize = t->asize;
     for (i = 0; i < asize; i++)
@@ -293,6 +347,13 @@ static MSize gc_traverse_frames(global_State *g, lua_State *th)
 static void gc_traverse_thread(global_State *g, lua_State *th)
 {
   TValue *o, *top = th->top;
+  if (g->gc.state == GCSpropagate &&
+      top - tvref(th->stack) >= GCTRAVSLOTS) {
+    /* Huge stack: mark it in chunks. It's traversed again atomically. */
+    setgcref(g->gc.trav, obj2gco(th));
+    g->gc.travpos = 1+LJ_FR2;
+    return;
+  }
   for (o = tvref(th->stack)+1+LJ_FR2; o < top; o++)
     gc_marktv(g, o);
   if (g->gc.state == GCSatomic) {
@@ -304,11 +365,53 @@ static void gc_traverse_thread(global_State *g, lua_State *th)
   lj_state_shrinkstack(th, gc_traverse_frames(g, th));
 }
 
+/* Traverse the next chunk of a huge table or stack. */
+static size_t gc_traverse_chunk(global_State *g)
+{
+  GCobj *o = gcref(g->gc.trav);
+  MSize i = g->gc.travpos, n, lim = i + GCTRAVSLOTS;
+  if (o->gch.gct == ~LJ_TTAB) {
+    GCtab *t = gco2tab(o);
+    Node *node = noderef(t->node);
+    MSize asize = t->asize;
+    n = asize + t->hmask + 1;
+    if (lim > n) lim = n;
+    for (; i < lim && i < asize; i++)
+      gc_marktv(g, arrayslot(t, i));
+    for (; i < lim; i++) {
+      Node *nd = &node[i - asize];
+      if (!tvisnil(&nd->val)) {  /* Mark non-empty slot. */
+	gc_marktv(g, &nd->key);
+	gc_marktv(g, &nd->val);
+      }
+    }
+  } else {
+    lua_State *th = gco2th(o);
+    TValue *stack = tvref(th->stack);
+    n = (MSize)(th->top - stack);  /* The stack may have been resized. */
+    if (lim > n) lim = n;
+    for (; i < lim; i++)
+      gc_marktv(g, &stack[i]);
+    if (i >= n) {
+      gc_markobj(g, tabref(th->env));
+      lj_state_shrinkstack(th, gc_traverse_frames(g, th));
+    }
+  }
+  if (i >= n)
+    setgcrefnull(g->gc.trav);  /* Done. */
+  else
+    g->gc.travpos = i;
+  return GCTRAVSLOTS * sizeof(TValue);
+}
+
 /* Propagate one gray object. Traverse it and turn it black. */
 static size_t propagatemark(global_State *g)
 {
   GCobj *o = gcref(g->gc.gray);
-  int gct = o->gch.gct;
+  int gct;
+  if (gcref(g->gc.trav))  /* Finish a partial traversal first. */
+    return gc_traverse_chunk(g);
+  gct = o->gch.gct;
   lua_assert(isgray(o));
   gray2black(o);
   setgcrefr(g->gc.gray, o->gch.gclist);  /* Remove from gray list. */
@@ -316,6 +419,8 @@ static size_t propagatemark(global_State *g)
     GCtab *t = gco2tab(o);
     if (gc_traverse_tab(g, t) > 0)
       black2gray(o);  /* Keep weak tables gray. */
+    else if (gcref(g->gc.trav) == o)
+      return sizeof(GCtab);  /* Marked in chunks. */
     return sizeof(GCtab) + sizeof(TValue) * t->asize +
 			   (t->hmask ? sizeof(Node) * (t->hmask + 1) : 0);
   } else if (LJ_LIKELY(gct == ~LJ_TFUNC)) {
@@ -333,6 +438,8 @@ static size_t propagatemark(global_State *g)
     setgcref(g->gc.grayagain, o);
     black2gray(o);  /* Threads are never black. */
     gc_traverse_thread(g, th);
+    if (gcref(g->gc.trav) == o)
+      return sizeof(lua_State);  /* Marked in chunks. */
     return sizeof(lua_State) + sizeof(TValue) * th->stacksize;
   } else {
 #if LJ_HASJIT
@@ -351,7 +458,7 @@ static size_t propagatemark(global_State *g)
 static size_t gc_propagate_gray(global_State *g)
 {
   size_t m = 0;
-  while (gcref(g->gc.gray) != NULL)
+  while (gcref(g->gc.gray) != NULL || gcref(g->gc.trav) != NULL)
     m += propagatemark(g);
   return m;
 }
@@ -409,6 +516,47 @@ static GCRef *gc_sweep(global_State *g, GCRef *p, uint32_t lim)
   return p;
 }
 
+/* Partial sweep of a GC list in generational mode. Survivors stay old. */
+static GCRef *gc_sweep_old(global_State *g, GCRef *p, GCobj *stop,
+			   uint32_t lim)
+{
+  int ow = otherwhite(g);
+  GCobj *o;
+  while ((o = gcref(*p)) != NULL && o != stop && lim-- > 0) {
+    if (o->gch.gct == ~LJ_TTHREAD)  /* Open upvalues are not ordered by age. */
+      gc_sweep_old(g, &gco2th(o)->openupval, NULL, ~(uint32_t)0);
+    if (((o->gch.marked ^ LJ_GC_WHITES) & ow)) {  /* Black or current white? */
+      lua_assert(!isdead(g, o) || (o->gch.marked & LJ_GC_FIXED));
+      p = &o->gch.nextgc;  /* Value is alive, keep its color. */
+    } else {  /* Otherwise value is dead, free it. */
+      lua_assert(isdead(g, o));
+      setgcrefr(*p, o->gch.nextgc);
+      if (o == gcref(g->gc.root))
+	setgcrefr(g->gc.root, o->gch.nextgc);  /* Adjust list anchor. */
+      if (o == gcref(g->gc.sweptroot))  /* Adjust future boundaries, too. */
+	setgcrefr(g->gc.sweptroot, o->gch.nextgc);
+      if (o == gcref(g->gc.sweptudata))
+	setgcrefr(g->gc.sweptudata, o->gch.nextgc);
+      gc_freefunc[o->gch.gct - ~LJ_TSTR](g, o);
+    }
+  }
+  return p;
+}
+
+#if LUAJIT_SMART_STRINGS
+/* Add a surviving string to the bloom filter for the next cycle. */
+static LJ_AINLINE void gc_bloom_str(global_State *g, GCstr *s)
+{
+  if (strsmart(s)) {
+    /* must match lj_str_new */
+    bloomset(g->strbloom.next[0], s->hash >> (sizeof(s->hash)*8-6));
+    bloomset(g->strbloom.next[1], s->strflags);
+  }
+}
+#else
+#define gc_bloom_str(g, s)	UNUSED(g)
+#endif
+
 /* Full sweep of a string chain. */
 static GCRef *gc_sweep_str_chain(global_State *g, GCRef *p)
 {
@@ -419,13 +567,7 @@ static GCRef *gc_sweep_str_chain(global_State *g, GCRef *p)
     if (((o->gch.marked ^ LJ_GC_WHITES) & ow)) {  /* Black or current white? */
       lua_assert(!isdead(g, o) || (o->gch.marked & LJ_GC_FIXED));
       makewhite(g, o);  /* Value is alive, change to the current white. */
-#if LUAJIT_SMART_STRINGS
-      if (strsmart(&o->str)) {
-	/* must match lj_str_new */
-	bloomset(g->strbloom.next[0], o->str.hash >> (sizeof(o->str.hash)*8-6));
-	bloomset(g->strbloom.next[1], o->str.strflags);
-      }
-#endif
+      gc_bloom_str(g, &o->str);
       p = &o->gch.nextgc;
     } else {  /* Otherwise value is dead, free it. */
       lua_assert(isdead(g, o) || ow == LJ_GC_SFIXED);
@@ -436,6 +578,28 @@ static GCRef *gc_sweep_str_chain(global_State *g, GCRef *p)
   return p;
 }
 
+/* Sweep of a string chain in generational mode. Survivors stay old. */
+static void gc_sweep_str_old(global_State *g, GCRef *p, int minor)
+{
+  int ow = otherwhite(g);
+  GCobj *o;
+  while ((o = gcref(*p)) != NULL) {
+    if (minor && (o->gch.marked & LJ_GC_OLD))
+      break;  /* The rest of the chain is old. */
+    if (((o->gch.marked ^ LJ_GC_WHITES) & ow)) {  /* Black or current white? */
+      lua_assert(!isdead(g, o) || (o->gch.marked & LJ_GC_FIXED));
+      if (!iswhite(o))  /* Strings created during the sweep stay young. */
+	o->gch.marked |= LJ_GC_OLD;
+      gc_bloom_str(g, &o->str);
+      p = &o->gch.nextgc;
+    } else {  /* Otherwise value is dead, free it. */
+      lua_assert(isdead(g, o));
+      setgcrefr(*p, o->gch.nextgc);
+      lj_str_free(g, &o->str);
+    }
+  }
+}
+
 /* Check whether we can clear a key or a value slot from a table. */
 static int gc_mayclear(cTValue *o, int val)
 {
@@ -518,6 +682,8 @@ static void gc_finalize(lua_State *L)
     setgcrefnull(g->gc.mmudata);
   else
     setgcrefr(gcref(g->gc.mmudata)->gch.nextgc, o->gch.nextgc);
+  g->gc.finnum--;
+  g->gc.finalized++;
 #if LJ_HASFFI
   if (o->gch.gct == ~LJ_TCDATA) {
     TValue tmp, *tv;
@@ -583,17 +749,239 @@ void lj_gc_finalize_cdata(lua_State *L)
 /* Free all remaining GC objects. */
 void lj_gc_freeall(global_State *g)
 {
-  MSize i, strmask;
+  MSize i, nchains;
   /* Free everything, except super-fixed objects (the main thread). */
   g->gc.currentwhite = LJ_GC_WHITES | LJ_GC_SFIXED;
   gc_fullsweep(g, &g->gc.root);
-  strmask = g->strmask;
-  for (i = 0; i <= strmask; i++)  /* Free all string hash chains. */
-    gc_fullsweep(g, &g->strhash[i]);
+  nchains = lj_str_nchains(g);
+  for (i = 0; i < nchains; i++)  /* Free all string hash chains. */
+    gc_fullsweep(g, lj_str_chain(g, i));
+}
+
+/* -- Background sweeping ------------------------------------------------- */
+
+#if LJ_HASGCTHREAD
+
+/*
+** Releasing big blocks back to the OS (munmap) is the most expensive part of
+** freeing them, e.g. the array or hash part of a huge table in the sweep
+** phase. The built-in allocator maps such blocks directly and unmapping them
+** doesn't touch any allocator state. So these blocks are handed to a helper
+** thread, linked through their own (dead) memory. Everything else is still
+** freed right away by the mutator.
+*/
+
+#define GCBGMINSIZE	(64u << 10)	/* Smaller blocks are never mapped directly. */
+
+typedef struct GCBlock {
+  struct GCBlock *next;		/* Next block to be freed. */
+  size_t sz;			/* Size of this block. */
+} GCBlock;
+
+typedef struct GCSweeper {
+  void *allocd;			/* Built-in allocator state. */
+  pthread_mutex_t lock;		/* Protects the fields below. */
+  pthread_cond_t cond;		/* Signals new pending blocks or quit. */
+  pthread_t thread;		/* Helper thread. */
+  GCBlock *pending;		/* Blocks to be freed by the helper thread. */
+  int quit;			/* Helper thread should exit. */
+} GCSweeper;
+
+/* Helper thread main loop. */
+static void *gc_bg_main(void *ud)
+{
+  GCSweeper *sw = (GCSweeper *)ud;
+  pthread_mutex_lock(&sw->lock);
+  for (;;) {
+    GCBlock *b = sw->pending;
+    if (b) {
+      sw->pending = NULL;
+      pthread_mutex_unlock(&sw->lock);
+      while (b) {
+	GCBlock *next = b->next;
+	lj_alloc_f(sw->allocd, b, b->sz, 0);
+	b = next;
+      }
+      pthread_mutex_lock(&sw->lock);
+    } else if (sw->quit) {
+      break;  /* Exit only after all pending blocks are freed. */
+    } else {
+      pthread_cond_wait(&sw->cond, &sw->lock);
+    }
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+/* Memory allocator wrapper, installed while the helper thread runs. */
+static void *gc_bg_alloc(void *ud, void *p, size_t osz, size_t nsz)
+{
+  GCSweeper *sw = (GCSweeper *)ud;
+  if (nsz == 0 && osz >= GCBGMINSIZE && !sw->quit && lj_alloc_isdirect(p)) {
+    GCBlock *b = (GCBlock *)p;
+    b->sz = osz;
+    pthread_mutex_lock(&sw->lock);
+    b->next = sw->pending;
+    sw->pending = b;
+    pthread_cond_signal(&sw->cond);
+    pthread_mutex_unlock(&sw->lock);
+    return NULL;
+  }
+  return lj_alloc_f(sw->allocd, p, osz, nsz);
+}
+
+/* Stop the helper thread. The wrapper frees everything directly after that. */
+static void gc_bg_quit(GCSweeper *sw)
+{
+  if (!sw->quit) {
+    pthread_mutex_lock(&sw->lock);
+    sw->quit = 1;
+    pthread_cond_signal(&sw->cond);
+    pthread_mutex_unlock(&sw->lock);
+    pthread_join(sw->thread, NULL);
+  }
+}
+
+/* Free the sweeper. Returns the state of the built-in allocator. */
+void *lj_gc_bgfree(struct GCSweeper *sw)
+{
+  void *allocd = sw->allocd;
+  gc_bg_quit(sw);
+  pthread_cond_destroy(&sw->cond);
+  pthread_mutex_destroy(&sw->lock);
+  lj_alloc_f(allocd, sw, sizeof(GCSweeper), 0);
+  return allocd;
+}
+
+/* Start or stop the background sweeper. Returns whether it's running. */
+int lj_gc_bgsweep(lua_State *L, int on)
+{
+  global_State *g = G(L);
+  GCSweeper *sw = g->gc.sweeper;
+  if (on && !sw && g->allocf == lj_alloc_f) {
+    sw = (GCSweeper *)lj_alloc_f(g->allocd, NULL, 0, sizeof(GCSweeper));
+    if (!sw) return 0;
+    memset(sw, 0, sizeof(GCSweeper));
+    sw->allocd = g->allocd;
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_cond_init(&sw->cond, NULL);
+    if (pthread_create(&sw->thread, NULL, gc_bg_main, sw) != 0) {
+      pthread_cond_destroy(&sw->cond);
+      pthread_mutex_destroy(&sw->lock);
+      lj_alloc_f(g->allocd, sw, sizeof(GCSweeper), 0);
+      return 0;
+    }
+    g->allocf = gc_bg_alloc;
+    g->allocd = sw;
+    g->gc.sweeper = sw;
+  } else if (!on && sw && g->allocf == gc_bg_alloc) {
+    g->allocf = lj_alloc_f;
+    g->allocd = lj_gc_bgfree(sw);
+    g->gc.sweeper = NULL;
+  }
+  return g->gc.sweeper != NULL;
+}
+
+/*
+** Stop the background sweeper on lua_close(). If another allocator is
+** stacked on top of the wrapper, only the helper thread is stopped. The
+** wrapper stays in place and the sweeper is freed after the last block.
+*/
+void lj_gc_bgclose(lua_State *L)
+{
+  global_State *g = G(L);
+  if (g->gc.sweeper && lj_gc_bgsweep(L, 0))
+    gc_bg_quit(g->gc.sweeper);
+}
+
+#endif
+
+/* -- Step timing --------------------------------------------------------- */
+
+/* Monotonic clock in nanoseconds. */
+static uint64_t gc_clock(void)
+{
+#if LJ_TARGET_WINDOWS
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return (uint64_t)(c.QuadPart / f.QuadPart) * 1000000000u +
+	 (uint64_t)(c.QuadPart % f.QuadPart) * 1000000000u / f.QuadPart;
+#elif LJ_TARGET_POSIX
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+  return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+/* Record the duration of a GC step and fit the work limit to the budget. */
+static void gc_step_timed(global_State *g, uint64_t ns, GCSize lim,
+			  GCSize work)
+{
+  uint64_t us = ns / 1000;
+  uint32_t i = us == 0 ? 0 : us >= 0x80000000u ? GC_PAUSEHIST-1 :
+	       lj_fls((uint32_t)us)+1;
+  g->gc.pausehist[i < GC_PAUSEHIST ? i : GC_PAUSEHIST-1]++;
+  if (g->gc.budget) {
+    /* Work that would have fit into the budget at the measured speed. */
+    uint64_t fit = ns ? (uint64_t)work * g->gc.budget * 1000 / ns :
+			(uint64_t)lim * 2;
+    if (fit > (uint64_t)lim * 2) fit = (uint64_t)lim * 2;
+    fit = (fit + (g->gc.budgetlim ? g->gc.budgetlim : fit)) / 2;  /* Smooth. */
+    g->gc.budgetlim = fit > GCBUDGETMIN ? (GCSize)fit : GCBUDGETMIN;
+  }
 }
 
 /* -- Collector ----------------------------------------------------------- */
 
+/* Run up to n finalizers from the queue. Returns the number run.
+**
+** The queue outlives the GC cycle which filled it. Its objects are marked
+** again by every atomic phase and a finalized object is linked back like a
+** new one, so finalizers may run in any GC state, except on trace.
+** They're held off under a heap walk, which dumps the queue at its end.
+*/
+static MSize gc_finalize_batch(lua_State *L, MSize n)
+{
+  global_State *g = G(L);
+  uint64_t start;
+  MSize i;
+  if (LJ_UNLIKELY(g->gc.dump != NULL) && lj_heapdump_walking(g))
+    return 0;
+  start = gc_clock();
+  for (i = 0; i < n && gcref(g->gc.mmudata) != NULL; i++)
+    gc_finalize(L);
+  g->gc.fintime += gc_clock() - start;
+  return i;
+}
+
+/* Run up to n queued finalizers (all for 0). Returns the queue length. */
+size_t lj_gc_finalize_queue(lua_State *L, MSize n)
+{
+  global_State *g = G(L);
+  if (!tvref(g->jit_base))
+    gc_finalize_batch(L, n ? n : ~(MSize)0);
+  return g->gc.finnum;
+}
+
+/* Move the objects for the atomic phase to the gray list, once per cycle.
+** Most of their marking is then done incrementally, leaving the atomic
+** phase mainly to scan them again.
+*/
+static void gc_remark(global_State *g)
+{
+  GCRef *p = &g->gc.grayagain;
+  while (gcref(*p))
+    p = &gcref(*p)->gch.gclist;
+  setgcrefr(*p, g->gc.weak);  /* Append the list of weak tables. */
+  setgcrefr(g->gc.gray, g->gc.grayagain);
+  setgcrefnull(g->gc.grayagain);
+  setgcrefnull(g->gc.weak);
+  g->gc.remarked = 1;
+}
+
 /* Atomic part of the GC cycle, transitioning from mark to sweep phase. */
 static void atomic(global_State *g, lua_State *L)
 {
@@ -608,6 +996,13 @@ static void atomic(global_State *g, lua_State *L)
   gc_markobj(g, L);  /* Mark running thread. */
   gc_traverse_curtrace(g);  /* Traverse current trace. */
   gc_mark_gcroot(g);  /* Mark GC roots (again). */
+#if LJ_HASFFI
+  if (gc_isminor(g)) {  /* The finalizer table stays gray, but has no list. */
+    CTState *cts = ctype_ctsG(g);
+    if (cts && isgray(obj2gco(cts->finalizer)))
+      gc_traverse_tab(g, cts->finalizer);
+  }
+#endif
   gc_propagate_gray(g);  /* Propagate all of the above. */
 
   setgcrefr(g->gc.gray, g->gc.grayagain);  /* Empty the 2nd chance list. */
@@ -620,6 +1015,8 @@ static void atomic(global_State *g, lua_State *L)
 
   /* All marking done, clear weak tables. */
   gc_clearweak(gcref(g->gc.weak));
+  lj_str_patclear(g, &g->patcache, 0);  /* Ditto for the string caches. */
+  lj_str_patclear(g, &g->fmtcache, 0);
 
   lj_buf_shrink(L, &g->tmpbuf);  /* Shrink temp buffer. */
 
@@ -627,9 +1024,81 @@ static void atomic(global_State *g, lua_State *L)
   g->gc.currentwhite = (uint8_t)otherwhite(g);  /* Flip current white. */
   g->strempty.marked = g->gc.currentwhite;
   setmref(g->gc.sweep, &g->gc.root);
+  if (g->gc.kind == GCKgen) {  /* Objects created from now on stay young. */
+    setgcrefr(g->gc.sweptroot, g->gc.root);
+    setgcrefr(g->gc.sweptudata, mainthread(g)->nextgc);
+  }
   g->gc.estimate = g->gc.total - (GCSize)udsize;  /* Initial estimate. */
 }
 
+/* Restart the sweep phase to turn everything white (preserving it). */
+static void gc_sweep_restart(global_State *g)
+{
+  setmref(g->gc.sweep, &g->gc.root);
+  setgcrefnull(g->gc.gray);  /* Reset lists from partial propagation. */
+  setgcrefnull(g->gc.trav);
+  setgcrefnull(g->gc.grayagain);
+  setgcrefnull(g->gc.weak);
+  setgcrefnull(g->gc.oldroot);  /* Nothing is old after this sweep. */
+  setgcrefnull(g->gc.oldudata);
+  g->gc.genphase = GCGwhiten;
+  g->gc.state = GCSsweepstring;
+  g->gc.sweepstr = 0;
+}
+
+/* Sweep one step of the root list in generational mode. */
+static int gc_sweep_step_old(global_State *g)
+{
+  GCobj *stop = gcref(g->gc.oldroot);
+  GCRef *p;
+  if (!stop) stop = gcref(g->gc.oldudata);
+  p = gc_sweep_old(g, mref(g->gc.sweep, GCRef), stop, GCSWEEPMAX);
+  if (gcref(*p) == NULL || gcref(*p) != stop) {
+    setmref(g->gc.sweep, p);
+    return gcref(*p) == NULL;
+  }
+  if (gcref(g->gc.oldroot)) {  /* Old part of the root list reached. */
+    setgcrefnull(g->gc.oldroot);
+    setmref(g->gc.sweep, &mainthread(g)->nextgc);  /* Sweep new userdata. */
+    return 0;
+  }
+  return 1;
+}
+
+/* End of the sweep phase in generational mode. */
+static void gc_sweep_done_gen(global_State *g)
+{
+  if (g->gc.genphase == GCGwhiten) {
+    g->gc.genphase = GCGmajor;  /* Everything is white, mark from scratch. */
+    return;
+  }
+  /* All survivors are old now, but not the objects created by the mutator
+  ** during the sweep. These would turn into garbage that only a major cycle
+  ** can free.
+  */
+  setgcrefr(g->gc.oldroot, g->gc.sweptroot);
+  setgcrefr(g->gc.oldudata, g->gc.sweptudata);
+  if (g->gc.genphase == GCGmajor) {
+    g->gc.majorest = g->gc.estimate;
+    g->gc.genphase = GCGminor;
+  } else if (g->gc.estimate >
+	     g->gc.majorest + (g->gc.majorest/100) * LUAI_GCMAJORMUL) {
+    g->gc.genphase = GCGwhiten;  /* Too much garbage may be old: go major. */
+  }
+}
+
+/* Close to the memory limit a full GC is done at the next GC step. */
+#define gc_softlimit(g)	((g)->gc.limit - ((g)->gc.limit >> 3))
+
+/* Memory threshold for the start of the next GC cycle. */
+static GCSize gc_threshold(global_State *g)
+{
+  GCSize t = g->gc.kind == GCKinc ? (g->gc.estimate/100) * g->gc.pause :
+	     g->gc.genphase != GCGminor ? g->gc.total :  /* No pause. */
+	     g->gc.estimate + (g->gc.estimate/100) * g->gc.minormul;
+  return LJ_LIKELY(t < gc_softlimit(g)) ? t : gc_softlimit(g);
+}
+
 /* GC state machine. Returns a cost estimate for each step performed. */
 static size_t gc_onestep(lua_State *L)
 {
@@ -637,28 +1106,48 @@ static size_t gc_onestep(lua_State *L)
   g->gc.state_count[g->gc.state]++;
   switch (g->gc.state) {
   case GCSpause:
+    if (g->gc.kind == GCKgen && g->gc.genphase == GCGwhiten) {
+      gc_sweep_restart(g);  /* Prepare a major cycle. */
+      return 0;
+    }
     gc_mark_start(g);  /* Start a new GC cycle by marking all GC roots. */
     return 0;
   case GCSpropagate:
-    if (gcref(g->gc.gray) != NULL)
+    if (gcref(g->gc.gray) != NULL || gcref(g->gc.trav) != NULL)
       return propagatemark(g);  /* Propagate one gray object. */
+    if (!g->gc.remarked && (gcref(g->gc.grayagain) || gcref(g->gc.weak))) {
+      gc_remark(g);
+      return 0;
+    }
     g->gc.state = GCSatomic;  /* End of mark phase. */
     return 0;
-  case GCSatomic:
+  case GCSatomic: {
+    uint64_t ns;
     if (tvref(g->jit_base))  /* Don't run atomic phase on trace. */
       return LJ_MAX_MEM;
+    ns = gc_clock();
     atomic(g, L);
+    ns = gc_clock() - ns;
+    g->gc.atomictime += ns;
+    if (ns > g->gc.atomicmax) g->gc.atomicmax = ns;
     g->gc.state = GCSsweepstring;  /* Start of sweep phase. */
     g->gc.sweepstr = 0;
 #if LUAJIT_SMART_STRINGS
-    g->strbloom.next[0] = 0;
-    g->strbloom.next[1] = 0;
+    if (!gc_isminor(g)) {  /* Old strings are not swept by a minor cycle. */
+      g->strbloom.next[0] = 0;
+      g->strbloom.next[1] = 0;
+    }
 #endif
     return 0;
+    }
   case GCSsweepstring: {
     GCSize old = g->gc.total;
-    gc_sweep_str_chain(g, &g->strhash[g->gc.sweepstr++]);  /* Sweep one chain. */
-    if (g->gc.sweepstr > g->strmask) {
+    GCRef *p = lj_str_chain(g, g->gc.sweepstr);
+    if (gc_keepold(g))
+      gc_sweep_str_old(g, p, gc_isminor(g));
+    else
+      gc_sweep_str_chain(g, p);  /* Sweep one chain. */
+    if (++g->gc.sweepstr >= lj_str_nchains(g)) {
       g->gc.state = GCSsweep;  /* All string hash chains sweeped. */
 #if LUAJIT_SMART_STRINGS
       g->strbloom.cur[0] = g->strbloom.next[0];
@@ -671,10 +1160,18 @@ static size_t gc_onestep(lua_State *L)
     }
   case GCSsweep: {
     GCSize old = g->gc.total;
-    setmref(g->gc.sweep, gc_sweep(g, mref(g->gc.sweep, GCRef), GCSWEEPMAX));
+    int done;
+    if (gc_keepold(g)) {
+      done = gc_sweep_step_old(g);
+    } else {
+      setmref(g->gc.sweep, gc_sweep(g, mref(g->gc.sweep, GCRef), GCSWEEPMAX));
+      done = gcref(*mref(g->gc.sweep, GCRef)) == NULL;
+    }
     lua_assert(old >= g->gc.total);
     g->gc.estimate -= old - g->gc.total;
-    if (gcref(*mref(g->gc.sweep, GCRef)) == NULL) {
+    if (done) {
+      if (g->gc.kind == GCKgen)
+	gc_sweep_done_gen(g);
       if (g->strnum <= (g->strmask >> 2) && g->strmask > LJ_MIN_STRTAB*2-1)
 	lj_str_resize(L, g->strmask >> 1);  /* Shrink string table. */
       if (gcref(g->gc.mmudata)) {  /* Need any finalizations? */
@@ -690,10 +1187,13 @@ static size_t gc_onestep(lua_State *L)
     return GCSWEEPMAX*GCSWEEPCOST;
     }
   case GCSfinalize:
-    if (gcref(g->gc.mmudata) != NULL) {
-      if (tvref(g->jit_base))  /* Don't call finalizers on trace. */
-	return LJ_MAX_MEM;
-      gc_finalize(L);  /* Finalize one userdata object. */
+    /* Don't call finalizers on trace and stick to the batch size. The rest
+    ** stays queued for the next GC steps or an explicit drain.
+    */
+    if (gcref(g->gc.mmudata) != NULL && g->gc.finleft > 0 &&
+	!tvref(g->jit_base)) {
+      g->gc.finleft--;
+      gc_finalize_batch(L, 1);  /* Finalize one userdata object. */
       if (g->gc.estimate > GCFINALIZECOST)
 	g->gc.estimate -= GCFINALIZECOST;
       return GCFINALIZECOST;
@@ -714,32 +1214,69 @@ static size_t gc_onestep(lua_State *L)
 int LJ_FASTCALL lj_gc_step(lua_State *L)
 {
   global_State *g = G(L);
-  GCSize lim;
+  GCSize lim, steplim;
+  uint64_t start = 0;
   int32_t ostate = g->vmstate;
+  int res, timed;
+  if (LJ_UNLIKELY(g->gc.total >= gc_softlimit(g)) && !tvref(g->jit_base) &&
+      g->gc.dump == NULL) {
+    /* Close to the memory limit: collect everything that can be freed. */
+    g->gc.emergencies++;
+    lj_gc_fullgc(L);
+    if (g->gc.total >= gc_softlimit(g))  /* Retry halfway to the limit. */
+      g->gc.threshold = g->gc.total + ((g->gc.limit - g->gc.total) >> 1);
+    return 1;
+  }
   setvmstate(g, GC);
+  /* The budget needs every step timed, the histogram only a sample. */
+  timed = g->gc.budget || ++g->gc.stepseq % GCSTEPSAMPLE == 0;
+  if (timed)
+    start = gc_clock();
   lim = (GCSTEPSIZE/100) * g->gc.stepmul;
   if (lim == 0)
     lim = LJ_MAX_MEM;
+  if (g->gc.budget && g->gc.budgetlim && g->gc.budgetlim < lim)
+    lim = g->gc.budgetlim;  /* Do less work to stay within the budget. */
+  steplim = lim;
+  g->gc.finleft = g->gc.finbatch;
+  if (gcref(g->gc.mmudata) != NULL && g->gc.state != GCSfinalize &&
+      !tvref(g->jit_base)) {  /* Drain finalizers left over by a GC cycle. */
+    MSize n = gc_finalize_batch(L, g->gc.finleft);
+    g->gc.finleft -= n;
+    lim -= n * GCFINALIZECOST;
+  }
+  if (g->strrehash)  /* Move on with a resize of the string table. */
+    lj_str_rehash(g, GCSTRREHASH);
+  if (LJ_UNLIKELY(g->gc.dump != NULL) && lj_heapdump_step(g, lim)) {
+    /* Dump the heap instead. The collector must not free anything yet. */
+    g->gc.threshold = g->gc.total + GCSTEPSIZE;
+    res = -1;
+    lim = 0;
+    goto done;
+  }
   if (g->gc.total > g->gc.threshold)
     g->gc.debt += g->gc.total - g->gc.threshold;
   do {
     lim -= (GCSize)gc_onestep(L);
     if (g->gc.state == GCSpause) {
-      g->gc.threshold = (g->gc.estimate/100) * g->gc.pause;
-      g->vmstate = ostate;
-      return 1;  /* Finished a GC cycle. */
+      g->gc.threshold = gc_threshold(g);
+      res = 1;  /* Finished a GC cycle. */
+      goto done;
     }
   } while (sizeof(lim) == 8 ? ((int64_t)lim > 0) : ((int32_t)lim > 0));
   if (g->gc.debt < GCSTEPSIZE) {
     g->gc.threshold = g->gc.total + GCSTEPSIZE;
-    g->vmstate = ostate;
-    return -1;
+    res = -1;
   } else {
     g->gc.debt -= GCSTEPSIZE;
     g->gc.threshold = g->gc.total;
-    g->vmstate = ostate;
-    return 0;
+    res = 0;
   }
+done:
+  if (timed)
+    gc_step_timed(g, gc_clock() - start, steplim, steplim - lim);
+  g->vmstate = ostate;
+  return res;
 }
 
 /* Ditto, but fix the stack top first. */
@@ -769,34 +1306,47 @@ void lj_gc_fullgc(lua_State *L)
   global_State *g = G(L);
   int32_t ostate = g->vmstate;
   setvmstate(g, GC);
-  if (g->gc.state <= GCSatomic) {  /* Caught somewhere in the middle. */
-    setmref(g->gc.sweep, &g->gc.root);  /* Sweep everything (preserving it). */
-    setgcrefnull(g->gc.gray);  /* Reset lists from partial propagation. */
-    setgcrefnull(g->gc.grayagain);
-    setgcrefnull(g->gc.weak);
-    g->gc.state = GCSsweepstring;  /* Fast forward to the sweep phase. */
-    g->gc.sweepstr = 0;
-  }
+  if (g->gc.dump != NULL)
+    lj_heapdump_step(g, ~(GCSize)0);  /* Finish the heap walk first. */
+  /* Caught somewhere in the middle or old objects around? */
+  if (g->gc.state <= GCSatomic || g->gc.kind == GCKgen)
+    gc_sweep_restart(g);  /* Fast forward to sweep everything (preserving it). */
   while (g->gc.state == GCSsweepstring || g->gc.state == GCSsweep)
     gc_onestep(L);  /* Finish sweep. */
   lua_assert(g->gc.state == GCSfinalize || g->gc.state == GCSpause);
   /* Now perform a full GC. */
   g->gc.state = GCSpause;
+  g->gc.finleft = 0;  /* Run the finalizers at the end. */
   do { gc_onestep(L); } while (g->gc.state != GCSpause);
-  g->gc.threshold = (g->gc.estimate/100) * g->gc.pause;
+  gc_finalize_batch(L, ~(MSize)0);
+  g->gc.threshold = gc_threshold(g);
   g->vmstate = ostate;
 }
 
+/* Switch between the incremental and the generational collector. */
+int lj_gc_setkind(lua_State *L, int kind)
+{
+  global_State *g = G(L);
+  int okind = g->gc.kind;
+  if (kind != okind) {
+    g->gc.kind = (uint8_t)kind;
+    gc_sweep_restart(g);  /* Turn old objects white again. */
+    lj_gc_fullgc(L);  /* And make the survivors old, if needed. */
+  }
+  return okind;
+}
+
 /* -- Write barriers ------------------------------------------------------ */
 
 /* Move the GC propagation frontier forward. */
 void lj_gc_barrierf(global_State *g, GCobj *o, GCobj *v)
 {
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
-  lua_assert(g->gc.state != GCSfinalize && g->gc.state != GCSpause);
+  lua_assert(g->gc.kind == GCKgen ||
+	     (g->gc.state != GCSfinalize && g->gc.state != GCSpause));
   lua_assert(o->gch.gct != ~LJ_TTAB);
-  /* Preserve invariant during propagation. Otherwise it doesn't matter. */
-  if (g->gc.state == GCSpropagate || g->gc.state == GCSatomic)
+  /* Preserve invariant during propagation or for old objects. */
+  if (gc_keepinvariant(g))
     gc_mark(g, v);  /* Move frontier forward. */
   else
     makewhite(g, o);  /* Make it white to avoid the following barrier. */
@@ -807,7 +1357,7 @@ void LJ_FASTCALL lj_gc_barrieruv(global_State *g, TValue *tv)
 {
 #define TV2MARKED(x) \
   (*((uint8_t *)(x) - offsetof(GCupval, tv) + offsetof(GCupval, marked)))
-  if (g->gc.state == GCSpropagate || g->gc.state == GCSatomic)
+  if (gc_keepinvariant(g))
     gc_mark(g, gcV(tv));
   else
     TV2MARKED(tv) = (TV2MARKED(tv) & (uint8_t)~LJ_GC_COLORS) | curwhite(g);
@@ -825,33 +1375,71 @@ void lj_gc_closeuv(global_State *g, GCupval *uv)
   setgcrefr(o->gch.nextgc, g->gc.root);
   setgcref(g->gc.root, o);
   if (isgray(o)) {  /* A closed upvalue is never gray, so fix this. */
-    if (g->gc.state == GCSpropagate || g->gc.state == GCSatomic) {
+    if (gc_keepinvariant(g)) {
       gray2black(o);  /* Make it black and preserve invariant. */
       if (tviswhite(&uv->tv))
 	lj_gc_barrierf(g, o, gcV(&uv->tv));
     } else {
       makewhite(g, o);  /* Make it white, i.e. sweep the upvalue. */
-      lua_assert(g->gc.state != GCSfinalize && g->gc.state != GCSpause);
+      lua_assert(g->gc.kind == GCKgen ||
+		 (g->gc.state != GCSfinalize && g->gc.state != GCSpause));
     }
   }
 }
 
 #if LJ_HASJIT
-/* Mark a trace if it's saved during the propagation phase. */
+/* Mark a trace if it's saved during the propagation phase or when old. */
 void lj_gc_barriertrace(global_State *g, uint32_t traceno)
 {
-  if (g->gc.state == GCSpropagate || g->gc.state == GCSatomic)
+  if (gc_keepinvariant(g))
     gc_marktrace(g, traceno);
 }
 #endif
 
 /* -- Allocator ----------------------------------------------------------- */
 
+/* Allocation of need more bytes beyond the memory limit. */
+static LJ_NOINLINE void mem_overlimit(lua_State *L, GCSize need)
+{
+  global_State *g = G(L);
+  /* The collector itself must not fail and errors can't be thrown across
+  ** machine code. The limit is enforced again once the trace is left.
+  */
+  if (g->vmstate == ~LJ_VMST_GC || tvref(g->jit_base))
+    return;
+  /* A full GC can't be run here: the caller may hold unanchored objects.
+  ** But the rest of the sweep phase is safe. It only frees objects found
+  ** dead by the last atomic phase, which ran at a GC check.
+  */
+  if ((g->gc.state == GCSsweepstring || g->gc.state == GCSsweep) &&
+      g->gc.dump == NULL) {
+    int32_t ostate = g->vmstate;
+    setvmstate(g, GC);  /* No reentry from allocations of the sweep. */
+    do {
+      gc_onestep(L);
+    } while (g->gc.state == GCSsweepstring || g->gc.state == GCSsweep);
+    g->vmstate = ostate;
+    if (g->gc.state == GCSpause)
+      g->gc.threshold = gc_threshold(g);
+    if (g->gc.total + need <= g->gc.limit)
+      return;
+  }
+  g->gc.limiterrors++;
+  /* Have the next GC step run a full GC, unless the collector has been
+  ** stopped.
+  */
+  if (g->gc.threshold != LJ_MAX_MEM)
+    g->gc.threshold = 0;
+  lj_err_mem(L);
+}
+
 /* Call pluggable memory allocator to allocate or resize a fragment. */
 void *lj_mem_realloc(lua_State *L, void *p, GCSize osz, GCSize nsz)
 {
   global_State *g = G(L);
   lua_assert((osz == 0) == (p == NULL));
+  if (LJ_UNLIKELY(nsz > osz && g->gc.total + (nsz - osz) > g->gc.limit))
+    mem_overlimit(L, nsz - osz);
   p = g->allocf(g->allocd, p, osz, nsz);
   if (p == NULL && nsz > 0)
     lj_err_mem(L);
@@ -867,7 +1455,10 @@ void *lj_mem_realloc(lua_State *L, void *p, GCSize osz, GCSize nsz)
 void * LJ_FASTCALL lj_mem_newgco(lua_State *L, GCSize size)
 {
   global_State *g = G(L);
-  GCobj *o = (GCobj *)g->allocf(g->allocd, NULL, 0, size);
+  GCobj *o;
+  if (LJ_UNLIKELY(g->gc.total + size > g->gc.limit))
+    mem_overlimit(L, size);
+  o = (GCobj *)g->allocf(g->allocd, NULL, 0, size);
   if (o == NULL)
     lj_err_mem(L);
   lua_assert(checkptrGC(o));
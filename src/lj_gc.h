@@ -16,8 +16,10 @@
 #define LJ_GC_WEAKKEY	0x08
 #define LJ_GC_WEAKVAL	0x10
 #define LJ_GC_CDATA_FIN	0x10
+#define LJ_GC_EXTSTR	0x10	/* Strings only: data owned by the caller. */
 #define LJ_GC_FIXED	0x20
 #define LJ_GC_SFIXED	0x40
+#define LJ_GC_OLD	0x80	/* Strings only: survived a generational sweep. */
 
 #define LJ_GC_WHITES	(LJ_GC_WHITE0 | LJ_GC_WHITE1)
 #define LJ_GC_COLORS	(LJ_GC_WHITES | LJ_GC_BLACK)
@@ -43,6 +45,7 @@
 /* Collector. */
 LJ_FUNC size_t lj_gc_separateudata(global_State *g, int all);
 LJ_FUNC void lj_gc_finalize_udata(lua_State *L);
+LJ_FUNC size_t lj_gc_finalize_queue(lua_State *L, MSize n);
 #if LJ_HASFFI
 LJ_FUNC void lj_gc_finalize_cdata(lua_State *L);
 #else
@@ -55,6 +58,12 @@ LJ_FUNCA void LJ_FASTCALL lj_gc_step_fixtop(lua_State *L);
 LJ_FUNC int LJ_FASTCALL lj_gc_step_jit(global_State *g, MSize steps);
 #endif
 LJ_FUNC void lj_gc_fullgc(lua_State *L);
+LJ_FUNC int lj_gc_setkind(lua_State *L, int kind);
+#if LJ_HASGCTHREAD
+LJ_FUNC int lj_gc_bgsweep(lua_State *L, int on);
+LJ_FUNC void lj_gc_bgclose(lua_State *L);
+LJ_FUNC void *lj_gc_bgfree(struct GCSweeper *sw);
+#endif
 
 /* GC check: drive collector forward if the GC threshold has been reached. */
 #define lj_gc_check(L) \
@@ -77,12 +86,17 @@ static LJ_AINLINE void lj_gc_barrierback(global_State *g, GCtab *t)
 {
   GCobj *o = obj2gco(t);
   lua_assert(isblack(o) && !isdead(g, o));
-  lua_assert(g->gc.state != GCSfinalize && g->gc.state != GCSpause);
+  lua_assert(g->gc.kind == GCKgen ||
+	     (g->gc.state != GCSfinalize && g->gc.state != GCSpause));
   black2gray(o);
   setgcrefr(t->gclist, g->gc.grayagain);
   setgcref(g->gc.grayagain, o);
 }
 
+/* Restart the traversal of a table in chunks, if its slots have moved. */
+#define lj_gc_travrestart(g, t) \
+  { if (LJ_UNLIKELY(obj2gco(t) == gcref((g)->gc.trav))) (g)->gc.travpos = 0; }
+
 /* Barrier for stores to table objects. TValue and GCobj variant. */
 #define lj_gc_anybarriert(L, t)  \
   { if (LJ_UNLIKELY(isblack(obj2gco(t)))) lj_gc_barrierback(G(L), (t)); }
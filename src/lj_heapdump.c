@@ -0,0 +1,401 @@
+/*
+** Heap snapshot dump.
+**
+** The dump walks the string table and the list of all objects like
+** lj_gc_freeall() does and writes the type, size and references of every
+** object. It's driven by the GC steps, so a huge heap is dumped at the
+** same pace as it would be collected and the collector is paused until
+** the walk is done: no object may be freed under the walk.
+*/
+
+#define lj_heapdump_c
+#define LUA_CORE
+
+#include <stdio.h>
+
+#include "lj_obj.h"
+#include "lj_gc.h"
+#include "lj_str.h"
+#include "lj_tab.h"
+#include "lj_meta.h"
+#include "lj_frame.h"
+#include "lj_heapdump.h"
+#if LJ_HASJIT
+#include "lj_jit.h"
+#include "lj_dispatch.h"
+#endif
+#if LJ_HASFFI
+#include "lj_ctype.h"
+#endif
+
+#define HD_BUFSZ	16384
+#define HD_BUFRESERVE	16	/* Max. size of a number plus a tag byte. */
+
+typedef struct HeapDump {
+  global_State *g;
+  FILE *fp;			/* Output file or NULL if written. */
+  int err;			/* A write error occurred. */
+  MSize strpos;			/* Next slot of the string table. */
+  GCobj *next;			/* Next object in the root list. */
+  uint8_t *pos;			/* Current position in the buffer. */
+  uint8_t buf[HD_BUFSZ];	/* Output buffer. */
+} HeapDump;
+
+/* -- Output -------------------------------------------------------------- */
+
+static void hd_flush(HeapDump *hd)
+{
+  size_t n = (size_t)(hd->pos - hd->buf);
+  if (n && !hd->err && fwrite(hd->buf, 1, n, hd->fp) != n)
+    hd->err = 1;
+  hd->pos = hd->buf;
+}
+
+static LJ_AINLINE void hd_byte(HeapDump *hd, uint32_t b)
+{
+  *hd->pos++ = (uint8_t)b;
+}
+
+/* Write a number. Flushes the buffer, if needed. */
+static void hd_uleb(HeapDump *hd, uint64_t v)
+{
+  uint8_t *p;
+  if ((size_t)(hd->buf + HD_BUFSZ - hd->pos) < HD_BUFRESERVE)
+    hd_flush(hd);
+  p = hd->pos;
+  for (; v >= 0x80; v >>= 7)
+    *p++ = (uint8_t)(v | 0x80);
+  *p++ = (uint8_t)v;
+  hd->pos = p;
+}
+
+static void hd_label(HeapDump *hd, const char *s, MSize len)
+{
+  if (len > HD_LABELMAX) len = HD_LABELMAX;
+  hd_uleb(hd, len);
+  if ((size_t)(hd->buf + HD_BUFSZ - hd->pos) < len)
+    hd_flush(hd);
+  memcpy(hd->pos, s, len);
+  hd->pos += len;
+}
+
+static LJ_AINLINE void hd_ref(HeapDump *hd, GCobj *o)
+{
+  if (o) hd_uleb(hd, (uintptr_t)o);
+}
+
+static LJ_AINLINE void hd_reftv(HeapDump *hd, cTValue *o)
+{
+  if (tvisgcv(o)) hd_uleb(hd, (uintptr_t)gcV(o));
+}
+
+/* -- Objects ------------------------------------------------------------- */
+
+/* Memory owned by an object, as it is freed by lj_gc.c. */
+static GCSize hd_size(global_State *g, GCobj *o)
+{
+  switch (o->gch.gct) {
+  case ~LJ_TSTR: return sizestring(gco2str(o));
+  case ~LJ_TUPVAL: return sizeof(GCupval);
+  case ~LJ_TTHREAD:
+    return sizeof(lua_State) + gco2th(o)->stacksize*sizeof(TValue);
+  case ~LJ_TPROTO: return gco2pt(o)->sizept;
+  case ~LJ_TFUNC: {
+    GCfunc *fn = gco2func(o);
+    return isluafunc(fn) ? sizeLfunc((MSize)fn->l.nupvalues) :
+			   sizeCfunc((MSize)fn->c.nupvalues);
+    }
+#if LJ_HASJIT
+  case ~LJ_TTRACE: {
+    GCtrace *T = gco2trace(o);
+    return ((sizeof(GCtrace)+7)&~7) + (T->nins-T->nk)*sizeof(IRIns) +
+	   T->nsnap*sizeof(SnapShot) + T->nsnapmap*sizeof(SnapEntry);
+    }
+#endif
+#if LJ_HASFFI
+  case ~LJ_TCDATA: {
+    GCcdata *cd = gco2cd(o);
+    if (cdataisv(cd)) {
+      return sizecdatav(cd);
+    } else {
+      CType *ct = ctype_raw(ctype_ctsG(g), cd->ctypeid);
+      return sizeof(GCcdata) +
+	     (ctype_hassize(ct->info) ? ct->size : CTSIZE_PTR);
+    }
+    }
+#endif
+  case ~LJ_TTAB: {
+    GCtab *t = gco2tab(o);
+    GCSize sz = (LJ_MAX_COLOSIZE != 0 && t->colo) ?
+		sizetabcolo((uint32_t)t->colo & 0x7f) : sizeof(GCtab);
+    if (t->hmask > 0)
+      sz += (t->hmask+1)*sizeof(Node);
+    if (t->asize > 0 && LJ_MAX_COLOSIZE != 0 && t->colo <= 0)
+      sz += t->asize*sizeof(TValue);
+    return sz;
+    }
+  case ~LJ_TUDATA: return sizeudata(gco2ud(o));
+  default: lua_assert(0); return 0;
+  }
+}
+
+static void hd_refs_tab(HeapDump *hd, GCtab *t)
+{
+  global_State *g = hd->g;
+  GCtab *mt = tabref(t->metatable);
+  cTValue *mode = lj_meta_fastg(g, mt, MM_mode);
+  int weak = 0;
+  hd_ref(hd, obj2gco(mt));
+  if (mode && tvisstr(mode)) {  /* Weak references retain nothing. */
+    const char *modestr = strVdata(mode);
+    int c;
+    while ((c = *modestr++)) {
+      if (c == 'k') weak |= LJ_GC_WEAKKEY;
+      else if (c == 'v') weak |= LJ_GC_WEAKVAL;
+    }
+  }
+  if (!(weak & LJ_GC_WEAKVAL)) {
+    MSize i, asize = t->asize;
+    for (i = 0; i < asize; i++)
+      hd_reftv(hd, arrayslot(t, i));
+  }
+  if (t->hmask > 0) {
+    Node *node = noderef(t->node);
+    MSize i, hmask = t->hmask;
+    for (i = 0; i <= hmask; i++) {
+      Node *n = &node[i];
+      if (!tvisnil(&n->val)) {
+	if (!(weak & LJ_GC_WEAKKEY)) hd_reftv(hd, &n->key);
+	if (!(weak & LJ_GC_WEAKVAL)) hd_reftv(hd, &n->val);
+      }
+    }
+  }
+}
+
+static void hd_refs_thread(HeapDump *hd, lua_State *th)
+{
+  TValue *o, *top = th->top, *bot = tvref(th->stack);
+  GCobj *uv;
+  hd_ref(hd, obj2gco(tabref(th->env)));
+  for (o = bot+1+LJ_FR2; o < top; o++)
+    hd_reftv(hd, o);
+  if (!LJ_FR2) {  /* Hidden frame functions. */
+    for (o = th->base-1; o > bot+LJ_FR2; o = frame_prev(o))
+      hd_ref(hd, obj2gco(frame_func(o)));
+  }
+  for (uv = gcref(th->openupval); uv; uv = gcnext(uv))
+    hd_ref(hd, uv);
+}
+
+static void hd_refs_proto(HeapDump *hd, GCproto *pt)
+{
+  ptrdiff_t i;
+  hd_ref(hd, obj2gco(proto_chunkname(pt)));
+  for (i = -(ptrdiff_t)pt->sizekgc; i < 0; i++)
+    hd_ref(hd, proto_kgc(pt, i));
+#if LJ_HASJIT
+  if (pt->trace)
+    hd_ref(hd, obj2gco(traceref(G2J(hd->g), pt->trace)));
+#endif
+}
+
+#if LJ_HASJIT
+static void hd_refs_trace(HeapDump *hd, GCtrace *T)
+{
+  jit_State *J = G2J(hd->g);
+  IRRef ref;
+  if (T->traceno == 0) return;
+  for (ref = T->nk; ref < REF_TRUE; ref++) {
+    IRIns *ir = &T->ir[ref];
+    if (ir->o == IR_KGC)
+      hd_ref(hd, ir_kgc(ir));
+    if (irt_is64(ir->t) && ir->o != IR_KNULL)
+      ref++;
+  }
+  if (T->link) hd_ref(hd, obj2gco(traceref(J, T->link)));
+  if (T->nextroot) hd_ref(hd, obj2gco(traceref(J, T->nextroot)));
+  if (T->nextside) hd_ref(hd, obj2gco(traceref(J, T->nextside)));
+  hd_ref(hd, gcref(T->startpt));
+}
+#endif
+
+/* Write an object. Returns its size. */
+static GCSize hd_object(HeapDump *hd, GCobj *o)
+{
+  GCSize size = hd_size(hd->g, o);
+  hd_uleb(hd, o->gch.gct);
+  hd_uleb(hd, (uintptr_t)o);
+  hd_uleb(hd, size);
+  switch (o->gch.gct) {
+  case ~LJ_TUPVAL:
+    hd_reftv(hd, uvval(gco2uv(o)));
+    break;
+  case ~LJ_TTHREAD:
+    hd_refs_thread(hd, gco2th(o));
+    break;
+  case ~LJ_TPROTO:
+    hd_refs_proto(hd, gco2pt(o));
+    break;
+  case ~LJ_TFUNC: {
+    GCfunc *fn = gco2func(o);
+    uint32_t i;
+    hd_ref(hd, obj2gco(tabref(fn->c.env)));
+    if (isluafunc(fn)) {
+      hd_ref(hd, obj2gco(funcproto(fn)));
+      for (i = 0; i < fn->l.nupvalues; i++)
+	hd_ref(hd, gcref(fn->l.uvptr[i]));
+    } else {
+      for (i = 0; i < fn->c.nupvalues; i++)
+	hd_reftv(hd, &fn->c.upvalue[i]);
+    }
+    break;
+    }
+#if LJ_HASJIT
+  case ~LJ_TTRACE:
+    hd_refs_trace(hd, gco2trace(o));
+    break;
+#endif
+  case ~LJ_TTAB:
+    hd_refs_tab(hd, gco2tab(o));
+    break;
+  case ~LJ_TUDATA:
+    hd_ref(hd, obj2gco(tabref(gco2ud(o)->metatable)));
+    hd_ref(hd, obj2gco(tabref(gco2ud(o)->env)));
+    break;
+  default:
+    break;
+  }
+  hd_uleb(hd, 0);
+  if (o->gch.gct == ~LJ_TSTR) {
+    hd_label(hd, strdata(gco2str(o)), gco2str(o)->len);
+  } else if (o->gch.gct == ~LJ_TPROTO) {
+    GCproto *pt = gco2pt(o);
+    GCstr *name = proto_chunkname(pt);
+    const char *s = strdata(name);
+    char buf[HD_LABELMAX+1];
+    MSize len = name->len;
+    if (len > HD_LABELMAX-12) {  /* Keep the tail, it has the file name. */
+      s += len - (HD_LABELMAX-12);
+      len = HD_LABELMAX-12;
+    }
+    memcpy(buf, s, len);
+    len += (MSize)sprintf(buf+len, ":%d", (int)pt->firstline);
+    hd_label(hd, buf, len);
+  } else {
+    hd_uleb(hd, 0);
+  }
+  if (o->gch.gct == ~LJ_TTHREAD) {  /* Open upvalues are owned by it. */
+    GCobj *uv;
+    for (uv = gcref(gco2th(o)->openupval); uv; uv = gcnext(uv))
+      size += hd_object(hd, uv);
+  }
+  return size;
+}
+
+static void hd_root(HeapDump *hd, GCobj *o)
+{
+  if (o) {
+    hd_uleb(hd, HD_ROOT);
+    hd_uleb(hd, (uintptr_t)o);
+  }
+}
+
+/* Write the userdata waiting for finalization and finish the dump.
+** The collector doesn't run finalizers until then, so the queue is whole.
+*/
+static void hd_finish(HeapDump *hd)
+{
+  global_State *g = hd->g;
+  GCobj *root = gcref(g->gc.mmudata);
+  if (root) {  /* The finalizers keep them alive. */
+    GCobj *o = root;
+    do {
+      o = gcnext(o);
+      hd_object(hd, o);
+      hd_root(hd, o);
+    } while (o != root);
+  }
+  hd_uleb(hd, HD_END);
+  hd_flush(hd);
+  if (fclose(hd->fp) != 0) hd->err = 1;
+  hd->fp = NULL;
+}
+
+/* -- Public API ---------------------------------------------------------- */
+
+/* Check whether the heap is still being walked. */
+int lj_heapdump_walking(global_State *g)
+{
+  return g->gc.dump != NULL && g->gc.dump->fp != NULL;
+}
+
+/* Dump a part of the heap. Returns 0 when done or 1 if not done yet. */
+int lj_heapdump_step(global_State *g, GCSize lim)
+{
+  HeapDump *hd = g->gc.dump;
+  GCSize work = 0;
+  if (hd->fp == NULL) return 0;
+  while (work < lim) {
+    if (hd->strpos < lj_str_nchains(g)) {
+      GCobj *o = gcref(*lj_str_chain(g, hd->strpos));
+      hd->strpos++;
+      for (; o; o = gcnext(o))
+	work += hd_object(hd, o);
+      work += sizeof(GCRef);
+    } else if (hd->next) {
+      GCobj *o = hd->next;
+      hd->next = gcnext(o);
+      work += hd_object(hd, o);
+    } else {
+      hd_finish(hd);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int lj_heapdump_start(lua_State *L, const char *fname)
+{
+  global_State *g = G(L);
+  HeapDump *hd;
+  FILE *fp;
+  ptrdiff_t i;
+  if (g->gc.dump)
+    return HD_ERRRUN;
+  hd = lj_mem_newt(L, sizeof(HeapDump), HeapDump);
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    lj_mem_freet(g, hd);
+    return HD_ERRIO;
+  }
+  hd->g = g;
+  hd->fp = fp;
+  hd->err = 0;
+  hd->strpos = 0;
+  hd->next = gcref(g->gc.root);
+  hd->pos = hd->buf;
+  hd_byte(hd, 'l'); hd_byte(hd, 'j'); hd_byte(hd, 'h');
+  hd_byte(hd, HD_VERSION);
+  hd_root(hd, obj2gco(mainthread(g)));
+  hd_root(hd, obj2gco(tabref(mainthread(g)->env)));
+  hd_root(hd, gcV(&g->registrytv));
+  for (i = 0; i < GCROOT_MAX; i++)
+    hd_root(hd, gcref(g->gcroot[i]));
+  g->gc.dump = hd;
+  return HD_OK;
+}
+
+int lj_heapdump_finish(lua_State *L)
+{
+  global_State *g = G(L);
+  HeapDump *hd = g->gc.dump;
+  int err;
+  if (hd == NULL)
+    return HD_ERRRUN;
+  while (lj_heapdump_step(g, ~(GCSize)0))
+    ;
+  err = hd->err;
+  g->gc.dump = NULL;
+  lj_mem_freet(g, hd);
+  return err ? HD_ERRIO : HD_OK;
+}
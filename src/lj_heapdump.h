@@ -0,0 +1,46 @@
+/*
+** Heap snapshot dump.
+*/
+
+#ifndef _LJ_HEAPDUMP_H
+#define _LJ_HEAPDUMP_H
+
+#include "lj_obj.h"
+
+/*
+** The dump is a stream of records written to a file. All numbers are
+** ULEB128-encoded, strings are a length followed by the bytes.
+**
+**   stream  := 'l' 'j' 'h' version record* end
+**   record  := HD_ROOT addr
+**            | gct addr size ref* 0 label
+**   end     := HD_END
+**
+** gct is the ~LJ_T* type of an object and size is the memory it owns.
+** The refs are the addresses of the objects it references. Strings are
+** labeled with a prefix of their contents, prototypes with their chunk
+** name and first line, the label of all other objects is empty.
+**
+** The dump is written incrementally by the GC steps and the collector
+** doesn't run until it's done. Objects created meanwhile are not dumped,
+** but the references of the dumped ones may point to them.
+*/
+
+#define HD_VERSION	1
+
+#define HD_ROOT		0x00
+#define HD_END		0x80
+
+#define HD_LABELMAX	64
+
+/* Error codes, same as LUAM_HEAPDUMP_*. */
+#define HD_OK		0
+#define HD_ERRRUN	1
+#define HD_ERRIO	2
+
+LJ_FUNC int lj_heapdump_start(lua_State *L, const char *fname);
+LJ_FUNC int lj_heapdump_step(global_State *g, GCSize lim);
+LJ_FUNC int lj_heapdump_finish(lua_State *L);
+LJ_FUNC int lj_heapdump_walking(global_State *g);
+
+#endif
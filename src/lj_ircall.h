@@ -29,6 +29,7 @@ typedef struct CCallInfo {
 #define CCI_CALL_L		(IR_CALLL << CCI_OPSHIFT)
 #define CCI_CALL_S		(IR_CALLS << CCI_OPSHIFT)
 #define CCI_CALL_FN		(CCI_CALL_N|CCI_CC_FASTCALL)
+#define CCI_CALL_FA		(CCI_CALL_A|CCI_CC_FASTCALL)
 #define CCI_CALL_FL		(CCI_CALL_L|CCI_CC_FASTCALL)
 #define CCI_CALL_FS		(CCI_CALL_S|CCI_CC_FASTCALL)
 
@@ -132,6 +133,7 @@ typedef struct CCallInfo {
   _(ANY,	lj_strfmt_putint,	2,  FL, PGC, 0) \
   _(ANY,	lj_strfmt_putnum,	2,  FL, PGC, 0) \
   _(ANY,	lj_strfmt_putquoted,	2,  FL, PGC, 0) \
+  _(ANY,	lj_strfmt_putptr,	2,  FL, PGC, 0) \
   _(ANY,	lj_strfmt_putfxint,	3,   L, PGC, XA_64) \
   _(ANY,	lj_strfmt_putfnum_int,	3,   L, PGC, XA_FP) \
   _(ANY,	lj_strfmt_putfnum_uint,	3,   L, PGC, XA_FP) \
@@ -147,6 +149,8 @@ typedef struct CCallInfo {
   _(ANY,	lj_buf_putstr_rep,	3,   L, PGC, 0) \
   _(ANY,	lj_buf_puttab,		5,   L, PGC, 0) \
   _(ANY,	lj_buf_tostr,		1,  FL, STR, 0) \
+  _(ANY,	lj_bufx_str,		2,  FA, STR, 0) \
+  _(ANY,	lj_bufx_skip,		2,  FS, NIL, 0) \
   _(ANY,	lj_tab_new_ah,		3,   A, TAB, CCI_L) \
   _(ANY,	lj_tab_new1,		2,  FS, TAB, CCI_L) \
   _(ANY,	lj_tab_dup,		2,  FS, TAB, CCI_L) \
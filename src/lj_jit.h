@@ -112,6 +112,8 @@
   _(\012, loopunroll,	15)	/* Max. unroll for loop ops in side traces. */ \
   _(\012, callunroll,	3)	/* Max. unroll for recursive calls. */ \
   _(\011, recunroll,	2)	/* Min. unroll for true recursion. */ \
+  _(\012, fullunroll,	16)	/* Max. trip count for full loop unrolling. */ \
+  _(\011, unrollins,	400)	/* Max. # of IR ins for full loop unrolling. */ \
   \
   /* Size of each machine code area (in KBytes). */ \
   _(\011, sizemcode,	JIT_P_sizemcode_DEFAULT) \
@@ -166,9 +168,14 @@ typedef struct SnapShot {
   uint8_t topslot;	/* Maximum frame extent. */
   uint8_t nent;		/* Number of compressed entries. */
   uint8_t count;	/* Count of taken exits for this snapshot. */
+  uint8_t ndelta;	/* Number of delta entries or SNAP_NODELTA. */
 } SnapShot;
 
 #define SNAPCOUNT_DONE	255	/* Already compiled and linked a side trace. */
+#define SNAP_NODELTA	255	/* Entries are stored in full. */
+
+/* Precompiled restore plan for a hot snapshot. Private to lj_snap.c. */
+typedef struct SnapPlan SnapPlan;
 
 /* Compressed snapshot entry. */
 typedef uint32_t SnapEntry;
@@ -238,6 +245,7 @@ typedef struct GCtrace {
   uint32_t nsnapmap;	/* Number of snapshot map elements. */
   SnapShot *snap;	/* Snapshot array. */
   SnapEntry *snapmap;	/* Snapshot map. */
+  SnapPlan **snapplan;	/* Restore plans for hot snapshots (or NULL). */
   GCRef startpt;	/* Starting prototype. */
   MRef startpc;		/* Bytecode PC of starting instruction. */
   BCIns startins;	/* Original bytecode of starting instruction. */
@@ -274,6 +282,12 @@ static LJ_AINLINE MSize snap_nextofs(GCtrace *T, SnapShot *snap)
     return (snap+1)->mapofs;
 }
 
+/* Number of stored entries of a snapshot, excluding PC and frame links. */
+static LJ_AINLINE MSize snap_nmap(SnapShot *snap)
+{
+  return snap->ndelta == SNAP_NODELTA ? snap->nent : snap->ndelta;
+}
+
 /* Round-robin penalty cache for bytecodes leading to aborted traces. */
 typedef struct HotPenalty {
   MRef pc;		/* Starting bytecode PC. */
@@ -474,7 +488,13 @@ typedef struct jit_State {
   MCode *mcbot;		/* Bottom of current mcode area. */
   size_t szmcarea;	/* Size of current mcode area. */
   size_t szallmcarea;	/* Total size of all allocated mcode areas. */
+#if LJ_HASMCODEPOOL
+  char *mcpool;		/* Base of reserved mcode pool (or NULL). */
+  char *mcpooltop;	/* Lowest mcode area allocated from the pool. */
+  size_t szmcpool;	/* Size of mcode pool. */
+#endif
   size_t tracenum;	/* Overall number of traces. */
+  size_t szallsnap;	/* Total size of snapshots of all traces. */
   size_t nsnaprestore;	/* Overall number of snap restores. */
   size_t ntraceabort;	/* Overall number of abort traces. */
 
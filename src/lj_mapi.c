@@ -12,12 +12,21 @@
 #include "lmisclib.h"
 
 #include "lj_obj.h"
+#include "lj_gc.h"
+#include "lj_str.h"
+#include "lj_strfmt.h"
+#include "lj_state.h"
 #include "lj_dispatch.h"
+#include "lj_trace.h"
+#include "lj_memprof.h"
+#include "lj_heapdump.h"
 
 #if LJ_HASJIT
 #include "lj_jit.h"
 #endif
 
+LJ_STATIC_ASSERT(LUAM_GCPAUSE_HIST == GC_PAUSEHIST);
+
 LUAMISC_API void luaM_metrics(lua_State *L, struct luam_Metrics *metrics)
 {
   global_State *g = G(L);
@@ -51,15 +60,80 @@ LUAMISC_API void luaM_metrics(lua_State *L, struct luam_Metrics *metrics)
   metrics->gc_steps_sweep = gc->state_count[GCSsweep];
   metrics->gc_steps_finalize = gc->state_count[GCSfinalize];
 
+  memcpy(metrics->gc_pause_hist, gc->pausehist, sizeof(gc->pausehist));
+  metrics->gc_atomic_ns = gc->atomictime;
+  metrics->gc_atomic_max_ns = gc->atomicmax;
+
+  metrics->gc_limit = gc->limit == LJ_MAX_MEM ? 0 : gc->limit;
+  metrics->gc_limit_errors = gc->limiterrors;
+  metrics->gc_emergency = gc->emergencies;
+
+  metrics->gc_finalize_queue = gc->finnum;
+  metrics->gc_finalized = gc->finalized;
+  metrics->gc_finalize_ns = gc->fintime;
+
+  metrics->patcache_hit = g->patcache.hit;
+  metrics->patcache_miss = g->patcache.miss;
+
 #if LJ_HASJIT
   metrics->jit_snap_restore = J->nsnaprestore;
   metrics->jit_trace_abort = J->ntraceabort;
   metrics->jit_mcode_size = J->szallmcarea;
+  metrics->jit_snap_size = J->szallsnap;
   metrics->jit_trace_num = J->tracenum;
 #else
   metrics->jit_snap_restore = 0;
   metrics->jit_trace_abort = 0;
   metrics->jit_mcode_size = 0;
+  metrics->jit_snap_size = 0;
   metrics->jit_trace_num = 0;
 #endif
 }
+
+LUAMISC_API int luaM_memprof_start(lua_State *L, const char *fname)
+{
+  lua_assert(fname != NULL);
+  return lj_memprof_start(L, fname);
+}
+
+LUAMISC_API int luaM_memprof_stop(lua_State *L)
+{
+  return lj_memprof_stop(L);
+}
+
+LUAMISC_API int luaM_heapdump_start(lua_State *L, const char *fname)
+{
+  lua_assert(fname != NULL);
+  return lj_heapdump_start(L, fname);
+}
+
+LUAMISC_API int luaM_heapdump_finish(lua_State *L)
+{
+  return lj_heapdump_finish(L);
+}
+
+LUAMISC_API const char *luaM_pushextstring(lua_State *L, char *str,
+					   size_t len, luam_Release release,
+					   void *ud)
+{
+  GCstr *s;
+  LJ_STATIC_ASSERT(sizeof(GCstrext) + sizeof(GCstr) <= LUAM_EXTSTRHDR);
+  lua_assert(str != NULL && release != NULL);
+  lj_gc_check(L);
+  lj_state_checkstack(L, 1);  /* Nothing may throw once the data is taken. */
+  s = lj_str_newext(L, str, len, (GCstrRelease)release, ud);
+  setstrV(L, L->top, s);
+  L->top++;
+  return strdata(s);
+}
+
+LUAMISC_API int luaM_numfmt(lua_State *L, int fmt)
+{
+  global_State *g = G(L);
+  int old = g->numfmt == STRFMT_SHORT ? LUAM_NUMFMT_SHORTEST : LUAM_NUMFMT_G14;
+  if (fmt >= 0 && fmt != old) {
+    g->numfmt = fmt == LUAM_NUMFMT_SHORTEST ? STRFMT_SHORT : STRFMT_G14;
+    lj_trace_flushall(L);  /* Traces may hold numbers converted before. */
+  }
+  return old;
+}
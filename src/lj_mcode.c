@@ -190,11 +190,31 @@ static LJ_NOINLINE void mcode_protfail(jit_State *J)
   }
 }
 
+#if LJ_HASMCODEPOOL
+/*
+** Areas in the MCode pool share the protection of the whole pool. Changing
+** it for a single area would split the 2MB-aligned mapping and the kernel
+** couldn't use huge pages for it anymore.
+*/
+static int mcode_setprotarea(jit_State *J, MCode *mc, size_t sz, int prot)
+{
+  if ((char *)mc >= J->mcpool && (char *)mc < J->mcpool + J->szmcpool) {
+    if ((char *)J->mcarea >= J->mcpool &&
+	(char *)J->mcarea < J->mcpool + J->szmcpool)
+      J->mcprot = prot;  /* The current area changes, too. */
+    return mcode_setprot(J->mcpool, J->szmcpool, prot);
+  }
+  return mcode_setprot(mc, sz, prot);
+}
+#else
+#define mcode_setprotarea(J, mc, sz, prot)	mcode_setprot((mc), (sz), (prot))
+#endif
+
 /* Change protection of MCode area. */
 static void mcode_protect(jit_State *J, int prot)
 {
   if (J->mcprot != prot) {
-    if (LJ_UNLIKELY(mcode_setprot(J->mcarea, J->szmcarea, prot)))
+    if (LJ_UNLIKELY(mcode_setprotarea(J, J->mcarea, J->szmcarea, prot)))
       mcode_protfail(J);
     J->mcprot = prot;
   }
@@ -213,7 +233,7 @@ static void mcode_protect(jit_State *J, int prot)
 #ifdef LJ_TARGET_JUMPRANGE
 
 /* Get memory within relative jump distance of our code in 64 bit mode. */
-static void *mcode_alloc(jit_State *J, size_t sz)
+static void *mcode_alloc_near(jit_State *J, size_t sz, int prot)
 {
   /* Target an address in the static assembler code (64K aligned).
   ** Try addresses within a distance of target-range/2+1MB..target+range/2-1MB.
@@ -233,7 +253,7 @@ static void *mcode_alloc(jit_State *J, size_t sz)
   /* Limit probing iterations, depending on the available pool size. */
   for (i = 0; i < LJ_TARGET_JUMPRANGE; i++) {
     if (mcode_validptr(hint)) {
-      void *p = mcode_alloc_at(J, hint, sz, MCPROT_GEN);
+      void *p = mcode_alloc_at(J, hint, sz, prot);
 
       if (mcode_validptr(p) &&
 	  ((uintptr_t)p + sz - target < range || target - (uintptr_t)p < range))
@@ -246,10 +266,17 @@ static void *mcode_alloc(jit_State *J, size_t sz)
     } while (!(hint + sz < range+range));
     hint = target + hint - range;
   }
-  lj_trace_err(J, LJ_TRERR_MCODEAL);  /* Give up. OS probably ignores hints? */
   return NULL;
 }
 
+static void *mcode_alloc(jit_State *J, size_t sz)
+{
+  void *p = mcode_alloc_near(J, sz, MCPROT_GEN);
+  if (!p)
+    lj_trace_err(J, LJ_TRERR_MCODEAL);  /* Give up. OS probably ignores hints? */
+  return p;
+}
+
 #else
 
 /* All memory addresses are reachable by relative jumps. */
@@ -270,6 +297,85 @@ static void *mcode_alloc(jit_State *J, size_t sz)
 
 #endif
 
+/* -- MCode pool ---------------------------------------------------------- */
+
+#if LJ_HASMCODEPOOL
+
+/*
+** A single region of maxmcode size, rounded up to 2MB, is reserved (but
+** not committed) up front near the static assembler code. It is 2MB-aligned
+** and marked for transparent huge pages. Its protection is only ever
+** changed as a whole, see mcode_setprotarea(). The mcode areas are
+** sub-allocated from the top of the pool downwards, saving the probing for
+** a suitable address for every new area.
+*/
+
+#define MCODE_POOL_ALIGN	((size_t)2 << 20)
+
+#define mcode_inpool(J, p) \
+  ((char *)(p) >= (J)->mcpool && (char *)(p) < (J)->mcpool + (J)->szmcpool)
+
+/* Map an inaccessible region for the pool. Returns NULL on failure. */
+static char *mcode_pool_map(jit_State *J, size_t sz)
+{
+#ifdef LJ_TARGET_JUMPRANGE
+  return (char *)mcode_alloc_near(J, sz, PROT_NONE);
+#else
+  /* Not mcode_alloc_at(), which throws for an unhinted mapping. */
+  void *p = mmap(NULL, sz, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  UNUSED(J);
+  return p == MAP_FAILED ? NULL : (char *)p;
+#endif
+}
+
+/* Reserve the MCode pool. */
+static void mcode_pool_reserve(jit_State *J)
+{
+  size_t sz = (size_t)J->param[JIT_P_maxmcode] << 10;
+  char *p, *q;
+  sz = (sz + MCODE_POOL_ALIGN-1) & ~(MCODE_POOL_ALIGN-1);
+  p = mcode_pool_map(J, sz + MCODE_POOL_ALIGN);
+  if (!p) return;  /* Fall back to separately allocated areas. */
+  /* Trim the unaligned head and tail. */
+  q = (char *)(((uintptr_t)p + MCODE_POOL_ALIGN-1) &
+	       ~(uintptr_t)(MCODE_POOL_ALIGN-1));
+  if (q != p)
+    mcode_free(J, p, (size_t)(q - p));
+  if (q + sz != p + sz + MCODE_POOL_ALIGN)
+    mcode_free(J, q + sz, (size_t)(p + MCODE_POOL_ALIGN - q));
+#ifdef MADV_HUGEPAGE
+  madvise(q, sz, MADV_HUGEPAGE);  /* Best effort only. */
+#endif
+  J->mcpool = q;
+  J->mcpooltop = q + sz;
+  J->szmcpool = sz;
+}
+
+/* Allocate an MCode area from the pool. Returns NULL if exhausted. */
+static void *mcode_pool_alloc(jit_State *J, size_t sz)
+{
+  if (!J->mcpool)
+    mcode_pool_reserve(J);
+  if (J->mcpool && (size_t)(J->mcpooltop - J->mcpool) >= sz &&
+      !mcode_setprot(J->mcpool, J->szmcpool, MCPROT_GEN)) {
+    J->mcpooltop -= sz;
+    return J->mcpooltop;
+  }
+  return NULL;
+}
+
+/* Release the whole MCode pool. */
+static void mcode_pool_free(jit_State *J)
+{
+  if (J->mcpool) {
+    mcode_free(J, J->mcpool, J->szmcpool);
+    J->mcpool = J->mcpooltop = NULL;
+    J->szmcpool = 0;
+  }
+}
+
+#endif
+
 /* -- MCode area management ----------------------------------------------- */
 
 /* Linked list of MCode areas. */
@@ -284,6 +390,10 @@ static void mcode_allocarea(jit_State *J)
   MCode *oldarea = J->mcarea;
   size_t sz = (size_t)J->param[JIT_P_sizemcode] << 10;
   sz = (sz + LJ_PAGESIZE-1) & ~(size_t)(LJ_PAGESIZE - 1);
+#if LJ_HASMCODEPOOL
+  J->mcarea = (MCode *)mcode_pool_alloc(J, sz);
+  if (!J->mcarea)
+#endif
   J->mcarea = (MCode *)mcode_alloc(J, sz);
   J->szmcarea = sz;
   J->mcprot = MCPROT_GEN;
@@ -302,9 +412,15 @@ void lj_mcode_free(jit_State *J)
   J->szallmcarea = 0;
   while (mc) {
     MCode *next = ((MCLink *)mc)->next;
+#if LJ_HASMCODEPOOL
+    if (!mcode_inpool(J, mc))
+#endif
     mcode_free(J, mc, ((MCLink *)mc)->size);
     mc = next;
   }
+#if LJ_HASMCODEPOOL
+  mcode_pool_free(J);
+#endif
 }
 
 /* -- MCode transactions -------------------------------------------------- */
@@ -344,7 +460,8 @@ MCode *lj_mcode_patch(jit_State *J, MCode *ptr, int finish)
   if (finish) {
     if (J->mcarea == ptr)
       mcode_protect(J, MCPROT_RUN);
-    else if (LJ_UNLIKELY(mcode_setprot(ptr, ((MCLink *)ptr)->size, MCPROT_RUN)))
+    else if (LJ_UNLIKELY(mcode_setprotarea(J, ptr, ((MCLink *)ptr)->size,
+					   MCPROT_RUN)))
       mcode_protfail(J);
     return NULL;
   } else {
@@ -359,7 +476,8 @@ MCode *lj_mcode_patch(jit_State *J, MCode *ptr, int finish)
       mc = ((MCLink *)mc)->next;
       lua_assert(mc != NULL);
       if (ptr >= mc && ptr < (MCode *)((char *)mc + ((MCLink *)mc)->size)) {
-	if (LJ_UNLIKELY(mcode_setprot(mc, ((MCLink *)mc)->size, MCPROT_GEN)))
+	if (LJ_UNLIKELY(mcode_setprotarea(J, mc, ((MCLink *)mc)->size,
+					  MCPROT_GEN)))
 	  mcode_protfail(J);
 	return mc;
       }
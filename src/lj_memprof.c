@@ -0,0 +1,268 @@
+/*
+** Allocation profiler.
+**
+** The profiler replaces the allocator of a VM with a wrapper, which
+** forwards each call to the original allocator and appends an event to a
+** buffered stream. Every event is attributed to its source: the current
+** line of a Lua function, a C function, a fast function, a trace or the VM
+** itself. Nothing is done at all while the profiler is not running.
+*/
+
+#define lj_memprof_c
+#define LUA_CORE
+
+#include <stdio.h>
+
+#include "lj_obj.h"
+#include "lj_frame.h"
+#include "lj_debug.h"
+#include "lj_memprof.h"
+#include "lj_dispatch.h"
+
+#define MP_BUFSZ	16384
+#define MP_BUFRESERVE	64	/* Max. size of an event or a symbol header. */
+#define MP_SYMCACHE	1024	/* Must be a power of 2. */
+
+typedef struct MemProf {
+  lua_Alloc allocf;		/* Original allocator. */
+  void *allocd;			/* Original allocator state. */
+  global_State *g;
+  FILE *fp;			/* Output file. */
+  int err;			/* A write error occurred. */
+  uint8_t *pos;			/* Current position in the buffer. */
+  uintptr_t symcache[MP_SYMCACHE];  /* Objects with an emitted symbol. */
+  uint8_t buf[MP_BUFSZ];	/* Output buffer. */
+} MemProf;
+
+/* -- Output -------------------------------------------------------------- */
+
+static void mp_flush(MemProf *mp)
+{
+  size_t n = (size_t)(mp->pos - mp->buf);
+  if (n && !mp->err && fwrite(mp->buf, 1, n, mp->fp) != n)
+    mp->err = 1;
+  mp->pos = mp->buf;
+}
+
+static LJ_AINLINE void mp_reserve(MemProf *mp, size_t n)
+{
+  if ((size_t)(mp->buf + MP_BUFSZ - mp->pos) < n)
+    mp_flush(mp);
+}
+
+static LJ_AINLINE void mp_byte(MemProf *mp, uint32_t b)
+{
+  *mp->pos++ = (uint8_t)b;
+}
+
+static void mp_uleb(MemProf *mp, uint64_t v)
+{
+  uint8_t *p = mp->pos;
+  for (; v >= 0x80; v >>= 7)
+    *p++ = (uint8_t)(v | 0x80);
+  *p++ = (uint8_t)v;
+  mp->pos = p;
+}
+
+static void mp_string(MemProf *mp, const char *s, size_t len)
+{
+  mp_uleb(mp, len);
+  if (len > (size_t)(mp->buf + MP_BUFSZ - mp->pos)) {
+    mp_flush(mp);
+    if (len > MP_BUFSZ) {
+      if (!mp->err && fwrite(s, 1, len, mp->fp) != len)
+	mp->err = 1;
+      return;
+    }
+  }
+  memcpy(mp->pos, s, len);
+  mp->pos += len;
+}
+
+/* -- Symbols ------------------------------------------------------------- */
+
+static LJ_AINLINE uintptr_t *mp_symslot(MemProf *mp, const void *o)
+{
+  uintptr_t u = (uintptr_t)o;
+  return &mp->symcache[((u >> 4) ^ (u >> 14)) & (MP_SYMCACHE-1)];
+}
+
+/* Check whether the symbol for an object has been emitted, mark it if not. */
+static int mp_symcached(MemProf *mp, const void *o)
+{
+  uintptr_t *slot = mp_symslot(mp, o);
+  if (*slot == (uintptr_t)o) return 1;
+  *slot = (uintptr_t)o;
+  return 0;
+}
+
+/* Forget a freed object. Its address may be reused for another one. */
+static LJ_AINLINE void mp_symforget(MemProf *mp, const void *o)
+{
+  uintptr_t *slot = mp_symslot(mp, o);
+  if (*slot == (uintptr_t)o) *slot = 0;
+}
+
+static void mp_symproto(MemProf *mp, GCproto *pt)
+{
+  if (!mp_symcached(mp, pt)) {
+    GCstr *name = proto_chunkname(pt);
+    mp_reserve(mp, MP_BUFRESERVE);
+    mp_byte(mp, MP_SYM|MP_SYM_PROTO);
+    mp_uleb(mp, (uintptr_t)pt);
+    mp_uleb(mp, (uint32_t)pt->firstline);
+    mp_string(mp, strdata(name), name->len);
+  }
+}
+
+#if LJ_HASJIT
+static void mp_symtrace(MemProf *mp, GCtrace *T)
+{
+  if (!mp_symcached(mp, T)) {
+    GCproto *pt = &gcref(T->startpt)->pt;
+    BCPos pos = proto_bcpos(pt, mref(T->startpc, const BCIns));
+    mp_symproto(mp, pt);
+    mp_reserve(mp, MP_BUFRESERVE);
+    mp_byte(mp, MP_SYM|MP_SYM_TRACE);
+    mp_uleb(mp, T->traceno);
+    mp_uleb(mp, (uintptr_t)pt);
+    mp_uleb(mp, (uint32_t)lj_debug_line(pt, pos));
+  }
+}
+#endif
+
+/* -- Event sources ------------------------------------------------------- */
+
+/* Get the source of the current event and emit the symbols it needs. */
+static uint32_t mp_source(MemProf *mp, uint64_t *a, uint64_t *b)
+{
+  global_State *g = mp->g;
+  int32_t st = g->vmstate;
+  if (st >= 0) {
+#if LJ_HASJIT
+    GCtrace *T = traceref(G2J(g), (TraceNo)st);
+    if (T) {
+      mp_symtrace(mp, T);
+      *a = (uint32_t)st;
+      return MP_SRC_TRACE;
+    }
+#endif
+  } else if (st == ~LJ_VMST_INTERP || st == ~LJ_VMST_C) {
+    lua_State *L = gco2th(gcref(g->cur_L));
+    GCfunc *fn;
+    if (L == NULL || L->base == NULL)
+      return MP_SRC_INTERNAL;
+    fn = curr_func(L);
+    if (fn->c.gct != ~LJ_TFUNC)  /* Empty stack. */
+      return MP_SRC_INTERNAL;
+    if (isluafunc(fn)) {
+      GCproto *pt = funcproto(fn);
+      void *cf = cframe_raw(L->cframe);
+      BCLine line = pt->firstline;
+      if (cf && (char *)cframe_pc(cf) != (char *)cframe_L(cf)) {
+	BCPos pos = proto_bcpos(pt, cframe_pc(cf)) - 1;
+	if (pos < pt->sizebc) line = lj_debug_line(pt, pos);
+      }
+      mp_symproto(mp, pt);
+      *a = (uintptr_t)pt;
+      *b = (uint32_t)line;
+      return MP_SRC_LFUNC;
+    } else if (fn->c.ffid != FF_C) {
+      *a = fn->c.ffid;
+      return MP_SRC_FFUNC;
+    } else {
+      *a = (uintptr_t)fn->c.f;
+      return MP_SRC_CFUNC;
+    }
+  }
+  return MP_SRC_INTERNAL;
+}
+
+/* -- Allocator wrapper --------------------------------------------------- */
+
+static void *mp_allocf(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+  MemProf *mp = (MemProf *)ud;
+  void *nptr = mp->allocf(mp->allocd, ptr, osize, nsize);
+  uint64_t a = 0, b = 0;
+  uint32_t ev, src;
+  if (nsize == 0) {
+    if (ptr == NULL) return nptr;
+    mp_symforget(mp, ptr);
+    ev = MP_FREE;
+  } else if (nptr == NULL) {
+    return nptr;  /* Failed allocations don't change the heap. */
+  } else {
+    ev = ptr == NULL ? MP_ALLOC : MP_REALLOC;
+  }
+  src = mp_source(mp, &a, &b);
+  mp_reserve(mp, MP_BUFRESERVE);
+  mp_byte(mp, ev|src);
+  if (src != MP_SRC_INTERNAL) {
+    mp_uleb(mp, a);
+    if (src == MP_SRC_LFUNC) mp_uleb(mp, b);
+  }
+  if (ev != MP_ALLOC) {
+    mp_uleb(mp, (uintptr_t)ptr);
+    mp_uleb(mp, osize);
+  }
+  if (ev != MP_FREE) {
+    mp_uleb(mp, (uintptr_t)nptr);
+    mp_uleb(mp, nsize);
+  }
+  return nptr;
+}
+
+/* -- Public API ---------------------------------------------------------- */
+
+int lj_memprof_isrunning(global_State *g)
+{
+  return g->allocf == mp_allocf;
+}
+
+int lj_memprof_start(lua_State *L, const char *fname)
+{
+  global_State *g = G(L);
+  MemProf *mp;
+  FILE *fp;
+  if (lj_memprof_isrunning(g))
+    return MP_ERRRUN;
+  fp = fopen(fname, "wb");
+  if (fp == NULL)
+    return MP_ERRIO;
+  mp = (MemProf *)g->allocf(g->allocd, NULL, 0, sizeof(MemProf));
+  if (mp == NULL) {
+    fclose(fp);
+    return MP_ERRIO;
+  }
+  memset(mp, 0, offsetof(MemProf, buf));
+  mp->allocf = g->allocf;
+  mp->allocd = g->allocd;
+  mp->g = g;
+  mp->fp = fp;
+  mp->pos = mp->buf;
+  mp_byte(mp, 'l'); mp_byte(mp, 'j'); mp_byte(mp, 'm');
+  mp_byte(mp, MP_VERSION);
+  g->allocf = mp_allocf;
+  g->allocd = mp;
+  return MP_OK;
+}
+
+int lj_memprof_stop(lua_State *L)
+{
+  global_State *g = G(L);
+  MemProf *mp;
+  int err;
+  if (!lj_memprof_isrunning(g))
+    return MP_ERRRUN;
+  mp = (MemProf *)g->allocd;
+  g->allocf = mp->allocf;
+  g->allocd = mp->allocd;
+  mp_reserve(mp, 1);
+  mp_byte(mp, MP_END);
+  mp_flush(mp);
+  err = mp->err;
+  if (fclose(mp->fp) != 0) err = 1;
+  g->allocf(g->allocd, mp, sizeof(MemProf), 0);
+  return err ? MP_ERRIO : MP_OK;
+}
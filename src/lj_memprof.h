@@ -0,0 +1,61 @@
+/*
+** Allocation profiler.
+*/
+
+#ifndef _LJ_MEMPROF_H
+#define _LJ_MEMPROF_H
+
+#include "lj_obj.h"
+
+/*
+** The profile is a stream of records written to a file. All numbers are
+** ULEB128-encoded, strings are a length followed by the bytes.
+**
+**   stream  := 'l' 'j' 'm' version record* end
+**   record  := symbol | event
+**   symbol  := MP_SYM|MP_SYM_PROTO  addr firstline chunkname
+**            | MP_SYM|MP_SYM_TRACE  traceno protoaddr line
+**   event   := (MP_ALLOC|src)   source ptr nsize
+**            | (MP_FREE|src)    source ptr osize
+**            | (MP_REALLOC|src) source optr osize nptr nsize
+**   source  := <empty>          (MP_SRC_INTERNAL: GC, JIT compiler etc.)
+**            | protoaddr line   (MP_SRC_LFUNC)
+**            | cfuncaddr        (MP_SRC_CFUNC)
+**            | traceno          (MP_SRC_TRACE)
+**            | ffid             (MP_SRC_FFUNC)
+**   end     := MP_END
+**
+** A symbol is emitted before the first event referring to it. It is
+** emitted again when the address or trace number is reused later on.
+*/
+
+#define MP_VERSION	1
+
+#define MP_SYM		0x00
+#define MP_ALLOC	0x01
+#define MP_FREE		0x02
+#define MP_REALLOC	0x03
+#define MP_EVMASK	0x03
+
+#define MP_SRC_INTERNAL	0x00
+#define MP_SRC_LFUNC	0x04
+#define MP_SRC_CFUNC	0x08
+#define MP_SRC_TRACE	0x0c
+#define MP_SRC_FFUNC	0x10
+#define MP_SRCMASK	0x1c
+
+#define MP_SYM_PROTO	0x00
+#define MP_SYM_TRACE	0x04
+
+#define MP_END		0x80
+
+/* Error codes, same as LUAM_MEMPROF_*. */
+#define MP_OK		0
+#define MP_ERRRUN	1
+#define MP_ERRIO	2
+
+LJ_FUNC int lj_memprof_start(lua_State *L, const char *fname);
+LJ_FUNC int lj_memprof_stop(lua_State *L);
+LJ_FUNC int lj_memprof_isrunning(global_State *g);
+
+#endif
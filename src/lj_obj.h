@@ -321,6 +321,7 @@ enum {
   UDTYPE_USERDATA,	/* Regular userdata. */
   UDTYPE_IO_FILE,	/* I/O library FILE. */
   UDTYPE_FFI_CLIB,	/* FFI C library namespace. */
+  UDTYPE_BUFFER,	/* String buffer object. */
   UDTYPE__MAX
 };
 
@@ -582,28 +583,71 @@ enum {
   GCSmax
 };
 
+/* Garbage collector kinds. */
+enum {
+  GCKinc,		/* Incremental collector, every cycle marks the heap. */
+  GCKgen		/* Generational collector, see lj_gc.c. */
+};
+
+/* Phases of the generational collector. */
+enum {
+  GCGminor,		/* Minor cycles, old objects are neither marked nor swept. */
+  GCGwhiten,		/* Sweep everything to white to prepare a major cycle. */
+  GCGmajor		/* Major cycle, all surviving objects become old. */
+};
+
+#define GC_PAUSEHIST	20	/* Buckets of the GC step duration histogram. */
+
 typedef struct GCState {
   GCSize total;		/* Memory currently allocated. */
   GCSize threshold;	/* Memory threshold. */
   uint8_t currentwhite;	/* Current white color. */
   uint8_t state;	/* GC state. */
   uint8_t nocdatafin;	/* No cdata finalizer called. */
-  uint8_t unused2;
+  uint8_t kind;		/* GC kind (GCKinc or GCKgen). */
   MSize sweepstr;	/* Sweep position in string table. */
   GCRef root;		/* List of all collectable objects. */
   MRef sweep;		/* Sweep position in root list. */
   GCRef gray;		/* List of gray objects. */
   GCRef grayagain;	/* List of objects for atomic traversal. */
   GCRef weak;		/* List of weak tables (to be cleared). */
-  GCRef mmudata;	/* List of userdata (to be finalized). */
+  GCRef mmudata;	/* Queue of userdata/cdata (to be finalized). */
+  GCRef trav;		/* Huge object traversed in chunks or NULL. */
+  MSize travpos;	/* Next slot of trav to traverse. */
   GCSize debt;		/* Debt (how much GC is behind schedule). */
   GCSize estimate;	/* Estimate of memory actually in use. */
   MSize stepmul;	/* Incremental GC step granularity. */
   MSize pause;		/* Pause between successive GC cycles. */
+  MSize budget;		/* Time budget per GC step in us or 0. */
+  GCSize budgetlim;	/* Work limit per GC step fitting the budget. */
+  GCSize limit;		/* Memory limit (LJ_MAX_MEM if none). */
+  MSize finbatch;	/* Max. number of finalizers run by a GC step. */
+  MSize finleft;	/* Finalizers left to run in the current GC step. */
+  MSize stepseq;	/* Sequence number of the GC step for sampling. */
+  MSize minormul;	/* Growth between successive minor cycles. */
+  uint8_t genphase;	/* Phase of the generational collector. */
+  uint8_t remarked;	/* Atomic lists already remarked in this cycle. */
+  GCRef oldroot;	/* First old object in root list. */
+  GCRef oldudata;	/* First old userdata after the main thread. */
+  GCRef sweptroot;	/* First object in root list marked before the sweep. */
+  GCRef sweptudata;	/* Same for the userdata after the main thread. */
+  GCSize majorest;	/* Estimate after the last major cycle. */
+  struct HeapDump *dump;	/* Heap dump being written or NULL. */
+#if LJ_HASGCTHREAD
+  struct GCSweeper *sweeper;	/* Background sweeper or NULL. */
+#endif
 
   size_t freed;		/* Total amount of freed memory. */
   size_t allocated;	/* Total amount of allocated memory. */
   size_t state_count[GCSmax]; /* Count of incremental GC steps per state. */
+  size_t pausehist[GC_PAUSEHIST]; /* Histogram of timed GC step durations. */
+  uint64_t atomictime;	/* Total time spent in atomic phases in ns. */
+  uint64_t atomicmax;	/* Longest atomic phase in ns. */
+  size_t limiterrors;	/* Memory errors due to the memory limit. */
+  size_t emergencies;	/* Full GCs done close to the memory limit. */
+  size_t finnum;	/* Number of objects queued for finalization. */
+  size_t finalized;	/* Total number of finalizers run. */
+  uint64_t fintime;	/* Total time spent in finalizers in ns. */
   size_t tabnum;	/* Amount of allocated table objects. */
   size_t udatanum;	/* Amount of allocated udata objects. */
 #ifdef LJ_HASFFI
@@ -611,11 +655,33 @@ typedef struct GCState {
 #endif
 } GCState;
 
+/*
+** Cache of programs compiled from strings, i.e. patterns and formats.
+** The programs are opaque here.
+*/
+#define LJ_PATCACHE_SETS	32	/* Number of sets, must be a power of 2. */
+
+typedef struct StrPatEntry {
+  GCRef pat;		/* Source string. Weak, cleared by the GC. */
+  MSize size;		/* Size of the compiled program. */
+  void *prog;		/* Compiled program or NULL. */
+} StrPatEntry;
+
+typedef struct StrPatCache {
+  StrPatEntry e[LJ_PATCACHE_SETS][2];  /* 2-way, most recently used first. */
+  uint32_t gen;		/* Incremented whenever a program is freed. */
+  size_t hit;		/* Lookups of cached strings. */
+  size_t miss;		/* Lookups of strings not in the cache. */
+} StrPatCache;
+
 /* Global state, shared by all threads of a Lua universe. */
 typedef struct global_State {
   GCRef *strhash;	/* String hash table (hash chain anchors). */
   MSize strmask;	/* String hash mask (size of hash table - 1). */
   MSize strnum;		/* Number of strings in hash table. */
+  GCRef *stroldhash;	/* Old string hash table while rehashing. */
+  MSize stroldmask;	/* Old string hash mask. */
+  MSize strrehash;	/* Number of old hash chains left to rehash. */
 #if LUAJIT_SMART_STRINGS
   struct {
     BloomFilter cur[2];
@@ -628,6 +694,7 @@ typedef struct global_State {
   void *allocd;		/* Memory allocator data. */
   GCState gc;		/* Garbage collector. */
   SBuf tmpbuf;		/* Temporary string buffer. */
+  uint32_t numfmt;	/* Format of number to string conversions. */
   GCstr strempty;	/* Empty string. */
   uint8_t stremptyz;	/* Zero terminator of empty string. */
   uint8_t hookmask;	/* Hook mask. */
@@ -650,6 +717,9 @@ typedef struct global_State {
   MRef jit_base;	/* Current JIT code L->base or NULL. */
   MRef ctype_state;	/* Pointer to C type state. */
   GCRef gcroot[GCROOT_MAX];  /* GC roots. */
+  /* Kept last, so the fields above stay within reach of JIT code. */
+  StrPatCache patcache;	/* Cache of compiled string patterns. */
+  StrPatCache fmtcache;	/* Cache of parsed format strings. */
 } global_State;
 
 #define mainthread(g)	(&gcref(g->mainthref)->th)
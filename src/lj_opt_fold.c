@@ -557,7 +557,7 @@ LJFOLDF(bufput_append)
 {
   /* New buffer, no other buffer op inbetween and same buffer? */
   if ((J->flags & JIT_F_OPT_FWD) &&
-      !(fleft->op2 & IRBUFHDR_APPEND) &&
+      fleft->op2 == IRBUFHDR_RESET &&
       fleft->prev == fright->op2 &&
       fleft->op1 == IR(fright->op2)->op1) {
     IRRef ref = fins->op1;
@@ -1195,6 +1195,64 @@ LJFOLDF(simplify_tobit_conv)
   return NEXTFOLD;
 }
 
+/* Emit floor(i/k) for an integer i and a constant k > 1.
+**
+** Powers of two turn into an arithmetic shift. Otherwise the sign is folded
+** into a 31 bit unsigned dividend u = i ^ (i >> 31), which is divided with
+** a 64 bit multiply-high by a magic number (Granlund/Montgomery). The sign
+** is restored afterwards: floor(i/k) = (u/k) ^ (i >> 31).
+** Returns 0 if the target lacks the 64 bit integer IR needed for this.
+*/
+static TRef kfold_floordiv_int(jit_State *J, TRef tr, int32_t k)
+{
+  lua_assert(k > 1);
+  if ((k & (k-1)) == 0)  /* floor(i/2^k) ==> i >> k */
+    return emitir(IRTI(IR_BSAR), tr, lj_ir_kint(J, (int32_t)lj_ffs(k)));
+#if LJ_64 && LJ_HASFFI
+  {
+    uint32_t sh = 32 + lj_fls((uint32_t)k);  /* 31 + ceil(log2(k)). */
+    uint64_t m = (U64x(00000000,00000001) << sh) / (uint64_t)k + 1;
+    TRef sx = emitir(IRTI(IR_BSAR), tr, lj_ir_kint(J, 31));
+    TRef tmp = emitir(IRTI(IR_BXOR), tr, sx);
+    tmp = emitir(IRT(IR_CONV, IRT_I64), tmp, (IRT_I64<<5)|IRT_INT);
+    tmp = emitir(IRT(IR_MUL, IRT_I64), tmp, lj_ir_kint64(J, m));
+    tmp = emitir(IRT(IR_BSHR, IRT_I64), tmp, lj_ir_kint(J, (int32_t)sh));
+    tmp = emitir(IRTI(IR_CONV), tmp, (IRT_INT<<5)|IRT_I64);
+    return emitir(IRTI(IR_BXOR), tmp, sx);
+  }
+#else
+  return 0;
+#endif
+}
+
+/* Strength reduction of floor(i/k) with an integer i and a constant k. */
+LJFOLD(FPMATH DIV IRFPM_FLOOR)
+LJFOLD(FPMATH MUL IRFPM_FLOOR)
+LJFOLDF(simplify_floor_divk)
+{
+  IRIns *ir;
+  lua_Number n;
+  int32_t k;
+  TRef tr;
+  PHIBARRIER(fleft);
+  ir = IR(fleft->op1);
+  if (IR(fleft->op2)->o != IR_KNUM || ir->o != IR_CONV ||
+      (ir->op2 & IRCONV_SRCMASK) != IRT_INT)
+    return NEXTFOLD;
+  n = ir_knum(IR(fleft->op2))->n;
+  if (fleft->o == IR_MUL) {  /* x / 2^k has been turned into x * 2^-k. */
+    if (n <= 0.0 || n >= 1.0) return NEXTFOLD;
+    n = 1.0 / n;
+  }
+  k = lj_num2int(n);
+  if (k <= 1 || n != (lua_Number)k ||
+      (fleft->o == IR_MUL && (k & (k-1)) != 0))
+    return NEXTFOLD;
+  tr = kfold_floordiv_int(J, ir->op1, k);
+  if (!tr) return NEXTFOLD;
+  return emitir(IRTN(IR_CONV), tr, IRCONV_NUM_INT);
+}
+
 /* Shortcut floor/ceil/round + IRT_NUM <- IRT_INT/IRT_U32 conversion. */
 LJFOLD(FPMATH CONV IRFPM_FLOOR)
 LJFOLD(FPMATH CONV IRFPM_CEIL)
@@ -1421,6 +1479,13 @@ LJFOLDF(simplify_intmod_k)
     fins->o = IR_BAND;
     fins->op2 = lj_ir_kint(J, k-1);
     return RETRYFOLD;
+  } else if (k > 1 && irt_isint(fins->t)) {  /* i % k ==> i - floor(i/k)*k */
+    IRRef op1 = fins->op1;
+    TRef tmp = kfold_floordiv_int(J, op1, k);
+    if (tmp) {
+      tmp = emitir(IRTI(IR_MUL), tmp, lj_ir_kint(J, k));
+      return emitir(IRTI(IR_SUB), op1, tmp);
+    }
   }
   return NEXTFOLD;
 }
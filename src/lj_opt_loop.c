@@ -228,6 +228,7 @@ static void loop_subst_snap(jit_State *J, SnapShot *osnap,
   snap->nslots = nslots;
   snap->topslot = osnap->topslot;
   snap->count = 0;
+  snap->ndelta = SNAP_NODELTA;
   nmap = &J->cur.snapmap[nmapofs];
   /* Substitute snapshot slots. */
   on = ln = nn = 0;
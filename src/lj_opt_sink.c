@@ -13,6 +13,7 @@
 #include "lj_ir.h"
 #include "lj_jit.h"
 #include "lj_iropt.h"
+#include "lj_dispatch.h"
 #include "lj_target.h"
 
 /* Some local macros to save typing. Undef'd at the end. */
@@ -61,6 +62,63 @@ static int sink_checkphi(jit_State *J, IRIns *ira, IRRef ref)
   return 1;  /* Constant (non-PHI). */
 }
 
+/* Check whether a loop-carried string needs to be created.
+**
+** Building a string piecewise in a loop appends to the temporary buffer,
+** see bufput_append. The intermediate strings are only needed on a trace
+** exit, if they are used nowhere else. The snapshots must refer to them
+** only while the buffer holds exactly their contents.
+*/
+static int sink_checkbufstr(jit_State *J, IRIns *irp)
+{
+  IRRef lref = irp->op1, rref = irp->op2, hdr, ref;
+  IRIns *ir;
+  SnapShot *snap;
+  MSize n;
+  /* The loop appends to the buffer holding the left PHI string. */
+  for (ir = IR(rref); ir->o != IR_BUFHDR; ir = IR(ir->op1)) ;
+  hdr = (IRRef)(ir - J->cur.ir);
+  if (ir->op2 != (IRBUFHDR_RESET|IRBUFHDR_APPEND) ||
+      ir->op1 != IR(lref)->op1 || ir->prev != IR(lref)->op2 ||
+      J->chain[IR_BUFHDR] != hdr)
+    return 0;  /* Other buffer operations in between. */
+  /* Which must be the temporary buffer. */
+  for (ir = IR(lref); ir->o != IR_BUFHDR || (ir->op2 & IRBUFHDR_APPEND);
+       ir = IR(ir->op1)) ;
+  if (ir->op2 != IRBUFHDR_RESET || !irref_isk(ir->op1) ||
+      ir_kptr(IR(ir->op1)) != (void *)&J2G(J)->tmpbuf)
+    return 0;
+  /* The strings must not be used except by the PHI. */
+  for (ref = lref+1; ref < J->cur.nins; ref++) {
+    ir = IR(ref);
+    if (ir->o != IR_PHI && (ir->op1 == lref || ir->op2 == lref ||
+			    ir->op1 == rref || ir->op2 == rref))
+      return 0;
+  }
+  /*
+  ** The left PHI string is overwritten by the appends in the loop. No exit
+  ** after them may use a snapshot referring to it. This includes the last
+  ** snapshot before the LOOP, which may still cover guards in the body.
+  */
+  for (n = 0, snap = J->cur.snap; n < J->cur.nsnap; n++, snap++) {
+    IRRef end = n+1 < J->cur.nsnap ? snap[1].ref : J->cur.nins;
+    if (end > hdr+1) {
+      SnapEntry *map = &J->cur.snapmap[snap->mapofs];
+      MSize i;
+      for (i = 0; i < snap->nent; i++)
+	if (snap_ref(map[i]) == lref)
+	  break;
+      if (i == snap->nent) continue;
+      if (snap->ref > hdr)
+	return 0;  /* A GC check may exit at the start of the snapshot. */
+      for (ref = hdr+1; ref < end; ref++)
+	if (irt_isguard(IR(ref)->t))
+	  return 0;
+    }
+  }
+  return 1;
+}
+
 /* Mark non-sinkable allocations using single-pass backward propagation.
 **
 ** Roots for the marking process are:
@@ -70,6 +128,7 @@ static int sink_checkphi(jit_State *J, IRIns *ira, IRRef ref)
 ** - Any remaining loads not eliminated by store-to-load forwarding.
 ** - Stores with non-constant keys.
 ** - All stored values.
+** - All strings which aren't loop-carried, see sink_checkbufstr().
 */
 static void sink_mark_ins(jit_State *J)
 {
@@ -102,9 +161,13 @@ static void sink_mark_ins(jit_State *J)
 	irt_setmark(ir->t);  /* Mark ineligible allocation. */
       /* fallthrough */
 #endif
-    case IR_USTORE:
+    case IR_USTORE: case IR_BUFPUT:
       irt_setmark(IR(ir->op2)->t);  /* Mark stored value. */
       break;
+    case IR_BUFSTR:
+      if (!irt_isphi(ir->t))
+	irt_setmark(ir->t);  /* Mark string which isn't loop-carried. */
+      break;
 #if LJ_HASFFI
     case IR_CALLXS:
 #endif
@@ -116,7 +179,8 @@ static void sink_mark_ins(jit_State *J)
       irl->prev = irr->prev = 0;  /* Clear PHI value counts. */
       if (irl->o == irr->o &&
 	  (irl->o == IR_TNEW || irl->o == IR_TDUP ||
-	   (LJ_HASFFI && (irl->o == IR_CNEW || irl->o == IR_CNEWI))))
+	   (LJ_HASFFI && (irl->o == IR_CNEW || irl->o == IR_CNEWI)) ||
+	   (irl->o == IR_BUFSTR && sink_checkbufstr(J, ir))))
 	break;
       irt_setmark(irl->t);
       irt_setmark(irr->t);
@@ -189,7 +253,7 @@ static void sink_sweep_ins(jit_State *J)
 #if LJ_HASFFI
     case IR_CNEW: case IR_CNEWI:
 #endif
-    case IR_TNEW: case IR_TDUP:
+    case IR_TNEW: case IR_TDUP: case IR_BUFSTR:
       if (!irt_ismarked(ir->t)) {
 	ir->t.irt &= ~IRT_GUARD;
 	ir->prev = REGSP(RID_SINK, 0);
@@ -202,7 +266,7 @@ static void sink_sweep_ins(jit_State *J)
     case IR_PHI: {
       IRIns *ira = IR(ir->op2);
       if (!irt_ismarked(ira->t) &&
-	  (ira->o == IR_TNEW || ira->o == IR_TDUP ||
+	  (ira->o == IR_TNEW || ira->o == IR_TDUP || ira->o == IR_BUFSTR ||
 	   (LJ_HASFFI && (ira->o == IR_CNEW || ira->o == IR_CNEWI)))) {
 	ir->prev = REGSP(RID_SINK, 0);
       } else {
@@ -234,7 +298,7 @@ void lj_opt_sink(jit_State *J)
   const uint32_t need = (JIT_F_OPT_SINK|JIT_F_OPT_FWD|
 			 JIT_F_OPT_DCE|JIT_F_OPT_CSE|JIT_F_OPT_FOLD);
   if ((J->flags & need) == need &&
-      (J->chain[IR_TNEW] || J->chain[IR_TDUP] ||
+      (J->chain[IR_TNEW] || J->chain[IR_TDUP] || J->chain[IR_BUFSTR] ||
        (LJ_HASFFI && (J->chain[IR_CNEW] || J->chain[IR_CNEWI])))) {
     if (!J->loopref)
       sink_mark_snap(J, &J->cur.snap[J->cur.nsnap-1]);
@@ -547,6 +547,63 @@ static LoopEvent rec_loop(jit_State *J, BCReg ra)
   return LOOPEV_ENTER;
 }
 
+/* Get the remaining trip count of a FOR loop with constant control refs. */
+static lua_Number rec_for_tripcount(jit_State *J, IRRef idx, IRRef stop,
+				    IRRef step)
+{
+  IRIns *ir;
+  lua_Number v[3];
+  IRRef ref[3];
+  int i;
+  ref[0] = idx; ref[1] = stop; ref[2] = step;
+  for (i = 0; i < 3; i++) {
+    if (!ref[i] || !irref_isk(ref[i]))
+      return -1;  /* Not a constant. */
+    ir = IR(ref[i]);
+    v[i] = ir->o == IR_KINT ? (lua_Number)ir->i : ir_knum(ir)->n;
+  }
+  if (v[2] == 0)
+    return -1;
+  return lj_vm_floor((v[1] - v[0]) / v[2]) + 1;
+}
+
+/* Check whether the rest of an inner FOR loop can be fully unrolled. The IR
+** size per iteration is estimated from the loop body recorded since the FORI
+** or the previous FORL. It's unknown, if the trace started inside the body.
+*/
+static int rec_for_unroll(jit_State *J, const BCIns *fori)
+{
+  TRef *tr = &J->base[bc_a(*fori)];
+  IRRef size = J->cur.nins - J->loopref;
+  lua_Number n;
+  if (!(J->flags & JIT_F_OPT_LOOP) || !J->loopref)
+    return 0;
+  n = rec_for_tripcount(J, tref_ref(tr[FORL_IDX]), tref_ref(tr[FORL_STOP]),
+			tref_ref(tr[FORL_STEP]));
+  return n >= 0 && n <= (lua_Number)J->param[JIT_P_fullunroll] &&
+	 n * (lua_Number)size <= (lua_Number)J->param[JIT_P_unrollins];
+}
+
+/* Check whether a root trace for a short FOR loop with a constant trip count
+** should be left to an outer trace, which fully unrolls it. Give up after
+** a couple of attempts, e.g. if no outer trace could be formed.
+*/
+static int rec_for_outer(jit_State *J, const BCIns *pc)
+{
+  lua_Number n;
+  ptrdiff_t i;
+  if (!(J->flags & JIT_F_OPT_LOOP))
+    return 0;
+  n = rec_for_tripcount(J, J->scev.start, J->scev.stop, J->scev.step);
+  if (!(n >= 0 && n <= (lua_Number)J->param[JIT_P_fullunroll]))
+    return 0;
+  for (i = 0; i < PENALTY_SLOTS; i++)
+    if (mref(J->penalty[i].pc, const BCIns) == pc)
+      return J->penalty[i].reason == LJ_TRERR_LOUTER &&
+	     J->penalty[i].val < 8*PENALTY_MIN;
+  return 1;
+}
+
 /* Check if a loop repeatedly failed to trace because it didn't loop back. */
 static int innerloopleft(jit_State *J, const BCIns *pc)
 {
@@ -572,6 +629,10 @@ static void rec_loop_interp(jit_State *J, const BCIns *pc, LoopEvent ev)
 	lj_trace_err(J, LJ_TRERR_LLEAVE);
       lj_record_stop(J, LJ_TRLINK_LOOP, J->cur.traceno);  /* Looping trace. */
     } else if (ev != LOOPEV_LEAVE) {  /* Entering inner loop? */
+      if (bc_op(*pc) == BC_FORL && rec_for_unroll(J, pc+bc_j(*pc))) {
+	J->loopref = J->cur.nins;  /* Fully unroll constant trip count loop. */
+	return;
+      }
       /* It's usually better to abort here and wait until the inner loop
       ** is traced. But if the inner loop repeatedly didn't loop back,
       ** this indicates a low trip count. In this case try unrolling
@@ -586,7 +647,10 @@ static void rec_loop_interp(jit_State *J, const BCIns *pc, LoopEvent ev)
       J->loopref = J->cur.nins;
     }
   } else if (ev != LOOPEV_LEAVE) {  /* Side trace enters an inner loop. */
+    int unroll = bc_op(*pc) == BC_FORL && rec_for_unroll(J, pc+bc_j(*pc));
     J->loopref = J->cur.nins;
+    if (unroll)
+      return;  /* Fully unroll constant trip count loop. */
     if (--J->loopunroll < 0)
       lj_trace_err(J, LJ_TRERR_LUNROLL);  /* Limit loop unrolling. */
   }  /* Side trace continues across a loop that's left or not entered. */
@@ -2607,9 +2671,11 @@ void lj_record_setup(jit_State *J)
     ** at the start! So snapshot #0 needs to point to the *next* instruction.
     */
     lj_snap_add(J);
-    if (bc_op(J->cur.startins) == BC_FORL)
+    if (bc_op(J->cur.startins) == BC_FORL) {
       rec_for_loop(J, J->pc-1, &J->scev, 1);
-    else if (bc_op(J->cur.startins) == BC_ITERC)
+      if (rec_for_outer(J, mref(J->cur.startpc, const BCIns)))
+	lj_trace_err(J, LJ_TRERR_LOUTER);
+    } else if (bc_op(J->cur.startins) == BC_ITERC)
       J->startpc = NULL;
     if (1 + J->pt->framesize >= LJ_MAX_JSLOTS)
       lj_trace_err(J, LJ_TRERR_STACKOV);
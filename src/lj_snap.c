@@ -11,6 +11,8 @@
 #if LJ_HASJIT
 
 #include "lj_gc.h"
+#include "lj_buf.h"
+#include "lj_str.h"
 #include "lj_tab.h"
 #include "lj_state.h"
 #include "lj_frame.h"
@@ -18,6 +20,7 @@
 #include "lj_ir.h"
 #include "lj_jit.h"
 #include "lj_iropt.h"
+#include "lj_ircall.h"
 #include "lj_trace.h"
 #include "lj_snap.h"
 #include "lj_target.h"
@@ -165,6 +168,7 @@ static void snapshot_stack(jit_State *J, SnapShot *snap, MSize nsnapmap)
   snap->ref = (IRRef1)J->cur.nins;
   snap->nslots = (uint8_t)nslots;
   snap->count = 0;
+  snap->ndelta = SNAP_NODELTA;
   J->cur.nsnapmap = (uint32_t)(nsnapmap + nent);
 }
 
@@ -329,6 +333,124 @@ void lj_snap_shrink(jit_State *J)
   J->cur.nsnapmap = (uint32_t)(snap->mapofs + m);  /* Free up space in map. */
 }
 
+/* -- Snapshot map packing ------------------------------------------------ */
+
+/*
+** Adjacent snapshots of a trace mostly hold the same entries. When a trace
+** is saved, the entries of a snapshot are stored as a delta against the
+** previous snapshot: an entry for every added or changed slot and a
+** zero-ref entry for every dropped slot, sorted by slot. Every
+** SNAP_KEYFRAME-th snapshot is stored in full to bound the unpacking cost.
+** The PC and frame links are always stored in full, so snap_nextofs()
+** continues to work on the packed map.
+*/
+
+#define SNAP_KEYFRAME	8
+
+/* Check whether the snapshot entries are strictly sorted by slot. */
+static int snap_sorted(SnapEntry *map, MSize nent)
+{
+  MSize n;
+  for (n = 1; n < nent; n++)
+    if (snap_slot(map[n]) <= snap_slot(map[n-1]))
+      return 0;
+  return 1;
+}
+
+/* Compute delta between two snapshots. Returns SNAP_NODELTA if too big. */
+static MSize snap_delta(SnapEntry *omap, MSize onent,
+			SnapEntry *map, MSize nent, SnapEntry *dmap)
+{
+  MSize o = 0, n = 0, d = 0;
+  while (o < onent || n < nent) {
+    SnapEntry sn;
+    if (o >= onent || (n < nent && snap_slot(map[n]) < snap_slot(omap[o]))) {
+      sn = map[n++];  /* Added slot. */
+    } else if (n >= nent || snap_slot(omap[o]) < snap_slot(map[n])) {
+      sn = SNAP(snap_slot(omap[o]), 0, 0);  /* Dropped slot. */
+      o++;
+      goto add;
+    } else {
+      sn = map[n++];
+      if (sn == omap[o++]) continue;  /* Unchanged slot. */
+    }
+    if (snap_ref(sn) == 0) return SNAP_NODELTA;  /* Ambiguous. */
+  add:
+    if (d+1 >= nent) return SNAP_NODELTA;  /* Not worth it. */
+    if (dmap) dmap[d] = sn;
+    d++;
+  }
+  return d;
+}
+
+/* Pack the snapshots of T. Only computes the size if dsnap is NULL. */
+MSize lj_snap_pack(GCtrace *T, SnapShot *dsnap, SnapEntry *dmap)
+{
+  SnapEntry *omap = NULL;
+  MSize onent = 0, ofs = 0;
+  int osorted = 0;
+  SnapNo i;
+  for (i = 0; i < T->nsnap; i++) {
+    SnapShot *snap = &T->snap[i];
+    SnapEntry *map = &T->snapmap[snap->mapofs];
+    MSize nent = snap->nent;
+    MSize ntail = snap_nextofs(T, snap) - snap->mapofs - nent;
+    MSize ndelta = SNAP_NODELTA;
+    int sorted = snap_sorted(map, nent);
+    lua_assert(snap->ndelta == SNAP_NODELTA);
+    if ((i & (SNAP_KEYFRAME-1)) && sorted && osorted)
+      ndelta = snap_delta(omap, onent, map, nent, dsnap ? dmap + ofs : NULL);
+    if (dsnap) {
+      dsnap[i].mapofs = (uint32_t)ofs;
+      dsnap[i].ndelta = (uint8_t)ndelta;
+      if (ndelta == SNAP_NODELTA)
+	memcpy(dmap + ofs, map, nent*sizeof(SnapEntry));
+      ofs += snap_nmap(&dsnap[i]);
+      memcpy(dmap + ofs, map + nent, ntail*sizeof(SnapEntry));
+    } else {
+      ofs += ndelta == SNAP_NODELTA ? nent : ndelta;
+    }
+    ofs += ntail;
+    omap = map;
+    onent = nent;
+    osorted = sorted;
+  }
+  return ofs;
+}
+
+/* Get the entries of a snapshot. Unpacks delta snapshots into buf. */
+SnapEntry *lj_snap_unpack(GCtrace *T, SnapNo snapno, SnapEntry *buf)
+{
+  SnapNo s = snapno;
+  SnapEntry *map, *nmap;
+  MSize nent;
+  if (T->snap[snapno].ndelta == SNAP_NODELTA)
+    return &T->snapmap[T->snap[snapno].mapofs];
+  while (T->snap[--s].ndelta != SNAP_NODELTA) ;  /* Find last full map. */
+  map = &T->snapmap[T->snap[s].mapofs];
+  nent = T->snap[s].nent;
+  nmap = buf;
+  while (s++ < snapno) {  /* Apply all deltas up to the snapshot. */
+    SnapShot *snap = &T->snap[s];
+    SnapEntry *dmap = &T->snapmap[snap->mapofs];
+    MSize o = 0, d = 0, n = 0, ndelta = snap->ndelta;
+    while (o < nent || d < ndelta) {
+      if (d >= ndelta || (o < nent && snap_slot(map[o]) < snap_slot(dmap[d]))) {
+	nmap[n++] = map[o++];
+      } else {
+	SnapEntry sn = dmap[d++];
+	if (o < nent && snap_slot(map[o]) == snap_slot(sn)) o++;
+	if (snap_ref(sn)) nmap[n++] = sn;
+      }
+    }
+    lua_assert(n == snap->nent);
+    map = nmap;
+    nent = n;
+    nmap = nmap == buf ? buf + SNAP_MAXENT : buf;
+  }
+  return map;
+}
+
 /* -- Snapshot access ----------------------------------------------------- */
 
 /* Initialize a Bloom Filter with all renamed refs.
@@ -358,8 +480,8 @@ static RegSP snap_renameref(GCtrace *T, SnapNo lim, IRRef ref, RegSP rs)
 /* Copy RegSP from parent snapshot to the parent links of the IR. */
 IRIns *lj_snap_regspmap(GCtrace *T, SnapNo snapno, IRIns *ir)
 {
-  SnapShot *snap = &T->snap[snapno];
-  SnapEntry *map = &T->snapmap[snap->mapofs];
+  SnapEntry ubuf[2*SNAP_MAXENT];
+  SnapEntry *map = lj_snap_unpack(T, snapno, ubuf);
   BloomFilter rfilt = snap_renamefilter(T, snapno);
   MSize n = 0;
   IRRef ref = 0;
@@ -368,7 +490,7 @@ IRIns *lj_snap_regspmap(GCtrace *T, SnapNo snapno, IRIns *ir)
     if (ir->o == IR_SLOAD) {
       if (!(ir->op2 & IRSLOAD_PARENT)) break;
       for ( ; ; n++) {
-	lua_assert(n < snap->nent);
+	lua_assert(n < T->snap[snapno].nent);
 	if (snap_slot(map[n]) == ir->op1) {
 	  ref = snap_ref(map[n++]);
 	  break;
@@ -457,7 +579,8 @@ static LJ_AINLINE int snap_sunk_store(GCtrace *T, IRIns *ira, IRIns *irs)
 void lj_snap_replay(jit_State *J, GCtrace *T)
 {
   SnapShot *snap = &T->snap[J->exitno];
-  SnapEntry *map = &T->snapmap[snap->mapofs];
+  SnapEntry ubuf[2*SNAP_MAXENT];
+  SnapEntry *map = lj_snap_unpack(T, J->exitno, ubuf);
   MSize n, nent = snap->nent;
   BloomFilter seen = 0;
   int pass23 = 0;
@@ -508,7 +631,8 @@ void lj_snap_replay(jit_State *J, GCtrace *T)
 	if (J->slot[snap_slot(sn)] != snap_slot(sn)) continue;
 	pass23 = 1;
 	lua_assert(ir->o == IR_TNEW || ir->o == IR_TDUP ||
-		   ir->o == IR_CNEW || ir->o == IR_CNEWI);
+		   ir->o == IR_CNEW || ir->o == IR_CNEWI || ir->o == IR_BUFSTR);
+	if (ir->o == IR_BUFSTR) continue;  /* Nothing to inherit. */
 	if (ir->op1 >= T->nk) snap_pref(J, T, map, nent, seen, ir->op1);
 	if (ir->op2 >= T->nk) snap_pref(J, T, map, nent, seen, ir->op2);
 	if (LJ_HASFFI && ir->o == IR_CNEWI) {
@@ -541,6 +665,11 @@ void lj_snap_replay(jit_State *J, GCtrace *T)
 	  J->slot[snap_slot(sn)] = J->slot[J->slot[snap_slot(sn)]];
 	  continue;
 	}
+	if (ir->o == IR_BUFSTR) {  /* Create string from the temp. buffer. */
+	  J->slot[snap_slot(sn)] = lj_ir_call(J, IRCALL_lj_buf_tostr,
+					lj_ir_kptr(J, &J2G(J)->tmpbuf));
+	  continue;
+	}
 	op1 = ir->op1;
 	if (op1 >= T->nk) op1 = snap_pref(J, T, map, nent, seen, op1);
 	op2 = ir->op2;
@@ -742,7 +871,12 @@ static void snap_unsink(jit_State *J, GCtrace *T, ExitState *ex,
 			IRIns *ir, TValue *o)
 {
   lua_assert(ir->o == IR_TNEW || ir->o == IR_TDUP ||
-	     ir->o == IR_CNEW || ir->o == IR_CNEWI);
+	     ir->o == IR_CNEW || ir->o == IR_CNEWI || ir->o == IR_BUFSTR);
+  if (ir->o == IR_BUFSTR) {  /* The data is still in the temp. buffer. */
+    SBuf *sb = &J2G(J)->tmpbuf;
+    setstrV(J->L, o, lj_str_new(J->L, sbufB(sb), sbuflen(sb)));
+    return;
+  }
 #if LJ_HASFFI
   if (ir->o == IR_CNEW || ir->o == IR_CNEWI) {
     CTState *cts = ctype_cts(J->L);
@@ -822,6 +956,264 @@ static void snap_unsink(jit_State *J, GCtrace *T, ExitState *ex,
   }
 }
 
+/* -- Restore plans for hot snapshots ------------------------------------- */
+
+/* Exits which are taken over and over again, but didn't turn into side
+** traces (yet), e.g. in polymorphic code, spend most of their time in
+** decoding the snapshot. So a plan is precompiled for a snapshot on its
+** second exit: it has all constants, renames, register and spill slot
+** assignments resolved and only needs to copy the values from the exit
+** state. Snapshots with sunk allocations or with constants that need a
+** new object on each exit (64 bit integers) use the generic path.
+*/
+
+/* Restore plan ops. */
+enum {
+  SPLAN_K,		/* Copy constant. */
+  SPLAN_PRI,		/* Set primitive type. */
+  SPLAN_SPILL_INT,	/* Restore from spill slot. */
+  SPLAN_SPILL_TONUM,
+  SPLAN_SPILL_NUM,
+  SPLAN_SPILL_U64,
+  SPLAN_SPILL_GC,
+  SPLAN_GPR_INT,	/* Restore from register. */
+  SPLAN_GPR_TONUM,
+  SPLAN_FPR_NUM,
+  SPLAN_GPR_U64,
+  SPLAN_GPR_GC,
+  SPLAN_FRAME		/* Overwrite tag with frame link. */
+};
+
+/* Restore plan instruction. */
+typedef struct SnapPlanIns {
+  uint8_t op;		/* Restore plan op. */
+  uint8_t slot;		/* Stack slot, relative to the base frame. */
+  uint8_t t;		/* IR type for SPLAN_PRI and SPLAN_*_GC. */
+  uint8_t unused;
+  int32_t arg;		/* Constant index, spill slot, register or link. */
+} SnapPlanIns;
+
+/* Restore plan. Followed by the constants and the plan instructions. */
+struct SnapPlan {
+  MSize sz;		/* Size of the plan in bytes. */
+  MSize nins;		/* Number of plan instructions. */
+  MSize nk;		/* Number of constants. */
+  uint32_t generic;	/* Snapshot needs the generic restore path. */
+};
+
+#define snapplan_k(sp)		((TValue *)((sp) + 1))
+#define snapplan_ins(sp)	((SnapPlanIns *)(snapplan_k(sp) + (sp)->nk))
+
+/* Compile the restore of a value into a plan instruction. */
+static int snap_planval(GCtrace *T, SnapNo snapno, BloomFilter rfilt,
+			IRRef ref, SnapPlanIns *pi, int tonum)
+{
+  IRIns *ir = &T->ir[ref];
+  RegSP rs = ir->prev;
+  pi->t = (uint8_t)irt_type(ir->t);
+  if (irref_isk(ref))
+    return 0;  /* Constants are handled by the caller. */
+  if (LJ_UNLIKELY(bloomtest(rfilt, ref)))
+    rs = snap_renameref(T, snapno, ref, rs);
+  if (ra_hasspill(regsp_spill(rs))) {
+    pi->arg = (int32_t)regsp_spill(rs);
+    if (irt_isinteger(ir->t)) {
+      pi->op = tonum ? SPLAN_SPILL_TONUM : SPLAN_SPILL_INT;
+      return 1;
+    }
+    if (tonum) return 0;
+#if !LJ_SOFTFP
+    if (irt_isnum(ir->t)) { pi->op = SPLAN_SPILL_NUM; return 1; }
+#endif
+#if LJ_64 && !LJ_GC64
+    if (irt_islightud(ir->t)) { pi->op = SPLAN_SPILL_U64; return 1; }
+#endif
+    pi->op = SPLAN_SPILL_GC;
+    return 1;
+  } else {
+    Reg r = regsp_reg(rs);
+    if (ra_noreg(r)) {
+      lua_assert(ir->o == IR_CONV && ir->op2 == IRCONV_NUM_INT);
+      return !tonum && snap_planval(T, snapno, rfilt, ir->op1, pi, 1);
+    }
+    if (irt_isinteger(ir->t)) {
+      pi->op = tonum ? SPLAN_GPR_TONUM : SPLAN_GPR_INT;
+      pi->arg = r-RID_MIN_GPR;
+      return 1;
+    }
+    if (tonum) return 0;
+#if !LJ_SOFTFP
+    if (irt_isnum(ir->t)) {
+      pi->op = SPLAN_FPR_NUM;
+      pi->arg = r-RID_MIN_FPR;
+      return 1;
+    }
+#endif
+#if LJ_64 && !LJ_GC64
+    if (irt_is64(ir->t)) {
+      pi->op = SPLAN_GPR_U64;
+      pi->arg = r-RID_MIN_GPR;
+      return 1;
+    }
+#endif
+    if (irt_ispri(ir->t)) {
+      pi->op = SPLAN_PRI;
+      return 1;
+    }
+    pi->op = SPLAN_GPR_GC;
+    pi->arg = r-RID_MIN_GPR;
+    return 1;
+  }
+}
+
+/* Compile a restore plan for a snapshot. */
+static SnapPlan *snap_plan_new(jit_State *J, GCtrace *T, SnapNo snapno)
+{
+  SnapShot *snap = &T->snap[snapno];
+  MSize n, nent = snap->nent;
+  SnapEntry ubuf[2*SNAP_MAXENT];
+  SnapEntry *map = lj_snap_unpack(T, snapno, ubuf);
+#if !LJ_FR2
+  SnapEntry *flinks = &T->snapmap[snap_nextofs(T, snap)-1];
+#endif
+  BloomFilter rfilt = snap_renamefilter(T, snapno);
+  MSize sz = sizeof(SnapPlan) + nent*sizeof(TValue) +
+	     (LJ_FR2 ? 1 : 2)*nent*sizeof(SnapPlanIns);
+  SnapPlan *sp = (SnapPlan *)lj_mem_new(J->L, sz);
+  TValue *k = snapplan_k(sp);
+  SnapPlanIns *pi0 = (SnapPlanIns *)(k + nent), *pi = pi0;
+  sp->sz = sz;
+  sp->nk = 0;
+  sp->generic = 0;
+  for (n = 0; n < nent; n++) {
+    SnapEntry sn = map[n];
+    if (!(sn & SNAP_NORESTORE)) {
+      IRRef ref = snap_ref(sn);
+      IRIns *ir = &T->ir[ref];
+      if (ir->r == RID_SUNK || (LJ_SOFTFP && (sn & SNAP_SOFTFPNUM))) {
+	sp->generic = 1;  /* Leave that to the generic path. */
+	break;
+      }
+      pi->slot = (uint8_t)snap_slot(sn);
+      if (irref_isk(ref)) {
+	/* Other constants, e.g. KINT64, would need a new object per restore.
+	** The plan doesn't keep them alive.
+	*/
+	if (!(ir->o == IR_KPRI || ir->o == IR_KINT || ir->o == IR_KNUM ||
+	      ir->o == IR_KGC || ir->o == IR_KPTR)) {
+	  sp->generic = 1;
+	  break;
+	}
+	lj_ir_kvalue(J->L, &k[sp->nk], ir);
+	pi->op = SPLAN_K;
+	pi->arg = (int32_t)sp->nk++;
+      } else if (!snap_planval(T, snapno, rfilt, ref, pi, 0)) {
+	sp->generic = 1;
+	break;
+      }
+      pi++;
+#if !LJ_FR2
+      if ((sn & (SNAP_CONT|SNAP_FRAME))) {
+	pi->op = SPLAN_FRAME;
+	pi->slot = (uint8_t)snap_slot(sn);
+	pi->arg = snap_slot(sn) != 0 ? (int32_t)*flinks-- : 0;
+	pi++;
+      }
+#endif
+    }
+  }
+  /* Move the instructions right behind the constants actually used. */
+  sp->nins = (MSize)(pi - pi0);
+  if (sp->nk != nent)
+    memmove(snapplan_ins(sp), pi0, sp->nins*sizeof(SnapPlanIns));
+  return sp;
+}
+
+/* Get the restore plan for a hot snapshot. Returns NULL for cold ones. */
+static SnapPlan *snap_plan(jit_State *J, GCtrace *T, SnapNo snapno)
+{
+  SnapPlan *sp;
+  if (LJ_LIKELY(T->snapplan != NULL)) {
+    sp = T->snapplan[snapno];
+    if (sp) return sp->generic ? NULL : sp;
+  }
+  if (T->snap[snapno].count == 0)
+    return NULL;  /* Not taken before. */
+  if (!T->snapplan) {
+    MSize sz = T->nsnap*(MSize)sizeof(SnapPlan *);
+    T->snapplan = (SnapPlan **)lj_mem_new(J->L, sz);
+    memset(T->snapplan, 0, sz);
+  }
+  sp = T->snapplan[snapno] = snap_plan_new(J, T, snapno);
+  return sp->generic ? NULL : sp;
+}
+
+/* Execute a restore plan. */
+static void snap_plan_restore(lua_State *L, SnapPlan *sp, ExitState *ex,
+			      TValue *frame)
+{
+  TValue *k = snapplan_k(sp);
+  SnapPlanIns *pi = snapplan_ins(sp), *pe = pi + sp->nins;
+#if !LJ_FR2
+  ptrdiff_t ftsz0 = frame_ftsz(frame);
+#endif
+  for (; pi < pe; pi++) {
+    TValue *o = &frame[pi->slot];
+    int32_t *sps = &ex->spill[pi->arg];
+    switch (pi->op) {
+    case SPLAN_K: copyTV(L, o, &k[pi->arg]); break;
+    case SPLAN_PRI: setpriV(o, irt_toitype_((IRType)pi->t)); break;
+    case SPLAN_SPILL_INT: setintV(o, *sps); break;
+    case SPLAN_SPILL_TONUM:
+      setintV(o, *sps);
+      if (LJ_DUALNUM) setnumV(o, (lua_Number)intV(o));
+      break;
+#if !LJ_SOFTFP
+    case SPLAN_SPILL_NUM: o->u64 = *(uint64_t *)sps; break;
+#endif
+#if LJ_64 && !LJ_GC64
+    case SPLAN_SPILL_U64: o->u64 = *(uint64_t *)sps; break;
+#endif
+    case SPLAN_SPILL_GC:
+      setgcV(L, o, (GCobj *)(uintptr_t)*(GCSize *)sps,
+	     irt_toitype_((IRType)pi->t));
+      break;
+    case SPLAN_GPR_INT: setintV(o, (int32_t)ex->gpr[pi->arg]); break;
+    case SPLAN_GPR_TONUM:
+      setintV(o, (int32_t)ex->gpr[pi->arg]);
+      if (LJ_DUALNUM) setnumV(o, (lua_Number)intV(o));
+      break;
+#if !LJ_SOFTFP
+    case SPLAN_FPR_NUM: setnumV(o, ex->fpr[pi->arg]); break;
+#endif
+#if LJ_64 && !LJ_GC64
+    case SPLAN_GPR_U64: o->u64 = ex->gpr[pi->arg]; break;
+#endif
+    case SPLAN_GPR_GC:
+      setgcV(L, o, (GCobj *)ex->gpr[pi->arg], irt_toitype_((IRType)pi->t));
+      break;
+#if !LJ_FR2
+    case SPLAN_FRAME:
+      setframe_ftsz(o, pi->slot != 0 ? pi->arg : ftsz0);
+      L->base = o+1;
+      break;
+#endif
+    default: lua_assert(0); break;
+    }
+  }
+}
+
+/* Free all restore plans of a trace. */
+void lj_snap_freeplans(global_State *g, GCtrace *T)
+{
+  SnapNo i;
+  for (i = 0; i < T->nsnap; i++)
+    if (T->snapplan[i])
+      lj_mem_free(g, T->snapplan[i], T->snapplan[i]->sz);
+  lj_mem_free(g, T->snapplan, T->nsnap*sizeof(SnapPlan *));
+  T->snapplan = NULL;
+}
+
 /* Restore interpreter state from exit state with the help of a snapshot. */
 const BCIns *lj_snap_restore(jit_State *J, void *exptr)
 {
@@ -830,7 +1222,9 @@ const BCIns *lj_snap_restore(jit_State *J, void *exptr)
   GCtrace *T = traceref(J, J->parent);
   SnapShot *snap = &T->snap[snapno];
   MSize n, nent = snap->nent;
-  SnapEntry *map = &T->snapmap[snap->mapofs];
+  SnapEntry ubuf[2*SNAP_MAXENT];
+  SnapEntry *map;
+  SnapEntry *pcmap = &T->snapmap[snap->mapofs + snap_nmap(snap)];
 #if !LJ_FR2 || defined(LUA_USE_ASSERT)
   SnapEntry *flinks = &T->snapmap[snap_nextofs(T, snap)-1-LJ_FR2];
 #endif
@@ -838,9 +1232,10 @@ const BCIns *lj_snap_restore(jit_State *J, void *exptr)
   ptrdiff_t ftsz0;
 #endif
   TValue *frame;
-  BloomFilter rfilt = snap_renamefilter(T, snapno);
-  const BCIns *pc = snap_pc(&map[nent]);
+  BloomFilter rfilt;
+  const BCIns *pc = snap_pc(pcmap);
   lua_State *L = J->L;
+  SnapPlan *sp;
 
   /* Set interpreter PC to the next PC to get correct error messages. */
   setcframe_pc(cframe_raw(L->cframe), pc+1);
@@ -853,6 +1248,13 @@ const BCIns *lj_snap_restore(jit_State *J, void *exptr)
 
   /* Fill stack slots with data from the registers and spill slots. */
   frame = L->base-1-LJ_FR2;
+  sp = snap_plan(J, T, snapno);
+  if (sp) {  /* Fast path for hot snapshots. */
+    snap_plan_restore(L, sp, ex, frame);
+    goto restored;
+  }
+  map = lj_snap_unpack(T, snapno, ubuf);
+  rfilt = snap_renamefilter(T, snapno);
 #if !LJ_FR2
   ftsz0 = frame_ftsz(frame);  /* Preserve link to previous frame in slot #0. */
 #endif
@@ -887,10 +1289,11 @@ const BCIns *lj_snap_restore(jit_State *J, void *exptr)
       }
     }
   }
+  lua_assert(pcmap == flinks);
+restored:
 #if LJ_FR2
-  L->base += (map[nent+LJ_BE] & 0xff);
+  L->base += (pcmap[LJ_BE] & 0xff);
 #endif
-  lua_assert(map + nent == flinks);
 
   /* Compute current stack top. */
   switch (bc_op(*pc)) {
@@ -10,12 +10,18 @@
 #include "lj_jit.h"
 
 #if LJ_HASJIT
+/* Unpacking a snapshot needs a buffer of 2*SNAP_MAXENT entries. */
+#define SNAP_MAXENT	256
+
 LJ_FUNC void lj_snap_add(jit_State *J);
 LJ_FUNC void lj_snap_purge(jit_State *J);
 LJ_FUNC void lj_snap_shrink(jit_State *J);
+LJ_FUNC MSize lj_snap_pack(GCtrace *T, SnapShot *dsnap, SnapEntry *dmap);
+LJ_FUNC SnapEntry *lj_snap_unpack(GCtrace *T, SnapNo snapno, SnapEntry *buf);
 LJ_FUNC IRIns *lj_snap_regspmap(GCtrace *T, SnapNo snapno, IRIns *ir);
 LJ_FUNC void lj_snap_replay(jit_State *J, GCtrace *T);
 LJ_FUNC const BCIns *lj_snap_restore(jit_State *J, void *exptr);
+LJ_FUNC void lj_snap_freeplans(global_State *g, GCtrace *T);
 LJ_FUNC void lj_snap_grow_buf_(jit_State *J, MSize need);
 LJ_FUNC void lj_snap_grow_map_(jit_State *J, MSize need);
 
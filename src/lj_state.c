@@ -14,6 +14,7 @@
 #include "lj_err.h"
 #include "lj_buf.h"
 #include "lj_str.h"
+#include "lj_strfmt.h"
 #include "lj_tab.h"
 #include "lj_func.h"
 #include "lj_meta.h"
@@ -26,6 +27,8 @@
 #include "lj_dispatch.h"
 #include "lj_vm.h"
 #include "lj_lex.h"
+#include "lj_memprof.h"
+#include "lj_heapdump.h"
 #include "lj_alloc.h"
 #include "luajit.h"
 
@@ -160,6 +163,11 @@ static TValue *cpluaopen(lua_State *L, lua_CFunction dummy, void *ud)
 static void close_state(lua_State *L)
 {
   global_State *g = G(L);
+  lj_memprof_stop(L);  /* Finish the profile before anything is freed. */
+  lj_heapdump_finish(L);  /* Ditto for the heap dump. */
+#if LJ_HASGCTHREAD
+  lj_gc_bgclose(L);  /* Restore the allocator first. */
+#endif
   lj_func_closeuv(L, tvref(L->stack));
   lj_gc_freeall(g);
   lua_assert(gcref(g->gc.root) == obj2gco(L));
@@ -169,15 +177,28 @@ static void close_state(lua_State *L)
   lj_ctype_freestate(g);
 #endif
   lj_mem_freevec(g, g->strhash, g->strmask+1, GCRef);
+  if (g->stroldhash)
+    lj_mem_freevec(g, g->stroldhash, g->stroldmask+1, GCRef);
   lj_buf_free(g, &g->tmpbuf);
+  lj_str_patclear(g, &g->patcache, 1);
+  lj_str_patclear(g, &g->fmtcache, 1);
   lj_mem_freevec(g, tvref(L->stack), L->stacksize, TValue);
   lua_assert(g->gc.total == sizeof(GG_State));
 #ifndef LUAJIT_USE_SYSMALLOC
-  if (g->allocf == lj_alloc_f)
+  if (g->allocf == lj_alloc_f) {
     lj_alloc_destroy(g->allocd);
-  else
+  } else
 #endif
+  {
+#if LJ_HASGCTHREAD
+    struct GCSweeper *sw = g->gc.sweeper;  /* Still below another allocator. */
+    g->allocf(g->allocd, G2GG(g), sizeof(GG_State), 0);
+    if (sw)
+      lj_alloc_destroy(lj_gc_bgfree(sw));
+#else
     g->allocf(g->allocd, G2GG(g), sizeof(GG_State), 0);
+#endif
+  }
 }
 
 #if LJ_64 && !LJ_GC64 && !(defined(LUAJIT_USE_VALGRIND) && defined(LUAJIT_USE_SYSMALLOC))
@@ -211,12 +232,16 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud)
   setmref(g->nilnode.freetop, &g->nilnode);
 #endif
   lj_buf_init(NULL, &g->tmpbuf);
+  g->numfmt = STRFMT_G14;
   g->gc.state = GCSpause;
   setgcref(g->gc.root, obj2gco(L));
   setmref(g->gc.sweep, &g->gc.root);
   g->gc.allocated = g->gc.total = sizeof(GG_State);
   g->gc.pause = LUAI_GCPAUSE;
   g->gc.stepmul = LUAI_GCMUL;
+  g->gc.minormul = LUAI_GCMINORMUL;
+  g->gc.finbatch = LUAI_GCFINBATCH;
+  g->gc.limit = LJ_MAX_MEM;
   lj_dispatch_init((GG_State *)L);
   L->status = LUA_ERRERR+1;  /* Avoid touching the stack upon memory error. */
   if (lj_vm_cpcall(L, NULL, NULL, cpluaopen) != 0) {
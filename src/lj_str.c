@@ -11,17 +11,19 @@
 #include "lj_err.h"
 #include "lj_str.h"
 #include "lj_char.h"
+#include "lj_heapdump.h"
+#include "lj_strhash.h"
+#if LJ_STRHASH_CRC32 && LJ_TARGET_X64
+#include "lj_vm.h"
+#endif
 
 #if LUAJIT_USE_ASAN
 /* These functions may read past a buffer end, that's ok. */
-GCstr *lj_str_new(lua_State *L, const char *str, size_t lenx)
+static GCstr *str_new(lua_State *L, const char *str, MSize len, GCstr *ext)
   __attribute__((no_sanitize_address));
 
 int32_t LJ_FASTCALL lj_str_cmp(GCstr *a, GCstr *b)
   __attribute__((no_sanitize_address));
-
-static LJ_AINLINE int str_fastcmp(const char *a, const char *b, MSize len)
-  __attribute__((no_sanitize_address));
 #endif
 
 /* -- String helpers ------------------------------------------------------ */
@@ -52,40 +54,27 @@ int32_t LJ_FASTCALL lj_str_cmp(GCstr *a, GCstr *b)
 /* Fast string data comparison. Caveat: unaligned access to 1st string! */
 static LJ_AINLINE int str_fastcmp(const char *a, const char *b, MSize len)
 {
-  MSize i = 0;
-  lua_assert(len > 0);
-  lua_assert((((uintptr_t)a+len-1) & (LJ_PAGESIZE-1)) <= LJ_PAGESIZE-4);
-  do {  /* Note: innocuous access up to end of string + 3. */
-    uint32_t v = lj_getu32(a+i) ^ *(const uint32_t *)(b+i);
-    if (v) {
-      i -= len;
-#if LJ_LE
-      return (int32_t)i >= -3 ? (v << (32+(i<<3))) : 1;
+#if LJ_STRCMP_SIMD
+  /* The interned string isn't 16-byte aligned, so it needs a check, too. */
+  if (LJ_UNLIKELY(!lj_strcmp_canoverread(b, len)))
+    return memcmp(a, b, len);
+  return lj_strcmp_simd(a, b, len);
 #else
-      return (int32_t)i >= -3 ? (v >> (32+(i<<3))) : 1;
+  return lj_strcmp_scalar(a, b, len);
 #endif
-    }
-    i += 4;
-  } while (i < len);
-  return 0;
 }
 
 /* Find fixed string p inside string s. */
 const char *lj_str_find(const char *s, const char *p, MSize slen, MSize plen)
 {
   if (plen <= slen) {
-    if (plen == 0) {
+    if (plen == 0)
       return s;
-    } else {
-      int c = *(const uint8_t *)p++;
-      plen--; slen -= plen;
-      while (slen) {
-	const char *q = (const char *)memchr(s, c, slen);
-	if (!q) break;
-	if (memcmp(q+1, p, plen) == 0) return q;
-	q++; slen -= (MSize)(q-s); s = q;
-      }
-    }
+#if LJ_STRCMP_SIMD
+    if (plen > 1)
+      return lj_strfind_simd(s, p, slen, plen);
+#endif
+    return lj_strfind_scalar(s, p, slen, plen);
   }
   return NULL;
 }
@@ -104,86 +93,135 @@ int lj_str_haspattern(GCstr *s)
 
 /* -- String interning ---------------------------------------------------- */
 
+/* Number of old hash chains moved for each interned string. */
+#define STR_REHASHSTEP	8
+
+/* Move up to n hash chains of the old string table to the new one.
+**
+** A resize only swaps in an empty table. The strings are moved over
+** incrementally by the interning and the GC steps. Until its chain is
+** moved, a hash value keeps using the old table, both for lookups and
+** for new strings, so each lookup still probes a single chain. The sweep
+** and the heap dump walk both tables, so the chains must stay in place
+** while they run.
+*/
+void lj_str_rehash(global_State *g, MSize n)
+{
+  GCRef *newhash = g->strhash;
+  MSize newmask = g->strmask;
+  if (g->gc.state == GCSsweepstring || lj_heapdump_walking(g))
+    return;
+  for (; n > 0 && g->strrehash > 0; n--) {
+    GCRef *p = &g->stroldhash[--g->strrehash];
+    GCobj *o = gcref(*p);
+    setgcrefnull(*p);
+    while (o) {  /* Follow the hash chain and reinsert all strings. */
+      MSize h = gco2str(o)->hash & newmask;
+      GCobj *next = gcnext(o);
+      o->gch.marked &= (uint8_t)~LJ_GC_OLD;  /* Chains are no longer by age. */
+      /* NOBARRIER: The string table is a GC root. */
+      setgcrefr(o->gch.nextgc, newhash[h]);
+      setgcref(newhash[h], o);
+      o = next;
+    }
+  }
+  if (g->strrehash == 0 && g->stroldhash) {
+    lj_mem_freevec(g, g->stroldhash, g->stroldmask+1, GCRef);
+    g->stroldhash = NULL;
+  }
+}
+
 /* Resize the string hash table (grow and shrink). */
 void lj_str_resize(lua_State *L, MSize newmask)
 {
   global_State *g = G(L);
   GCRef *newhash;
-  MSize i;
-  if (g->gc.state == GCSsweepstring || newmask >= LJ_MAX_STRTAB-1)
-    return;  /* No resizing during GC traversal or if already too big. */
+  if (g->gc.state == GCSsweepstring || lj_heapdump_walking(g) ||
+      newmask >= LJ_MAX_STRTAB-1)
+    return;  /* No resizing during GC traversal, heap dump or if too big. */
   newhash = lj_mem_newvec(L, newmask+1, GCRef);
   memset(newhash, 0, (newmask+1)*sizeof(GCRef));
-  for (i = g->strmask; i != ~(MSize)0; i--) {  /* Rehash old table. */
-    GCobj *p = gcref(g->strhash[i]);
-    while (p) {  /* Follow each hash chain and reinsert all strings. */
-      MSize h = gco2str(p)->hash & newmask;
-      GCobj *next = gcnext(p);
-      /* NOBARRIER: The string table is a GC root. */
-      setgcrefr(p->gch.nextgc, newhash[h]);
-      setgcref(newhash[h], p);
-      p = next;
-    }
+  lj_str_rehash(g, g->strrehash);  /* Finish the previous resize first. */
+  lua_assert(g->strrehash == 0 && g->stroldhash == NULL);
+  if (g->strhash) {
+    g->stroldhash = g->strhash;
+    g->stroldmask = g->strmask;
+    g->strrehash = g->strmask+1;
   }
-  lj_mem_freevec(g, g->strhash, g->strmask+1, GCRef);
   g->strmask = newmask;
   g->strhash = newhash;
 }
 
+/* Get the hash chain for a hash value. */
+static LJ_AINLINE GCRef *str_chain(global_State *g, MSize h)
+{
+  if (LJ_UNLIKELY(g->strrehash) && (h & g->stroldmask) < g->strrehash)
+    return &g->stroldhash[h & g->stroldmask];  /* Not rehashed yet. */
+  return &g->strhash[h & g->strmask];
+}
+
+#if LJ_STRHASH_CRC32
+/* Check whether the CPU has the CRC32 instructions. */
+int lj_str_hascrc32(void)
+{
+#if LJ_TARGET_X64 && !defined(__SSE4_2__)
+  uint32_t features[4];
+  return lj_vm_cpuid(1, features) && ((features[2] >> 20)&1);
+#else
+  return 1;
+#endif
+}
+#endif
+
 #if LUAJIT_SMART_STRINGS
-static LJ_AINLINE uint32_t
-lj_fullhash(const uint8_t *v, MSize len)
+#if LJ_STRHASH_CRC32
+/*
+** The full hash kernel is picked on first use. The full hashes only need
+** to be consistent within the process, lua_hashstring() doesn't return
+** them.
+*/
+static uint32_t str_fullhash_scalar(const uint8_t *v, MSize len)
 {
-  MSize a = 0, b = 0;
-  MSize c = 0xcafedead;
-  MSize d = 0xdeadbeef;
-  MSize h = len;
-  lua_assert(len >= 12);
-  for(; len>8; len-=8, v+=8) {
-    a ^= lj_getu32(v);
-    b ^= lj_getu32(v+4);
-    c += a;
-    d += b;
-    a = lj_rol(a, 5) - d;
-    b = lj_rol(b, 7) - c;
-    c = lj_rol(c, 24) ^ a;
-    d = lj_rol(d, 1) ^ b;
-  }
-  a ^= lj_getu32(v+len-8);
-  b ^= lj_getu32(v+len-4);
-  c += b; c -= lj_rol(a, 9);
-  d += a; d -= lj_rol(b, 18);
-  h -= lj_rol(a^b,7);
-  h += c; h += lj_rol(d,13);
-  d ^= c;  d -= lj_rol(c,25);
-  h ^= d; h -= lj_rol(d,16);
-  c ^= h; c -= lj_rol(h,4);
-  d ^= c;  d -= lj_rol(c,14);
-  h ^= d; h -= lj_rol(d,24);
-  return h;
+  return lj_strhash_full(v, len);
 }
+
+static LJ_STRHASH_TARGET uint32_t str_fullhash_crc32(const uint8_t *v,
+						     MSize len)
+{
+  return lj_strhash_crc32(v, len);
+}
+
+static uint32_t str_fullhash_init(const uint8_t *v, MSize len);
+
+static uint32_t (*str_fullhash)(const uint8_t *v, MSize len) =
+  str_fullhash_init;
+
+static uint32_t str_fullhash_init(const uint8_t *v, MSize len)
+{
+  str_fullhash = lj_str_hascrc32() ? str_fullhash_crc32 : str_fullhash_scalar;
+  return str_fullhash(v, len);
+}
+#else
+#define str_fullhash	lj_strhash_full
+#endif
 #endif
 
-/* Intern a string and return string object. */
-GCstr *lj_str_new(lua_State *L, const char *str, size_t lenx)
+/* Intern a string. Use the external string object, if any, for a new one. */
+static LJ_AINLINE GCstr *str_new(lua_State *L, const char *str, MSize len,
+				 GCstr *ext)
 {
-  global_State *g;
+  global_State *g = G(L);
   GCstr *s;
   GCobj *o;
-  MSize len = (MSize)lenx;
+  GCRef *chain;
   uint8_t strflags = 0;
 #if LUAJIT_SMART_STRINGS
   unsigned collisions = 0;
 #endif
-  if (lenx >= LJ_MAX_STR)
-    lj_err_msg(L, LJ_ERR_STROV);
-  g = G(L);
-  if (len == 0)
-    return &g->strempty;
   /* Compute string hash. Constants taken from lookup3 hash by Bob Jenkins. */
   MSize h = lua_hash(str, len);
   /* Check if the string has already been interned. */
-  o = gcref(g->strhash[h & g->strmask]);
+  o = gcref(*str_chain(g, h));
 #if LUAJIT_SMART_STRINGS
 /*
 ** The default "fast" string hash function samples only a few positions
@@ -215,7 +253,7 @@ GCstr *lj_str_new(lua_State *L, const char *str, size_t lenx)
 #define inc_collision_hard() (1)
 #define inc_collision_soft()
 #endif
-  if (LJ_LIKELY((((uintptr_t)str+len-1) & (LJ_PAGESIZE-1)) <= LJ_PAGESIZE-4)) {
+  if (LJ_LIKELY(lj_strcmp_canoverread(str, len))) {
     while (o != NULL) {
       GCstr *sx = gco2str(o);
       if (sx->hash == h && sx->len == len && inc_collision_hard() &&
@@ -256,13 +294,13 @@ GCstr *lj_str_new(lua_State *L, const char *str, size_t lenx)
        bloomtest(g->strbloom.cur[0], h>>(sizeof(h)*8- 6)) != 0 &&
        bloomtest(g->strbloom.cur[1], h>>(sizeof(h)*8-12)) != 0;
     if (LJ_UNLIKELY(search_fullh || collisions > max_collisions)) {
-      MSize fh = lj_fullhash((const uint8_t*)str, len);
+      MSize fh = str_fullhash((const uint8_t*)str, len);
 #define high6mask ((~(MSize)0)<<(sizeof(MSize)*8-6))
       fh = (fh >> 6) | (h & high6mask);
       if (search_fullh) {
 	/* Recheck if the string has already been interned with "harder" hash. */
-	o = gcref(g->strhash[fh & g->strmask]);
-	if (LJ_LIKELY((((uintptr_t)str+len-1) & (LJ_PAGESIZE-1)) <= LJ_PAGESIZE-4)) {
+	o = gcref(*str_chain(g, fh));
+	if (LJ_LIKELY(lj_strcmp_canoverread(str, len))) {
 	  while (o != NULL) {
 	    GCstr *sx = gco2str(o);
 	    if (sx->hash == fh && sx->len == len && str_fastcmp(str, strdata(sx), len) == 0) {
@@ -298,29 +336,149 @@ GCstr *lj_str_new(lua_State *L, const char *str, size_t lenx)
   }
 #endif
   g->strhash_miss++;
+  /* Grow the string table before an external string is handed over. */
+  if (g->strnum > g->strmask)  /* Allow a 100% load factor. */
+    lj_str_resize(L, (g->strmask<<1)+1);  /* Grow string table. */
   /* Nope, create a new string. */
-  s = lj_mem_newt(L, sizeof(GCstr)+len+1, GCstr);
-  newwhite(g, s);
+  if (LJ_LIKELY(!ext)) {
+    s = lj_mem_newt(L, sizeof(GCstr)+len+1, GCstr);
+    newwhite(g, s);
+    memcpy(strdatawr(s), str, len);
+  } else {  /* The data is already in place. */
+    s = ext;
+    newwhite(g, s);
+    s->marked |= LJ_GC_EXTSTR;
+    /* Account for the data, so the GC keeps pace with external memory. */
+    g->gc.total += (GCSize)(sizeof(GCstr)+len+1);
+    g->gc.allocated += (GCSize)(sizeof(GCstr)+len+1);
+  }
   s->gct = ~LJ_TSTR;
   s->len = len;
   s->hash = h;
   s->reserved = 0;
   s->strflags = strflags;
-  memcpy(strdatawr(s), str, len);
   strdatawr(s)[len] = '\0';  /* Zero-terminate string. */
+  if (LJ_UNLIKELY(g->strrehash)) {
+    lj_str_rehash(g, STR_REHASHSTEP);
+    chain = str_chain(g, h);
+  } else {
+    chain = &g->strhash[h & g->strmask];
+  }
   /* Add it to string hash table. */
-  h &= g->strmask;
-  s->nextgc = g->strhash[h];
+  s->nextgc = *chain;
   /* NOBARRIER: The string table is a GC root. */
-  setgcref(g->strhash[h], obj2gco(s));
-  if (g->strnum++ > g->strmask)  /* Allow a 100% load factor. */
-    lj_str_resize(L, (g->strmask<<1)+1);  /* Grow string table. */
+  setgcref(*chain, obj2gco(s));
+  g->strnum++;
   return s;  /* Return newly interned string. */
 }
 
+/* Intern a string and return string object. */
+GCstr *lj_str_new(lua_State *L, const char *str, size_t lenx)
+{
+  if (lenx >= LJ_MAX_STR)
+    lj_err_msg(L, LJ_ERR_STROV);
+  if (lenx == 0)
+    return &G(L)->strempty;
+  return str_new(L, str, (MSize)lenx, NULL);
+}
+
+#if LJ_64 && !LJ_GC64
+/* Keep GC objects in the lower 2GB, like the allocator does. */
+#define str_extreachable(p, len)	((((uintptr_t)(p)+(len)) >> 31) == 0)
+#else
+#define str_extreachable(p, len)	checkptrGC((p)+(len))
+#endif
+
+/* lj_str_cmp() reads up to 3 bytes past the terminating zero. */
+#define str_extpadded(p, len) \
+  ((((uintptr_t)(p)+(len)) & (LJ_PAGESIZE-1)) <= LJ_PAGESIZE-4)
+
+/*
+** Intern a string with data owned by the caller. The GCstr and its GCstrext
+** header are put right before the data, so nothing is copied. The data is
+** released right away if an equal string exists already. Otherwise it's
+** released when the string is freed.
+*/
+GCstr *lj_str_newext(lua_State *L, char *str, size_t lenx,
+		     GCstrRelease release, void *ud)
+{
+  GCstr *s;
+  if (lenx >= LJ_MAX_STR)
+    lj_err_msg(L, LJ_ERR_STROV);
+  if (lenx > 0 && ((uintptr_t)str & 7) == 0 &&
+      str_extreachable(str, lenx) && str_extpadded(str, lenx)) {
+    GCstr *ext = (GCstr *)str - 1;
+    s = str_new(L, str, (MSize)lenx, ext);
+    if (s == ext) {
+      strext(s)->release = release;
+      strext(s)->ud = ud;
+      return s;
+    }
+  } else {  /* Copy it, if the VM can't use the memory. */
+    s = lj_str_new(L, str, lenx);
+  }
+  release(ud, str, lenx);
+  return s;
+}
+
 void LJ_FASTCALL lj_str_free(global_State *g, GCstr *s)
 {
   g->strnum--;
-  lj_mem_free(g, s, sizestring(s));
+  if (LJ_UNLIKELY(s->marked & LJ_GC_EXTSTR)) {
+    g->gc.total -= (GCSize)sizestring(s);
+    g->gc.freed += sizestring(s);
+    strext(s)->release(strext(s)->ud, strdatawr(s), s->len);
+  } else {
+    lj_mem_free(g, s, sizestring(s));
+  }
 }
 
+/* -- Pattern and format cache -------------------------------------------- */
+
+/* Get the compiled program of a pattern or format, if it's cached. */
+void *lj_str_patget(StrPatCache *c, GCstr *pat)
+{
+  StrPatEntry *e = c->e[pat->hash & (LJ_PATCACHE_SETS-1)];
+  if (gcref(e[0].pat) == obj2gco(pat)) {
+    c->hit++;
+    return e[0].prog;
+  } else if (gcref(e[1].pat) == obj2gco(pat)) {
+    StrPatEntry t = e[0];  /* Move it to the front. */
+    e[0] = e[1];
+    e[1] = t;
+    c->hit++;
+    return e[0].prog;
+  }
+  c->miss++;
+  return NULL;
+}
+
+/* Add a program to a cache. Evicts the least recently used one. */
+void lj_str_patset(global_State *g, StrPatCache *c, GCstr *pat, void *prog,
+		   MSize size)
+{
+  StrPatEntry *e = c->e[pat->hash & (LJ_PATCACHE_SETS-1)];
+  if (e[1].prog) {
+    lj_mem_free(g, e[1].prog, e[1].size);
+    c->gen++;
+  }
+  e[1] = e[0];
+  setgcref(e[0].pat, obj2gco(pat));
+  e[0].size = size;
+  e[0].prog = prog;
+}
+
+/* Free the programs of dead strings, or all programs of a cache. */
+void lj_str_patclear(global_State *g, StrPatCache *c, int all)
+{
+  StrPatEntry *e = &c->e[0][0];
+  MSize i;
+  for (i = 0; i < 2*LJ_PATCACHE_SETS; i++, e++) {
+    if (e->prog && (all || iswhite(gcref(e->pat)))) {
+      lj_mem_free(g, e->prog, e->size);
+      setgcrefnull(e->pat);
+      e->prog = NULL;
+      c->gen++;
+    }
+  }
+}
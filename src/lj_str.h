@@ -10,6 +10,9 @@
 
 #include "lj_obj.h"
 
+/* Release function of external string data. */
+typedef void (*GCstrRelease)(void *ud, char *str, size_t len);
+
 /* String helpers. */
 LJ_FUNC int32_t LJ_FASTCALL lj_str_cmp(GCstr *a, GCstr *b);
 LJ_FUNC const char *lj_str_find(const char *s, const char *f,
@@ -18,10 +21,33 @@ LJ_FUNC int lj_str_haspattern(GCstr *s);
 
 /* String interning. */
 LJ_FUNC void lj_str_resize(lua_State *L, MSize newmask);
+LJ_FUNC void lj_str_rehash(global_State *g, MSize n);
 LJ_FUNCA GCstr *lj_str_new(lua_State *L, const char *str, size_t len);
+LJ_FUNC GCstr *lj_str_newext(lua_State *L, char *str, size_t len,
+			     GCstrRelease release, void *ud);
 LJ_FUNC void LJ_FASTCALL lj_str_free(global_State *g, GCstr *s);
 
+/* Pattern and format cache. */
+LJ_FUNC void *lj_str_patget(StrPatCache *c, GCstr *pat);
+LJ_FUNC void lj_str_patset(global_State *g, StrPatCache *c, GCstr *pat,
+			   void *prog, MSize size);
+LJ_FUNC void lj_str_patclear(global_State *g, StrPatCache *c, int all);
+
 #define lj_str_newz(L, s)	(lj_str_new(L, s, strlen(s)))
 #define lj_str_newlit(L, s)	(lj_str_new(L, "" s, sizeof(s)-1))
 
+/* Header of an external string, right before its GCstr. */
+typedef struct GCstrext {
+  GCstrRelease release;	/* Called when the string is freed. */
+  void *ud;		/* Opaque argument of the release function. */
+} GCstrext;
+
+#define strext(s)	((GCstrext *)(s) - 1)
+
+/* Hash chain i of the string table, followed by the chains left to rehash. */
+#define lj_str_chain(g, i) \
+  ((i) <= (g)->strmask ? &(g)->strhash[(i)] : \
+			 &(g)->stroldhash[(i) - (g)->strmask - 1])
+#define lj_str_nchains(g)	((g)->strmask + 1 + (g)->strrehash)
+
 #endif
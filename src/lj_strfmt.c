@@ -8,12 +8,17 @@
 #define lj_strfmt_c
 #define LUA_CORE
 
+#include "lauxlib.h"
+
 #include "lj_obj.h"
+#include "lj_err.h"
 #include "lj_buf.h"
 #include "lj_str.h"
+#include "lj_meta.h"
 #include "lj_state.h"
 #include "lj_char.h"
 #include "lj_strfmt.h"
+#include "lj_lib.h"
 
 /* -- Format parser ------------------------------------------------------- */
 
@@ -87,6 +92,58 @@ retlit:
   return fs->len ? STRFMT_LIT : STRFMT_EOF;
 }
 
+/* -- Format programs ----------------------------------------------------- */
+
+/* Parse a format string into a program. Adjacent literals are merged. */
+static FormatProg *strfmt_compile(lua_State *L, GCstr *fmt)
+{
+  FormatState fs;
+  FormatProg *fp;
+  SFormat sf, last = STRFMT_EOF;
+  MSize n = 0, tlen = 0, sz;
+  char *t;
+  lj_strfmt_init(&fs, strdata(fmt), fmt->len);
+  while ((sf = lj_strfmt_parse(&fs)) != STRFMT_EOF) {
+    if (sf == STRFMT_LIT || sf == STRFMT_ERR) tlen += fs.len;
+    if (!(sf == STRFMT_LIT && last == STRFMT_LIT)) n++;
+    last = sf;
+  }
+  sz = (MSize)offsetof(FormatProg, item) + n*(MSize)sizeof(FormatItem) + tlen;
+  fp = (FormatProg *)lj_mem_new(L, sz);
+  fp->size = sz;
+  fp->nitem = n;
+  t = (char *)&fp->item[n];
+  n = tlen = 0;
+  last = STRFMT_EOF;
+  lj_strfmt_init(&fs, strdata(fmt), fmt->len);
+  while ((sf = lj_strfmt_parse(&fs)) != STRFMT_EOF) {
+    MSize len = (sf == STRFMT_LIT || sf == STRFMT_ERR) ? fs.len : 0;
+    if (sf == STRFMT_LIT && last == STRFMT_LIT) {
+      fp->item[n-1].len += len;
+    } else {
+      fp->item[n].sf = sf;
+      fp->item[n].ofs = tlen;
+      fp->item[n++].len = len;
+    }
+    memcpy(t + tlen, fs.str, len);
+    tlen += len;
+    last = sf;
+  }
+  return fp;
+}
+
+/* Get the program of a format string. */
+FormatProg *lj_strfmt_prog(lua_State *L, GCstr *fmt)
+{
+  global_State *g = G(L);
+  FormatProg *fp = (FormatProg *)lj_str_patget(&g->fmtcache, fmt);
+  if (!fp) {
+    fp = strfmt_compile(L, fmt);
+    lj_str_patset(g, &g->fmtcache, fmt, fp, fp->size);
+  }
+  return fp;
+}
+
 /* -- Raw conversions ----------------------------------------------------- */
 
 #define WINT_R(x, sh, sc) \
@@ -164,7 +221,7 @@ const char *lj_strfmt_wstrnum(lua_State *L, cTValue *o, MSize *lenp)
   } else if (tvisint(o)) {
     sb = lj_strfmt_putint(lj_buf_tmp_(L), intV(o));
   } else if (tvisnum(o)) {
-    sb = lj_strfmt_putfnum(lj_buf_tmp_(L), STRFMT_G14, o->n);
+    sb = lj_strfmt_putfnum(lj_buf_tmp_(L), G(L)->numfmt, o->n);
   } else {
     return NULL;
   }
@@ -185,7 +242,7 @@ SBuf * LJ_FASTCALL lj_strfmt_putint(SBuf *sb, int32_t k)
 /* Add number to buffer. */
 SBuf * LJ_FASTCALL lj_strfmt_putnum(SBuf *sb, cTValue *o)
 {
-  return lj_strfmt_putfnum(sb, STRFMT_G14, o->n);
+  return lj_strfmt_putfnum(sb, G(sbufL(sb))->numfmt, o->n);
 }
 #endif
 
@@ -399,6 +456,99 @@ GCstr * LJ_FASTCALL lj_strfmt_obj(lua_State *L, cTValue *o)
   }
 }
 
+/* -- Formatting of stack arguments -------------------------------------- */
+
+/* Emulate tostring() inline. */
+static GCstr *strfmt_tostring(lua_State *L, int arg, int retry)
+{
+  TValue *o = L->base+arg-1;
+  cTValue *mo;
+  lua_assert(o < L->top);  /* Caller already checks for existence. */
+  if (LJ_LIKELY(tvisstr(o)))
+    return strV(o);
+  if (retry != 2 && !tvisnil(mo = lj_meta_lookup(L, o, MM_tostring))) {
+    copyTV(L, L->top++, mo);
+    copyTV(L, L->top++, o);
+    lua_call(L, 1, 1);
+    copyTV(L, L->base+arg-1, --L->top);
+    return NULL;  /* Buffer may be overwritten, retry. */
+  }
+  return lj_strfmt_obj(L, o);
+}
+
+/* Put the stack arguments after arg, formatted by the string at arg.
+** Returns 1 if a __tostring metamethod was called. The caller must then
+** restore the buffer and call again with retry = 2.
+*/
+int lj_strfmt_putarg(lua_State *L, SBuf *sb, int arg, int retry)
+{
+  int top = (int)(L->top - L->base);
+  GCstr *fmt = lj_lib_checkstr(L, arg);
+  const FormatProg *fp = lj_strfmt_prog(L, fmt);
+  uint32_t gen = G(L)->fmtcache.gen;
+  MSize i;
+  for (i = 0; i < fp->nitem; i++) {
+    const FormatItem *fi = &fp->item[i];
+    SFormat sf = fi->sf;
+    if (sf == STRFMT_LIT) {
+      lj_buf_putmem(sb, strfmt_text(fp, fi), fi->len);
+    } else if (sf == STRFMT_ERR) {
+      lj_err_callerv(L, LJ_ERR_STRFMT,
+		     strdata(lj_str_new(L, strfmt_text(fp, fi), fi->len)));
+    } else {
+      if (++arg > top)
+	luaL_argerror(L, arg, lj_obj_typename[0]);
+      switch (STRFMT_TYPE(sf)) {
+      case STRFMT_INT:
+	if (tvisint(L->base+arg-1)) {
+	  int32_t k = intV(L->base+arg-1);
+	  if (sf == STRFMT_INT)
+	    lj_strfmt_putint(sb, k);  /* Shortcut for plain %d. */
+	  else
+	    lj_strfmt_putfxint(sb, sf, k);
+	} else {
+	  lj_strfmt_putfnum_int(sb, sf, lj_lib_checknum(L, arg));
+	}
+	break;
+      case STRFMT_UINT:
+	if (tvisint(L->base+arg-1))
+	  lj_strfmt_putfxint(sb, sf, intV(L->base+arg-1));
+	else
+	  lj_strfmt_putfnum_uint(sb, sf, lj_lib_checknum(L, arg));
+	break;
+      case STRFMT_NUM:
+	lj_strfmt_putfnum(sb, sf, lj_lib_checknum(L, arg));
+	break;
+      case STRFMT_STR: {
+	GCstr *str = strfmt_tostring(L, arg, retry);
+	if (str == NULL) {
+	  retry = 1;
+	  /* The metamethod may have evicted the program from the cache. */
+	  if (LJ_UNLIKELY(G(L)->fmtcache.gen != gen)) {
+	    fp = lj_strfmt_prog(L, fmt);
+	    gen = G(L)->fmtcache.gen;
+	  }
+	} else if ((sf & STRFMT_T_QUOTED))
+	  lj_strfmt_putquoted(sb, str);  /* No formatting. */
+	else
+	  lj_strfmt_putfstr(sb, sf, str);
+	break;
+	}
+      case STRFMT_CHAR:
+	lj_strfmt_putfchar(sb, sf, lj_lib_checkint(L, arg));
+	break;
+      case STRFMT_PTR:  /* No formatting. */
+	lj_strfmt_putptr(sb, lj_obj_ptr(L->base+arg-1));
+	break;
+      default:
+	lua_assert(0);
+	break;
+      }
+    }
+  }
+  return retry;
+}
+
 /* -- Internal string formatting ------------------------------------------ */
 
 /*
@@ -40,6 +40,7 @@ typedef enum FormatType {
 #define STRFMT_F_SPACE	0x0800
 #define STRFMT_F_ALT	0x1000
 #define STRFMT_F_UPPER	0x2000
+#define STRFMT_F_SHORT	0x4000	/* Internal: shortest round-trip %g. */
 
 /* Format indicator fields. */
 #define STRFMT_SH_WIDTH	16
@@ -65,11 +66,12 @@ typedef enum FormatType {
 #define STRFMT_U	(STRFMT_UINT)
 #define STRFMT_X	(STRFMT_UINT|STRFMT_T_HEX)
 #define STRFMT_G14	(STRFMT_G | ((14+1) << STRFMT_SH_PREC))
+#define STRFMT_SHORT	(STRFMT_G | STRFMT_F_SHORT)
 
 /* Maximum buffer sizes for conversions. */
 #define STRFMT_MAXBUF_XINT	(1+22)  /* '0' prefix + uint64_t in octal. */
 #define STRFMT_MAXBUF_INT	(1+10)  /* Sign + int32_t in decimal. */
-#define STRFMT_MAXBUF_NUM	32  /* Must correspond with STRFMT_G14. */
+#define STRFMT_MAXBUF_NUM	32  /* Must correspond with STRFMT_G14/SHORT. */
 #define STRFMT_MAXBUF_PTR	(2+2*sizeof(ptrdiff_t))  /* "0x" + hex ptr. */
 
 /* Format parser. */
@@ -82,6 +84,24 @@ static LJ_AINLINE void lj_strfmt_init(FormatState *fs, const char *p, MSize len)
   lua_assert(*fs->e == 0);  /* Must be NUL-terminated (may have NULs inside). */
 }
 
+/* Parsed format string. Cached with the interned string as the key. */
+typedef struct FormatItem {
+  SFormat sf;		/* Format, STRFMT_LIT or STRFMT_ERR. */
+  MSize ofs, len;	/* Text of a literal or an error, see strfmt_text. */
+} FormatItem;
+
+typedef struct FormatProg {
+  MSize size;		/* Size of the program. */
+  MSize nitem;		/* Number of items. */
+  FormatItem item[1];	/* Items, followed by the text of literals. */
+} FormatProg;
+
+#define strfmt_text(fp, fi) \
+  ((const char *)&(fp)->item[(fp)->nitem] + (fi)->ofs)
+
+LJ_FUNC FormatProg *lj_strfmt_prog(lua_State *L, GCstr *fmt);
+LJ_FUNC int lj_strfmt_putarg(lua_State *L, SBuf *sb, int arg, int retry);
+
 /* Raw conversions. */
 LJ_FUNC char * LJ_FASTCALL lj_strfmt_wint(char *p, int32_t k);
 LJ_FUNC char * LJ_FASTCALL lj_strfmt_wptr(char *p, const void *v);
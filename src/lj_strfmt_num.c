@@ -13,6 +13,7 @@
 #include "lj_buf.h"
 #include "lj_str.h"
 #include "lj_strfmt.h"
+#include "lj_strscan.h"
 
 /* -- Precomputed tables -------------------------------------------------- */
 
@@ -573,20 +574,347 @@ static char *lj_strfmt_wfnum(SBuf *sb, SFormat sf, lua_Number n, char *p)
   return p;
 }
 
+/* -- Shortest round-trip conversion -------------------------------------- */
+
+/*
+** Grisu3 by Florian Loitsch: the number and the bounds of its rounding
+** interval are scaled by a cached power of ten, so the integral part fits
+** into 32 bits, and the shortest digits inside the interval are generated
+** with 64 bit fixed-point arithmetic. For about 0.5% of all numbers the
+** approximation can't tell whether the digits are shortest and correctly
+** rounded. These are converted with lj_strfmt_wfnum() instead.
+*/
+
+/* Normalized 10^k = f * 2^e for k = -348, -340, ..., 340. */
+#define GRISU_POW_KMIN	-348
+#define GRISU_POW_STEP	8
+
+static const uint64_t grisu_pow_f[] = {
+  U64x(fa8fd5a0,081c0288), U64x(baaee17f,a23ebf76), U64x(8b16fb20,3055ac76),
+  U64x(cf42894a,5dce35ea), U64x(9a6bb0aa,55653b2d), U64x(e61acf03,3d1a45df),
+  U64x(ab70fe17,c79ac6ca), U64x(ff77b1fc,bebcdc4f), U64x(be5691ef,416bd60c),
+  U64x(8dd01fad,907ffc3c), U64x(d3515c28,31559a83), U64x(9d71ac8f,ada6c9b5),
+  U64x(ea9c2277,23ee8bcb), U64x(aecc4991,4078536d), U64x(823c1279,5db6ce57),
+  U64x(c2109436,4dfb5637), U64x(9096ea6f,3848984f), U64x(d77485cb,25823ac7),
+  U64x(a086cfcd,97bf97f4), U64x(ef340a98,172aace5), U64x(b23867fb,2a35b28e),
+  U64x(84c8d4df,d2c63f3b), U64x(c5dd4427,1ad3cdba), U64x(936b9fce,bb25c996),
+  U64x(dbac6c24,7d62a584), U64x(a3ab6658,0d5fdaf6), U64x(f3e2f893,dec3f126),
+  U64x(b5b5ada8,aaff80b8), U64x(87625f05,6c7c4a8b), U64x(c9bcff60,34c13053),
+  U64x(964e858c,91ba2655), U64x(dff97724,70297ebd), U64x(a6dfbd9f,b8e5b88f),
+  U64x(f8a95fcf,88747d94), U64x(b9447093,8fa89bcf), U64x(8a08f0f8,bf0f156b),
+  U64x(cdb02555,653131b6), U64x(993fe2c6,d07b7fac), U64x(e45c10c4,2a2b3b06),
+  U64x(aa242499,697392d3), U64x(fd87b5f2,8300ca0e), U64x(bce50864,92111aeb),
+  U64x(8cbccc09,6f5088cc), U64x(d1b71758,e219652c), U64x(9c400000,00000000),
+  U64x(e8d4a510,00000000), U64x(ad78ebc5,ac620000), U64x(813f3978,f8940984),
+  U64x(c097ce7b,c90715b3), U64x(8f7e32ce,7bea5c70), U64x(d5d238a4,abe98068),
+  U64x(9f4f2726,179a2245), U64x(ed63a231,d4c4fb27), U64x(b0de6538,8cc8ada8),
+  U64x(83c7088e,1aab65db), U64x(c45d1df9,42711d9a), U64x(924d692c,a61be758),
+  U64x(da01ee64,1a708dea), U64x(a26da399,9aef774a), U64x(f209787b,b47d6b85),
+  U64x(b454e4a1,79dd1877), U64x(865b8692,5b9bc5c2), U64x(c83553c5,c8965d3d),
+  U64x(952ab45c,fa97a0b3), U64x(de469fbd,99a05fe3), U64x(a59bc234,db398c25),
+  U64x(f6c69a72,a3989f5c), U64x(b7dcbf53,54e9bece), U64x(88fcf317,f22241e2),
+  U64x(cc20ce9b,d35c78a5), U64x(98165af3,7b2153df), U64x(e2a0b5dc,971f303a),
+  U64x(a8d9d153,5ce3b396), U64x(fb9b7cd9,a4a7443c), U64x(bb764c4c,a7a44410),
+  U64x(8bab8eef,b6409c1a), U64x(d01fef10,a657842c), U64x(9b10a4e5,e9913129),
+  U64x(e7109bfb,a19c0c9d), U64x(ac2820d9,623bf429), U64x(80444b5e,7aa7cf85),
+  U64x(bf21e440,03acdd2d), U64x(8e679c2f,5e44ff8f), U64x(d433179d,9c8cb841),
+  U64x(9e19db92,b4e31ba9), U64x(eb96bf6e,badf77d9), U64x(af87023b,9bf0ee6b),
+};
+static const int16_t grisu_pow_e[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+  -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635,
+  -608, -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316,
+  -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30, 56,
+  83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+  481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853,
+  880, 907, 933, 960, 986, 1013, 1039, 1066
+};
+
+/* Unpacked floating-point number f * 2^e. */
+typedef struct DiyFp {
+  uint64_t f;
+  int32_t e;
+} DiyFp;
+
+static DiyFp diyfp_norm(uint64_t f, int32_t e)
+{
+  DiyFp r;
+  uint32_t hi = (uint32_t)(f >> 32);
+  uint32_t sh = hi ? 31 - lj_fls(hi) : 63 - lj_fls((uint32_t)f);
+  r.f = f << sh;
+  r.e = e - (int32_t)sh;
+  return r;
+}
+
+/* Multiply, keeping the rounded upper 64 bits of the product. */
+static DiyFp diyfp_mul(DiyFp x, DiyFp y)
+{
+  DiyFp r;
+  uint64_t a = x.f >> 32, b = x.f & 0xffffffffu;
+  uint64_t c = y.f >> 32, d = y.f & 0xffffffffu;
+  uint64_t ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+  uint64_t t = (bd >> 32) + (ad & 0xffffffffu) + (bc & 0xffffffffu) +
+	       (1u << 31);
+  r.f = ac + (ad >> 32) + (bc >> 32) + (t >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+/*
+** Move the last digit down towards the exact value while it stays inside
+** the interval. Return 0 unless the digits are known to be closest.
+*/
+static int grisu_round_weed(char *buf, MSize len, uint64_t dist, uint64_t
+			    unsafe, uint64_t rest, uint64_t tenk, uint64_t unit)
+{
+  uint64_t small = dist - unit, big = dist + unit;
+  while (rest < small && unsafe - rest >= tenk &&
+	 (rest + tenk < small || small - rest >= rest + tenk - small)) {
+    buf[len-1]--;
+    rest += tenk;
+  }
+  if (rest < big && unsafe - rest >= tenk &&
+      (rest + tenk < big || big - rest > rest + tenk - big))
+    return 0;
+  return 2*unit <= rest && rest <= unsafe - 4*unit;
+}
+
+/*
+** Generate the digits of the scaled number w inside (lo, hi) and stop as
+** soon as the rest is inside the interval. Returns the number of digits
+** or 0 if it failed. Then w is about digits * 10^kappa.
+*/
+static MSize grisu_digits(DiyFp lo, DiyFp w, DiyFp hi, char *buf,
+			  int32_t *kappap)
+{
+  uint64_t unit = 1, unsafe, rest, frac, one, dist;
+  uint32_t sh = (uint32_t)-w.e, intg, div;
+  int32_t kappa;
+  MSize len = 0;
+  char dig[10], *d;
+  lo.f -= unit;
+  hi.f += unit;  /* The scaled bounds are off by up to one unit. */
+  unsafe = hi.f - lo.f;
+  dist = hi.f - w.f;
+  one = (uint64_t)1 << sh;
+  intg = (uint32_t)(hi.f >> sh);
+  frac = hi.f & (one - 1);
+  kappa = (int32_t)ndigits_dec(intg);
+  /* Convert the integral part at once, then strip digit by digit. */
+  if (kappa == 10) {
+    dig[0] = (char)('0' + intg / 1000000000);
+    lj_strfmt_wuint9(dig+1, intg % 1000000000);
+    d = dig;
+  } else {
+    lj_strfmt_wuint9(dig, intg);
+    d = dig + 9 - kappa;
+  }
+  while (kappa > 0) {
+    div = ndigits_dec_threshold[--kappa] + 1;  /* 10^kappa */
+    buf[len] = *d++;
+    intg -= (uint32_t)(buf[len++] - '0') * div;
+    rest = ((uint64_t)intg << sh) + frac;
+    if (rest < unsafe) {
+      *kappap = kappa;
+      return grisu_round_weed(buf, len, dist, unsafe, rest,
+			      (uint64_t)div << sh, unit) ? len : 0;
+    }
+  }
+  for (;;) {
+    frac *= 10;
+    unit *= 10;
+    unsafe *= 10;
+    buf[len++] = (char)('0' + (frac >> sh));
+    frac &= one - 1;
+    kappa--;
+    if (frac < unsafe) {
+      *kappap = kappa;
+      return grisu_round_weed(buf, len, dist * unit, unsafe, frac, one,
+			      unit) ? len : 0;
+    }
+  }
+}
+
+/*
+** Get the shortest digits of a positive finite number, which read back as
+** the same number. Returns the number of digits, n == digits * 10^(*kp).
+*/
+static MSize grisu3(lua_Number n, char *buf, int32_t *kp)
+{
+  TValue t;
+  DiyFp w, lo, hi, c;
+  uint64_t f;
+  int32_t e, k, kappa, idx;
+  double lk;
+  MSize len;
+  t.n = n;
+  f = t.u64 & U64x(000fffff,ffffffff);
+  e = (t.u32.hi >> 20) & 0x7ff;
+  if (e) { f |= U64x(00100000,00000000); e -= 1075; } else { e = -1074; }
+  /* Bounds of the rounding interval, half-way to the neighbours. */
+  hi = diyfp_norm((f << 1) + 1, e - 1);
+  if (f == U64x(00100000,00000000) && e > -1074) {
+    lo.f = (f << 2) - 1; lo.e = e - 2;  /* Lower neighbour is closer. */
+  } else {
+    lo.f = (f << 1) - 1; lo.e = e - 1;
+  }
+  lo.f <<= lo.e - hi.e;
+  lo.e = hi.e;
+  w = diyfp_norm(f, e);
+  /* Pick 10^k, so the exponent of the scaled numbers is in -60 .. -32. */
+  lk = (-60 - (w.e + 64) + 63) * 0.30102999566398114;  /* log10(2) */
+  k = (int32_t)lk;
+  if (lk > (double)k) k++;  /* ceil() */
+  idx = (-GRISU_POW_KMIN + k - 1) / GRISU_POW_STEP + 1;
+  c.f = grisu_pow_f[idx];
+  c.e = grisu_pow_e[idx];
+  len = grisu_digits(diyfp_mul(lo, c), diyfp_mul(w, c), diyfp_mul(hi, c),
+		     buf, &kappa);
+  *kp = kappa - (GRISU_POW_KMIN + idx * GRISU_POW_STEP);
+  return len;
+}
+
+/* Get the shortest digits the slow way, for numbers where Grisu3 fails. */
+static MSize shortest_nd(lua_Number n, char *buf, int32_t *kp)
+{
+  char tmp[STRFMT_MAXBUF_NUM];
+  MSize lo = 1, hi = 17, len = 0, i;
+  const char *q, *e;
+  int32_t x = 0;
+  TValue o;
+  /* The correctly rounded digits read back for all lengths from some on. */
+  while (lo < hi) {
+    MSize prec = (lo + hi) >> 1;
+    SFormat sf = STRFMT_E | (prec << STRFMT_SH_PREC);  /* %.(prec-1)e */
+    MSize tl = (MSize)(lj_strfmt_wfnum(NULL, sf, n, tmp) - tmp);
+    tmp[tl] = '\0';  /* The scanner needs a terminator. */
+    if (lj_strscan_scan((const uint8_t *)tmp, tl, &o, STRSCAN_OPT_TONUM) ==
+	STRSCAN_NUM && o.n == n)
+      hi = prec;
+    else
+      lo = prec + 1;
+  }
+  e = lj_strfmt_wfnum(NULL, STRFMT_E | (hi << STRFMT_SH_PREC), n, tmp);
+  for (q = tmp; *q != 'e'; q++)
+    if (*q != '.') buf[len++] = *q;
+  for (i = 2; q + i < e; i++)
+    x = x*10 + (q[i] - '0');
+  if (q[1] == '-') x = -x;
+  while (len > 1 && buf[len-1] == '0') len--;
+  *kp = x - (int32_t)len + 1;
+  return len;
+}
+
+/*
+** Round an exact tie between the digits d and its neighbour to an even last
+** digit, like a correctly rounded %.17g. The caller has checked that the last
+** digit is odd. With n = f * 2^e and f odd, the tie is n == (2*d +- 1) * 10^k
+** / 2, i.e. e == k-1 and (2*d +- 1) == f * 5^-k resp. f == (2*d +- 1) * 5^k.
+*/
+static MSize shortest_even(lua_Number n, char *buf, MSize len, int32_t *kp)
+{
+  TValue t;
+  uint64_t f, d = 0, p5 = 1, m;
+  int32_t e, k = *kp, i;
+  t.n = n;
+  f = t.u64 & U64x(000fffff,ffffffff);
+  e = (t.u32.hi >> 20) & 0x7ff;
+  if (e) { f |= U64x(00100000,00000000); e -= 1075; } else { e = -1074; }
+  i = (int32_t)(t.u32.lo ? lj_ffs(t.u32.lo) : 32 + lj_ffs((uint32_t)(f >> 32)));
+  f >>= i;
+  if (e + i != k - 1 || k > 22 || k < -27)
+    return len;  /* Not a tie. Then 5^|k| doesn't fit, or f would be even. */
+  for (i = 0; i < (int32_t)len; i++) d = d*10 + (uint64_t)(buf[i] - '0');
+  for (i = k < 0 ? -k : k; i > 0; i--) p5 *= 5;
+  for (m = 2*d - 1; m <= 2*d + 1; m += 2) {
+    if (k >= 0 ? (m <= f / p5 && m * p5 == f) : (f <= m / p5 && f * p5 == m))
+      break;
+  }
+  if (m < 2*d) {  /* Halfway above d-1. */
+    buf[len-1]--;
+  } else if (m == 2*d + 1) {  /* Halfway below d+1. */
+    MSize j = len;
+    while (j > 0 && buf[j-1] == '9') j--;
+    if (j == 0) { buf[j++] = '0'; k++; }
+    buf[j-1]++;
+    k += (int32_t)(len - j);
+    len = j;
+  } else {
+    return len;
+  }
+  while (len > 1 && buf[len-1] == '0') { len--; k++; }
+  *kp = k;
+  return len;
+}
+
+/* Write shortest representation reading back as the same number, like %g. */
+static char *strfmt_wshort(char *p, lua_Number n)
+{
+  char buf[24];
+  int32_t k, x;
+  MSize len, i;
+  TValue t;
+  t.n = n;
+  if (LJ_UNLIKELY((t.u32.hi << 1) >= 0xffe00000))
+    return lj_strfmt_wfnum(NULL, STRFMT_G, n, p);  /* inf or nan. */
+  if ((t.u32.hi & 0x80000000)) {
+    *p++ = '-';
+    n = -n;
+  }
+  if (n == 0) {
+    *p++ = '0';
+    return p;
+  }
+  len = grisu3(n, buf, &k);
+  if (LJ_UNLIKELY(len == 0)) len = shortest_nd(n, buf, &k);
+  if ((buf[len-1] & 1)) len = shortest_even(n, buf, len, &k);
+  x = k + (int32_t)len - 1;  /* Exponent of the leading digit. */
+  if (x >= -4 && x < 17) {  /* Like %.17g, i.e. integers aren't shortened. */
+    if (k >= 0) {
+      for (i = 0; i < len; i++) *p++ = buf[i];
+      while (k--) *p++ = '0';
+    } else if (x >= 0) {
+      for (i = 0; i <= (MSize)x; i++) *p++ = buf[i];
+      *p++ = '.';
+      for (; i < len; i++) *p++ = buf[i];
+    } else {
+      *p++ = '0'; *p++ = '.';
+      while (++x < 0) *p++ = '0';
+      for (i = 0; i < len; i++) *p++ = buf[i];
+    }
+  } else {
+    *p++ = buf[0];
+    if (len > 1) {
+      *p++ = '.';
+      for (i = 1; i < len; i++) *p++ = buf[i];
+    }
+    *p++ = 'e';
+    if (x < 0) { *p++ = '-'; x = -x; } else { *p++ = '+'; }
+    if (x < 10) *p++ = '0';  /* Always at least two digits of exponent. */
+    p = lj_strfmt_wint(p, x);
+  }
+  return p;
+}
+
+/* -- Conversions to buffer and strings ----------------------------------- */
+
 /* Add formatted floating-point number to buffer. */
 SBuf *lj_strfmt_putfnum(SBuf *sb, SFormat sf, lua_Number n)
 {
-  setsbufP(sb, lj_strfmt_wfnum(sb, sf, n, NULL));
+  if ((sf & STRFMT_F_SHORT))
+    setsbufP(sb, strfmt_wshort(lj_buf_more(sb, STRFMT_MAXBUF_NUM), n));
+  else
+    setsbufP(sb, lj_strfmt_wfnum(sb, sf, n, NULL));
   return sb;
 }
 
-/* -- Conversions to strings ---------------------------------------------- */
-
 /* Convert number to string. */
 GCstr * LJ_FASTCALL lj_strfmt_num(lua_State *L, cTValue *o)
 {
   char buf[STRFMT_MAXBUF_NUM];
-  MSize len = (MSize)(lj_strfmt_wfnum(NULL, STRFMT_G14, o->n, buf) - buf);
+  SFormat sf = G(L)->numfmt;
+  MSize len = (MSize)(((sf & STRFMT_F_SHORT) ? strfmt_wshort(buf, o->n) :
+		       lj_strfmt_wfnum(NULL, sf, o->n, buf)) - buf);
   return lj_str_new(L, buf, len);
 }
 
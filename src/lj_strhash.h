@@ -0,0 +1,279 @@
+/*
+** String hash, compare and search kernels.
+*/
+
+#ifndef _LJ_STRHASH_H
+#define _LJ_STRHASH_H
+
+#include <string.h>
+
+#include "lj_obj.h"
+
+#if LJ_TARGET_X64 && defined(__GNUC__)
+#include <nmmintrin.h>
+#define LJ_STRHASH_CRC32	1
+#define LJ_STRHASH_TARGET	__attribute__((target("sse4.2")))
+#define strhash_crc32(crc, v)	((uint32_t)_mm_crc32_u64((crc), (v)))
+#elif LJ_TARGET_ARM64 && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define LJ_STRHASH_CRC32	1
+#define LJ_STRHASH_TARGET
+#define strhash_crc32(crc, v)	__crc32cd((crc), (v))
+#else
+#define LJ_STRHASH_CRC32	0
+#endif
+
+#if LJ_STRHASH_CRC32
+LJ_FUNC int lj_str_hascrc32(void);
+#endif
+
+#if LJ_TARGET_X64
+#include <emmintrin.h>
+#define LJ_STRCMP_SIMD		1
+#elif LJ_TARGET_ARM64 && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LJ_STRCMP_SIMD		1
+#else
+#define LJ_STRCMP_SIMD		0
+#endif
+
+/* Max. number of bytes read past the end of the compared strings, plus 1. */
+#if LJ_STRCMP_SIMD
+#define LJ_STRCMP_OVERREAD	16
+#else
+#define LJ_STRCMP_OVERREAD	4
+#endif
+
+/* Check whether the compare kernels may read past the end of a string. */
+#define lj_strcmp_canoverread(p, len) \
+  ((((uintptr_t)(p)+(len)-1) & (LJ_PAGESIZE-1)) <= \
+   LJ_PAGESIZE-LJ_STRCMP_OVERREAD)
+
+#if LUAJIT_USE_ASAN
+/* These functions may read past a buffer end, that's ok. */
+static LJ_AINLINE int lj_strcmp_scalar(const char *a, const char *b, MSize len)
+  __attribute__((no_sanitize_address));
+#if LJ_STRCMP_SIMD
+static LJ_AINLINE int lj_strcmp_simd(const char *a, const char *b, MSize len)
+  __attribute__((no_sanitize_address));
+#endif
+#endif
+
+/* -- Hash kernels -------------------------------------------------------- */
+
+/* Full hash of a string with at least 12 bytes. */
+static LJ_AINLINE uint32_t lj_strhash_full(const uint8_t *v, MSize len)
+{
+  MSize a = 0, b = 0;
+  MSize c = 0xcafedead;
+  MSize d = 0xdeadbeef;
+  MSize h = len;
+  lua_assert(len >= 12);
+  for(; len>8; len-=8, v+=8) {
+    a ^= lj_getu32(v);
+    b ^= lj_getu32(v+4);
+    c += a;
+    d += b;
+    a = lj_rol(a, 5) - d;
+    b = lj_rol(b, 7) - c;
+    c = lj_rol(c, 24) ^ a;
+    d = lj_rol(d, 1) ^ b;
+  }
+  a ^= lj_getu32(v+len-8);
+  b ^= lj_getu32(v+len-4);
+  c += b; c -= lj_rol(a, 9);
+  d += a; d -= lj_rol(b, 18);
+  h -= lj_rol(a^b,7);
+  h += c; h += lj_rol(d,13);
+  d ^= c;  d -= lj_rol(c,25);
+  h ^= d; h -= lj_rol(d,16);
+  c ^= h; c -= lj_rol(h,4);
+  d ^= c;  d -= lj_rol(c,14);
+  h ^= d; h -= lj_rol(d,24);
+  return h;
+}
+
+#if LJ_STRHASH_CRC32
+static LJ_AINLINE uint64_t strhash_getu64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/*
+** Full hash of a string with at least 12 bytes, using the CRC32C
+** instruction. Two independent CRCs consume 16 bytes per round, the tail
+** is read with overlapping loads. Needs a CPU check on x64, see
+** lj_str_hascrc32().
+*/
+static LJ_INLINE LJ_STRHASH_TARGET uint32_t
+lj_strhash_crc32(const uint8_t *v, MSize len)
+{
+  const uint8_t *e = v + len;
+  uint32_t a = len, b = 0xdeadbeef, h;
+  lua_assert(len >= 12);
+  if (len > 16) {
+    do {
+      a = strhash_crc32(a, strhash_getu64(v));
+      b = strhash_crc32(b, strhash_getu64(v+8));
+      v += 16;
+    } while (e - v > 16);
+    v = e - 16;
+  }
+  a = strhash_crc32(a, strhash_getu64(v));
+  b = strhash_crc32(b, strhash_getu64(e-8));
+  /* The CRC is linear, so mix the result like the murmur3 finalizer. */
+  h = a ^ lj_rol(b, 16);
+  h ^= h >> 16; h *= 0x85ebca6b;
+  h ^= h >> 13; h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+#endif
+
+/* -- Compare kernels ----------------------------------------------------- */
+
+/*
+** The compare kernels return zero if the string data is equal. Caveat:
+** they read past the end of both strings, see lj_strcmp_canoverread().
+*/
+
+/* Compare string data 4 bytes at a time. The 2nd string must be aligned. */
+static LJ_AINLINE int lj_strcmp_scalar(const char *a, const char *b, MSize len)
+{
+  MSize i = 0;
+  lua_assert(len > 0);
+  lua_assert(lj_strcmp_canoverread(a, len));
+  do {  /* Note: innocuous access up to end of string + 3. */
+    uint32_t v = lj_getu32(a+i) ^ *(const uint32_t *)(b+i);
+    if (v) {
+      i -= len;
+#if LJ_LE
+      return (int32_t)i >= -3 ? (v << (32+(i<<3))) : 1;
+#else
+      return (int32_t)i >= -3 ? (v >> (32+(i<<3))) : 1;
+#endif
+    }
+    i += 4;
+  } while (i < len);
+  return 0;
+}
+
+#if LJ_STRCMP_SIMD
+/* Compare string data 16 bytes at a time. */
+static LJ_AINLINE int lj_strcmp_simd(const char *a, const char *b, MSize len)
+{
+  MSize i = 0;
+  lua_assert(len > 0);
+  lua_assert(lj_strcmp_canoverread(a, len) && lj_strcmp_canoverread(b, len));
+  do {  /* Note: innocuous access up to end of string + 15. */
+#if LJ_TARGET_X64
+    __m128i va = _mm_loadu_si128((const __m128i *)(a+i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b+i));
+    uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffff;
+    if (m)  /* Only differences before the end count. */
+      return i + lj_ffs(m) < len;
+#else
+    uint8x16_t ne = vmvnq_u8(vceqq_u8(vld1q_u8((const uint8_t *)a+i),
+				      vld1q_u8((const uint8_t *)b+i)));
+    /* Narrow to 4 bits per byte to get a scalar mask. */
+    uint64_t m = vget_lane_u64(vreinterpret_u64_u8(
+		   vshrn_n_u16(vreinterpretq_u16_u8(ne), 4)), 0);
+    if (m)  /* Only differences before the end count. */
+      return i + ((uint32_t)__builtin_ctzll(m) >> 2) < len;
+#endif
+    i += 16;
+  } while (i < len);
+  return 0;
+}
+#endif
+
+/* -- Search kernels ------------------------------------------------------ */
+
+/* Find p in s with memchr() on the first byte. 0 < plen <= slen. */
+static LJ_AINLINE const char *lj_strfind_scalar(const char *s, const char *p,
+						MSize slen, MSize plen)
+{
+  int c = *(const uint8_t *)p++;
+  plen--; slen -= plen;
+  while (slen) {
+    const char *q = (const char *)memchr(s, c, slen);
+    if (!q) break;
+    if (memcmp(q+1, p, plen) == 0) return q;
+    q++; slen -= (MSize)(q-s); s = q;
+  }
+  return NULL;
+}
+
+#if LJ_STRCMP_SIMD
+/* Max. average density of false candidates for memchr(), in bytes. */
+#define STRFIND_SPAN	128
+/* Positions checked per vector step. */
+#if LJ_TARGET_X64
+#define STRFIND_STRIDE	32
+#else
+#define STRFIND_STRIDE	16
+#endif
+
+/*
+** Find p in s. memchr() on the first byte is the fastest scan as long as
+** that byte is rare in s. Once it stops too often, e.g. at every line for
+** "\r\n\r\n" in HTTP headers, switch to checking STRFIND_STRIDE positions
+** at a time. Only the positions where both the first and the last byte of
+** p match are compared. Doesn't read past the end of s. 1 < plen <= slen.
+*/
+static LJ_AINLINE const char *lj_strfind_simd(const char *s, const char *p,
+					      MSize slen, MSize plen)
+{
+  MSize i = 0, last = plen-1, miss = 0;
+  int c = *(const uint8_t *)p;
+  while (i + last < slen) {
+    const char *q = (const char *)memchr(s+i, c, slen-last-i);
+    if (!q) return NULL;
+    if (memcmp(q+1, p+1, last) == 0) return q;
+    i = (MSize)(q-s) + 1;
+    if (++miss*STRFIND_SPAN > i + 4*STRFIND_SPAN) break;
+  }
+  {
+#if LJ_TARGET_X64
+    __m128i vf = _mm_set1_epi8(p[0]), vl = _mm_set1_epi8(p[last]);
+    for (; i + last + STRFIND_STRIDE <= slen; i += STRFIND_STRIDE) {
+#define strfind_mask(o) \
+  _mm_and_si128( \
+    _mm_cmpeq_epi8(vf, _mm_loadu_si128((const __m128i *)(s+i+(o)))), \
+    _mm_cmpeq_epi8(vl, _mm_loadu_si128((const __m128i *)(s+i+last+(o)))))
+      __m128i e0 = strfind_mask(0), e1 = strfind_mask(16);
+#undef strfind_mask
+      if (LJ_UNLIKELY(_mm_movemask_epi8(_mm_or_si128(e0, e1)))) {
+	uint32_t m = (uint32_t)_mm_movemask_epi8(e0) |
+		     ((uint32_t)_mm_movemask_epi8(e1) << 16);
+	do {
+	  const char *q = s + i + lj_ffs(m);
+	  if (memcmp(q+1, p+1, last-1) == 0) return q;
+	  m &= m-1;
+	} while (m);
+      }
+    }
+#else
+    uint8x16_t vf = vdupq_n_u8((uint8_t)p[0]);
+    uint8x16_t vl = vdupq_n_u8((uint8_t)p[last]);
+    for (; i + last + STRFIND_STRIDE <= slen; i += STRFIND_STRIDE) {
+      uint8x16_t eq = vandq_u8(vceqq_u8(vf, vld1q_u8((const uint8_t *)s+i)),
+			       vceqq_u8(vl, vld1q_u8((const uint8_t *)s+i+last)));
+      /* Narrow to 4 bits per byte to get a scalar mask. */
+      uint64_t m = vget_lane_u64(vreinterpret_u64_u8(
+		     vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+      for (; m; m &= ~((uint64_t)15 << (__builtin_ctzll(m) & ~3))) {
+	const char *q = s + i + ((uint32_t)__builtin_ctzll(m) >> 2);
+	if (memcmp(q+1, p+1, last-1) == 0) return q;
+      }
+    }
+#endif
+  }
+  /* Less than STRFIND_STRIDE positions are left. */
+  return i + plen <= slen ? lj_strfind_scalar(s+i, p, slen-i, plen) : NULL;
+}
+#endif
+
+#endif
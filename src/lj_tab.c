@@ -252,6 +252,7 @@ void lj_tab_resize(lua_State *L, GCtab *t, uint32_t asize, uint32_t hbits)
   Node *oldnode = noderef(t->node);
   uint32_t oldasize = t->asize;
   uint32_t oldhmask = t->hmask;
+  lj_gc_travrestart(G(L), t);
   if (asize > oldasize) {  /* Array part grows? */
     TValue *array;
     uint32_t i;
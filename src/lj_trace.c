@@ -122,21 +122,23 @@ GCtrace * LJ_FASTCALL lj_trace_alloc(lua_State *L, GCtrace *T)
 {
   size_t sztr = ((sizeof(GCtrace)+7)&~7);
   size_t szins = (T->nins-T->nk)*sizeof(IRIns);
-  size_t sz = sztr + szins +
-	      T->nsnap*sizeof(SnapShot) +
-	      T->nsnapmap*sizeof(SnapEntry);
+  MSize nsnapmap = lj_snap_pack(T, NULL, NULL);
+  size_t szsnap = T->nsnap*sizeof(SnapShot) + nsnapmap*sizeof(SnapEntry);
+  size_t sz = sztr + szins + szsnap;
   GCtrace *T2 = lj_mem_newt(L, (MSize)sz, GCtrace);
   char *p = (char *)T2 + sztr;
   T2->gct = ~LJ_TTRACE;
   T2->marked = 0;
   T2->traceno = 0;
+  T2->snapplan = NULL;
   T2->ir = (IRIns *)p - T->nk;
   T2->nins = T->nins;
   T2->nk = T->nk;
   T2->nsnap = T->nsnap;
-  T2->nsnapmap = T->nsnapmap;
+  T2->nsnapmap = nsnapmap;
   memcpy(p, T->ir + T->nk, szins);
   L2J(L)->tracenum++;
+  L2J(L)->szallsnap += szsnap;
   return T2;
 }
 
@@ -146,6 +148,7 @@ static void trace_save(jit_State *J, GCtrace *T)
   size_t sztr = ((sizeof(GCtrace)+7)&~7);
   size_t szins = (J->cur.nins-J->cur.nk)*sizeof(IRIns);
   char *p = (char *)T + sztr;
+  MSize nsnapmap = T->nsnapmap;  /* Packed size computed by lj_trace_alloc. */
   memcpy(T, &J->cur, sizeof(GCtrace));
   setgcrefr(T->nextgc, J2G(J)->gc.root);
   setgcrefp(J2G(J)->gc.root, T);
@@ -154,7 +157,9 @@ static void trace_save(jit_State *J, GCtrace *T)
   T->ir = (IRIns *)p - J->cur.nk;  /* The IR has already been copied above. */
   p += szins;
   TRACE_APPENDVEC(snap, nsnap, SnapShot)
-  TRACE_APPENDVEC(snapmap, nsnapmap, SnapEntry)
+  T->snapmap = (SnapEntry *)p;
+  T->nsnapmap = lj_snap_pack(&J->cur, T->snap, T->snapmap);
+  lua_assert(T->nsnapmap == nsnapmap); UNUSED(nsnapmap);
   J->cur.traceno = 0;
   J->curfinal = NULL;
   setgcrefp(J->trace[T->traceno], T);
@@ -174,6 +179,9 @@ void LJ_FASTCALL lj_trace_free(global_State *g, GCtrace *T)
       J->freetrace = T->traceno;
     setgcrefnull(J->trace[T->traceno]);
   }
+  if (T->snapplan)
+    lj_snap_freeplans(g, T);
+  J->szallsnap -= T->nsnap*sizeof(SnapShot) + T->nsnapmap*sizeof(SnapEntry);
   lj_mem_free(g, T,
     ((sizeof(GCtrace)+7)&~7) + (T->nins-T->nk)*sizeof(IRIns) +
     T->nsnap*sizeof(SnapShot) + T->nsnapmap*sizeof(SnapEntry));
@@ -19,6 +19,7 @@ TREDEF(NYIBC,	"NYI: bytecode %d")
 TREDEF(LLEAVE,	"leaving loop in root trace")
 TREDEF(LINNER,	"inner loop in root trace")
 TREDEF(LUNROLL,	"loop unroll limit reached")
+TREDEF(LOUTER,	"short loop left to outer trace")
 
 /* Recording calls/returns. */
 TREDEF(BADTYPE,	"bad argument type")
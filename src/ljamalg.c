@@ -49,6 +49,8 @@
 #include "lj_strfmt_num.c"
 #include "lj_api.c"
 #include "lj_mapi.c"
+#include "lj_memprof.c"
+#include "lj_heapdump.c"
 #include "lj_profile.c"
 #include "lj_lex.c"
 #include "lj_parse.c"
@@ -95,5 +97,6 @@
 #include "lib_jit.c"
 #include "lib_ffi.c"
 #include "lib_misc.c"
+#include "lib_buffer.c"
 #include "lib_init.c"
 
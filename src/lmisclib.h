@@ -8,10 +8,14 @@
 #ifndef _LMISCLIB_H
 #define _LMISCLIB_H
 
+#include <stdint.h>
+
 #include "lua.h"
 
 /* API for obtaining various platform metrics. */
 
+#define LUAM_GCPAUSE_HIST	20
+
 struct luam_Metrics {
   /*
   ** Number of strings being interned (i.e. the string with the
@@ -45,6 +49,34 @@ struct luam_Metrics {
   size_t gc_steps_sweep;
   size_t gc_steps_finalize;
 
+  /*
+  ** Histogram of GC step durations. Bucket i counts the steps
+  ** shorter than 2^i microseconds, the last one counts the rest.
+  ** Only every 16th step is timed, unless a time budget is set by
+  ** collectgarbage("setbudget"), which needs every step timed.
+  */
+  size_t gc_pause_hist[LUAM_GCPAUSE_HIST];
+  /* Total and maximum duration of the atomic GC phase in nanoseconds. */
+  uint64_t gc_atomic_ns;
+  uint64_t gc_atomic_max_ns;
+
+  /* Memory limit set by collectgarbage("setlimit"), 0 if there is none. */
+  size_t gc_limit;
+  /* Allocations refused due to the memory limit. */
+  size_t gc_limit_errors;
+  /* Full cycles run on reaching the soft limit. */
+  size_t gc_emergency;
+
+  /* Objects waiting for their finalizer. */
+  size_t gc_finalize_queue;
+  /* Total number of finalizers run and the time spent in them. */
+  size_t gc_finalized;
+  uint64_t gc_finalize_ns;
+
+  /* Lookups of compiled Lua patterns found in and missing from the cache. */
+  size_t patcache_hit;
+  size_t patcache_miss;
+
   /*
   ** Overall number of snap restores (amount of guard assertions
   ** leading to stopping trace executions).
@@ -54,12 +86,74 @@ struct luam_Metrics {
   size_t jit_trace_abort;
   /* Total size of all allocated machine code areas. */
   size_t jit_mcode_size;
+  /* Total size of snapshots (headers and maps) of all JIT traces. */
+  size_t jit_snap_size;
   /* Amount of JIT traces. */
   unsigned int jit_trace_num;
 };
 
 LUAMISC_API void luaM_metrics(lua_State *L, struct luam_Metrics *metrics);
 
+/* Allocation profiler. */
+#define LUAM_MEMPROF_SUCCESS	0
+#define LUAM_MEMPROF_ERRRUN	1	/* Profiler is (not) running. */
+#define LUAM_MEMPROF_ERRIO	2	/* Cannot open or write the file. */
+
+/*
+** Start writing the allocation events of the VM to the given file.
+** Use jit/memprof.lua to turn the file into a report.
+*/
+LUAMISC_API int luaM_memprof_start(lua_State *L, const char *fname);
+/* Stop the allocation profiler and close the file. */
+LUAMISC_API int luaM_memprof_stop(lua_State *L);
+
+/* Heap snapshot dump. */
+#define LUAM_HEAPDUMP_SUCCESS	0
+#define LUAM_HEAPDUMP_ERRRUN	1	/* Dump is (not) in progress. */
+#define LUAM_HEAPDUMP_ERRIO	2	/* Cannot open or write the file. */
+
+/*
+** Start writing a snapshot of the heap to the given file. The heap is
+** walked by the following GC steps, the collector resumes afterwards.
+** Use jit/heapdump.lua to compute the retained sizes from the file.
+*/
+LUAMISC_API int luaM_heapdump_start(lua_State *L, const char *fname);
+/* Complete the heap walk, if needed, and close the file. */
+LUAMISC_API int luaM_heapdump_finish(lua_State *L);
+
+/* External strings. */
+#define LUAM_EXTSTRHDR	40	/* Header room before the string data. */
+
+typedef void (*luam_Release)(void *ud, char *str, size_t len);
+
+/*
+** Push a string whose data stays in memory owned by the caller, without
+** copying it. The data must be 8-byte aligned. The LUAM_EXTSTRHDR bytes
+** before it and the byte after it must be writable: they receive the
+** string header and the terminating zero. The data is copied if the zero
+** is within 3 bytes of a page end, since compares read a few bytes past
+** it. The VM calls release(ud, str, len) once it's done with the memory:
+** right away if an equal string exists already, otherwise when the string
+** is collected. The release function must not call into the VM. Returns
+** the data of the pushed string, which is str unless it was copied or
+** already interned. If an error is thrown, the memory stays owned by the
+** caller.
+*/
+LUAMISC_API const char *luaM_pushextstring(lua_State *L, char *str,
+					   size_t len, luam_Release release,
+					   void *ud);
+
+/* Number to string conversions. */
+#define LUAM_NUMFMT_G14		0	/* "%.14g", the default. */
+#define LUAM_NUMFMT_SHORTEST	1	/* Shortest string reading back exactly. */
+
+/*
+** Set the format used by tostring(), concatenation and table.concat() for
+** non-integer numbers, unless fmt is negative. Returns the previous one.
+** Changing it flushes all traces, since they may hold converted numbers.
+*/
+LUAMISC_API int luaM_numfmt(lua_State *L, int fmt);
+
 #define LUAM_MISCLIBNAME "misc"
 LUALIB_API int luaopen_misc(lua_State *L);
 
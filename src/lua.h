@@ -230,6 +230,13 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCBGSWEEP		12
+#define LUA_GCSETBUDGET		13
+#define LUA_GCSETLIMIT		14
+#define LUA_GCFINALIZE		15
+#define LUA_GCSETFINBATCH	16
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -99,6 +99,9 @@
 #define LUAI_MAXCSTACK	8000	/* Max. # of stack slots for a C func (<10K). */
 #define LUAI_GCPAUSE	200	/* Pause GC until memory is at 200%. */
 #define LUAI_GCMUL	200	/* Run GC at 200% of allocation speed. */
+#define LUAI_GCMINORMUL	20	/* Minor GC when memory grew by 20%. */
+#define LUAI_GCMAJORMUL	100	/* Major GC when old memory grew by 100%. */
+#define LUAI_GCFINBATCH	16	/* Max. number of finalizers per GC step. */
 #define LUA_MAXCAPTURES	32	/* Max. pattern captures. */
 
 /* Configuration for the frontend (the luajit executable). */
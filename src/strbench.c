@@ -0,0 +1,272 @@
+/*
+** Microbenchmark of the string hash, compare and search kernels.
+**
+** Build with "make strbench" and run "./strbench [calls]". For several
+** distributions of string lengths it prints the time per call of every
+** hash and compare kernel available on this CPU. The compared strings are
+** equal, which is the expensive case when a string is already interned.
+** Then it prints the time of a plain string.find() over some typical
+** inputs, for every search kernel.
+*/
+
+#define LUA_CORE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lj_obj.h"
+#include "lj_strhash.h"
+
+#define NSTR		4096	/* Number of strings, must be a power of 2. */
+
+typedef struct BenchDist {
+  const char *name;
+  MSize minlen, maxlen;
+} BenchDist;
+
+static const BenchDist bench_dists[] = {
+  { "tiny", 1, 12 },
+  { "keys", 12, 32 },
+  { "headers", 16, 64 },
+  { "long", 64, 512 },
+  { "huge", 1024, 4096 }
+};
+
+static const char *str_a[NSTR], *str_b[NSTR];
+static MSize str_len[NSTR];
+
+static double bench_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Fill the strings. The copies are 8-byte aligned like string objects. */
+static double bench_fill(char *a, char *b, const BenchDist *d)
+{
+  double total = 0;
+  int i;
+  for (i = 0; i < NSTR; i++) {
+    MSize j, len = d->minlen + (MSize)rand() % (d->maxlen - d->minlen + 1);
+    for (j = 0; j < len; j++) a[j] = (char)('a' + rand() % 26);
+    memcpy(b, a, len);
+    str_a[i] = a; str_b[i] = b; str_len[i] = len;
+    a += len;
+    b += (len + 7) & ~(MSize)7;
+    total += len;
+  }
+  return total / NSTR;
+}
+
+#define BENCH_HASH(name, attr, kernel) \
+  static attr uint32_t name(uint32_t n) \
+  { \
+    uint32_t i, x = 0; \
+    for (i = 0; i < n; i++) { \
+      uint32_t k = i & (NSTR-1); \
+      x += kernel((const uint8_t *)str_a[k], str_len[k]); \
+    } \
+    return x; \
+  }
+
+#define BENCH_CMP(name, kernel) \
+  static uint32_t name(uint32_t n) \
+  { \
+    uint32_t i, x = 0; \
+    for (i = 0; i < n; i++) { \
+      uint32_t k = i & (NSTR-1); \
+      x += (uint32_t)kernel(str_a[k], str_b[k], str_len[k]); \
+    } \
+    return x; \
+  }
+
+BENCH_HASH(bench_hash_scalar, , lj_strhash_full)
+#if LJ_STRHASH_CRC32
+BENCH_HASH(bench_hash_crc32, LJ_STRHASH_TARGET, lj_strhash_crc32)
+#endif
+BENCH_CMP(bench_cmp_scalar, lj_strcmp_scalar)
+#if LJ_STRCMP_SIMD
+BENCH_CMP(bench_cmp_simd, lj_strcmp_simd)
+#endif
+
+static volatile uint32_t bench_sink;
+
+/* -- Search inputs ------------------------------------------------------- */
+
+#define FINDSIZE	16384	/* Size of the searched texts. */
+
+typedef struct BenchFind {
+  const char *name;
+  const char *pat;
+  void (*fill)(char *s, MSize len);
+} BenchFind;
+
+/* Put the string with the pattern at the end of the text. */
+#define bench_tail(s, len, str) \
+  memcpy((s) + (len) - (sizeof(str)-1), (str), sizeof(str)-1)
+
+/* HTTP request headers, the end of headers is the last 4 bytes. */
+static void bench_fill_http(char *s, MSize len)
+{
+  static const char *const hdr[] = {
+    "Host: example.com", "Accept: */*", "Connection: keep-alive",
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64)", "Cache-Control: no-cache",
+    "Accept-Encoding: gzip, deflate", "X-Request-Id: 5f0c8e2a9b7d4c31"
+  };
+  MSize n = 0;
+  while (n < len - 4) {
+    const char *h = hdr[rand() % 7];
+    while (*h && n < len - 4) s[n++] = *h++;
+    if (n < len - 5) { s[n++] = '\r'; s[n++] = '\n'; }
+  }
+  bench_tail(s, len, "\r\n\r\n");
+}
+
+/* Words of English text, the searched word is at the end. */
+static void bench_fill_text(char *s, MSize len)
+{
+  static const char *const word[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was",
+    "with", "be", "by", "on", "not", "this", "string", "search", "buffer"
+  };
+  MSize n = 0;
+  while (n < len - 7) {
+    const char *w = word[rand() % 20];
+    while (*w && n < len - 7) s[n++] = *w++;
+    if (n < len - 7) s[n++] = ' ';
+  }
+  bench_tail(s, len, "strings");
+}
+
+/* JSON objects, the searched key is in the last one. */
+static void bench_fill_json(char *s, MSize len)
+{
+  MSize n = 0;
+  while (n < len - 16) {
+    int k = snprintf(s + n, len - 16 - n, "{\"id\":%d,\"v\":\"%c\"},",
+		     rand() % 100000, 'a' + rand() % 26);
+    if (k <= 0 || (MSize)k >= len - 16 - n) break;
+    n += (MSize)k;
+  }
+  while (n < len) s[n++] = ' ';
+  bench_tail(s, len, "{\"name\":\"x\"}]");
+}
+
+/* Random letters, the first byte of the pattern is rare. */
+static void bench_fill_rare(char *s, MSize len)
+{
+  MSize n;
+  for (n = 0; n < len; n++) s[n] = (char)('a' + rand() % 26);
+  for (n = 0; n < 16; n++) s[rand() % (len - 6)] = 'Z';
+  bench_tail(s, len, "Zebra!");
+}
+
+static const BenchFind bench_finds[] = {
+  { "http", "\r\n\r\n", bench_fill_http },
+  { "text", "strings", bench_fill_text },
+  { "json", "\"name\":", bench_fill_json },
+  { "rare", "Zebra", bench_fill_rare }
+};
+
+static const char *find_s, *find_p;
+static MSize find_plen;
+
+#define BENCH_FIND(name, kernel) \
+  static uint32_t name(uint32_t n) \
+  { \
+    uint32_t i, x = 0; \
+    for (i = 0; i < n; i++) \
+      x += (uint32_t)(kernel(find_s, find_p, FINDSIZE, find_plen) - find_s); \
+    return x; \
+  }
+
+BENCH_FIND(bench_find_scalar, lj_strfind_scalar)
+#if LJ_STRCMP_SIMD
+BENCH_FIND(bench_find_simd, lj_strfind_simd)
+#endif
+
+/* Print the ns per call of a kernel. */
+static void bench_run(uint32_t (*f)(uint32_t), uint32_t n)
+{
+  double t;
+  bench_sink += f(NSTR);  /* Warm up. */
+  t = bench_time();
+  bench_sink += f(n);
+  printf(" %9.2f", (bench_time() - t) / n);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t calls = argc > 1 ? (uint32_t)atol(argv[1]) : 1u << 22;
+  int hascrc32 = 0;
+  size_t i;
+#if LJ_STRHASH_CRC32
+  hascrc32 = lj_str_hascrc32();
+#endif
+  printf("%-8s %7s %9s %9s %9s %9s   (ns per call)\n", "LENGTHS", "AVG",
+	 "hash", "crc32", "cmp", "simd");
+  for (i = 0; i < sizeof(bench_dists)/sizeof(bench_dists[0]); i++) {
+    const BenchDist *d = &bench_dists[i];
+    /* Room for the strings, the alignment and the innocuous over-reads. */
+    size_t sz = (size_t)NSTR * (d->maxlen + 8) + LJ_STRCMP_OVERREAD;
+    char *a = (char *)calloc(sz, 1), *b = (char *)calloc(sz, 1);
+    double avg;
+    uint32_t n;
+    if (!a || !b) {
+      fprintf(stderr, "strbench: not enough memory\n");
+      return 1;
+    }
+    avg = bench_fill(a, b, d);
+    /* Keep the number of hashed bytes roughly the same. */
+    n = (uint32_t)(calls * 32.0 / (avg > 32 ? avg : 32));
+    if (n < NSTR) n = NSTR;
+    printf("%-8s %7.1f", d->name, avg);
+    if (d->minlen >= 12) {  /* The full hash needs 12 bytes. */
+      bench_run(bench_hash_scalar, n);
+#if LJ_STRHASH_CRC32
+      if (hascrc32)
+	bench_run(bench_hash_crc32, n);
+      else
+#endif
+	printf(" %9s", "-");
+    } else {
+      printf(" %9s %9s", "-", "-");
+    }
+    bench_run(bench_cmp_scalar, n);
+#if LJ_STRCMP_SIMD
+    bench_run(bench_cmp_simd, n);
+#else
+    printf(" %9s", "-");
+#endif
+    printf("\n");
+    free(a);
+    free(b);
+  }
+  printf("\n%-8s %7s %9s %9s   (ns per call)\n", "FIND", "SIZE",
+	 "scalar", "simd");
+  for (i = 0; i < sizeof(bench_finds)/sizeof(bench_finds[0]); i++) {
+    const BenchFind *f = &bench_finds[i];
+    char *s = (char *)malloc(FINDSIZE);
+    uint32_t n = calls / (FINDSIZE / 32);
+    if (!s) {
+      fprintf(stderr, "strbench: not enough memory\n");
+      return 1;
+    }
+    f->fill(s, FINDSIZE);
+    find_s = s; find_p = f->pat; find_plen = (MSize)strlen(f->pat);
+    if (n == 0) n = 1;
+    printf("%-8s %7d", f->name, FINDSIZE);
+    bench_run(bench_find_scalar, n);
+#if LJ_STRCMP_SIMD
+    bench_run(bench_find_simd, n);
+#else
+    printf(" %9s", "-");
+#endif
+    printf("\n");
+    free(s);
+  }
+  return 0;
+}
@@ -0,0 +1,18 @@
+#!/usr/bin/env tarantool
+
+local path = arg[0]:gsub('%.test%.lua', '')
+local suffix = package.cpath:match('?.(%a+);')
+package.cpath = ('%s/?.%s;'):format(path, suffix)..package.cpath
+
+local tap = require('tap')
+
+local test = tap.test("alloc-slab")
+test:plan(3)
+
+local slab = require("testslab")
+
+test:ok(slab.reuse(), "a freed block is reused")
+test:ok(slab.resize(), "contents are kept across size classes")
+test:ok(slab.fullpage(1000), "full pages are freed and reused")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Must match SLAB_PAGE in lj_alloc.c. */
+#define SLAB_PAGE	(16 * 1024)
+
+#define pageof(p)	((uintptr_t)(p) & ~(uintptr_t)(SLAB_PAGE - 1))
+
+#define MAXBLOCKS	1024
+
+/* The allocator is called the way lua_getallocf() users may do it: the
+ * old size is always 0. The allocator has to find out by itself whether
+ * a block comes from a slab page or from the regular heap.
+ */
+
+/* A freed block is handed out again for the same size class. */
+static int reuse(lua_State *L)
+{
+	void *ud;
+	lua_Alloc f = lua_getallocf(L, &ud);
+	void *p = f(ud, NULL, 0, 40);
+	void *q;
+	assert(p != NULL);
+	f(ud, p, 0, 0);
+	q = f(ud, NULL, 0, 33);
+	assert(q != NULL);
+	f(ud, q, 0, 0);
+	lua_pushboolean(L, p == q);
+	return 1;
+}
+
+/* The contents are kept when a block moves between size classes and
+ * between a slab page and the regular heap.
+ */
+static int resize(lua_State *L)
+{
+	static const size_t sizes[] = {8, 100, 256, 257, 4000, 24, 200, 8};
+	char ref[4000];
+	void *ud;
+	lua_Alloc f = lua_getallocf(L, &ud);
+	size_t i, len = sizes[0];
+	int ok = 1;
+	char *p = f(ud, NULL, 0, len);
+	assert(p != NULL);
+	for (i = 0; i < sizeof(ref); i++)
+		ref[i] = (char)(i * 7 + 1);
+	memcpy(p, ref, len);
+	for (i = 1; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size_t nlen = sizes[i];
+		p = f(ud, p, 0, nlen);
+		assert(p != NULL);
+		ok = ok && memcmp(p, ref, len < nlen ? len : nlen) == 0;
+		memcpy(p, ref, nlen);
+		len = nlen;
+	}
+	f(ud, p, 0, 0);
+	lua_pushboolean(L, ok);
+	return 1;
+}
+
+/* Fill several pages with blocks of one size class, free all of them and
+ * allocate them again. The emptied pages are reused.
+ */
+static int fullpage(lua_State *L)
+{
+	static char *blocks[MAXBLOCKS];
+	static uintptr_t pages[MAXBLOCKS];
+	void *ud;
+	lua_Alloc f = lua_getallocf(L, &ud);
+	int n = (int)luaL_checkinteger(L, 1);
+	int i, j, npages = 0, ok = 1;
+	assert(n <= MAXBLOCKS);
+	for (i = 0; i < n; i++) {
+		blocks[i] = f(ud, NULL, 0, 248);
+		assert(blocks[i] != NULL);
+		memset(blocks[i], i & 0xff, 248);
+	}
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 248; j++)
+			ok = ok && blocks[i][j] == (char)(i & 0xff);
+		for (j = 0; j < npages; j++)
+			if (pages[j] == pageof(blocks[i]))
+				break;
+		if (j == npages)
+			pages[npages++] = pageof(blocks[i]);
+		f(ud, blocks[i], 0, 0);
+	}
+	for (i = 0; i < n; i++) {
+		blocks[i] = f(ud, NULL, 0, 248);
+		assert(blocks[i] != NULL);
+		memset(blocks[i], 0, 248);
+		for (j = 0; j < npages; j++)
+			if (pages[j] == pageof(blocks[i]))
+				break;
+		ok = ok && j < npages;
+	}
+	for (i = 0; i < n; i++)
+		f(ud, blocks[i], 0, 0);
+	lua_pushboolean(L, ok && npages > 2);
+	return 1;
+}
+
+static const struct luaL_Reg testslab[] = {
+	{"reuse", reuse},
+	{"resize", resize},
+	{"fullpage", fullpage},
+	{NULL, NULL}
+};
+
+LUA_API int luaopen_testslab(lua_State *L)
+{
+	luaL_register(L, "testslab", testslab);
+	return 1;
+}
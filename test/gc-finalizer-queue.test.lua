@@ -0,0 +1,59 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+local ffi = require('ffi')
+
+local test = tap.test("gc-finalizer-queue")
+test:plan(9)
+
+local ran = 0
+local function fin() ran = ran + 1 end
+
+local function garbage(n)
+  for _ = 1, n do ffi.gc(ffi.new("int[1]"), fin) end
+end
+
+-- Finish the current GC cycle and run the next one by steps only.
+local function cycle()
+  repeat until collectgarbage("step", 0)
+  repeat until collectgarbage("step", 0)
+end
+
+collectgarbage()
+test:is(collectgarbage("setfinbatch", 0), 16, "default batch size")
+local old = misc.getmetrics()
+garbage(100)
+cycle()
+test:is(ran, 0, "GC steps don't run finalizers")
+test:is(misc.getmetrics().gc_finalize_queue, 100, "finalizers are queued")
+test:is(collectgarbage("finalize", 10), 90, "drain a part of the queue")
+test:is(ran, 10, "only a part is finalized")
+test:is(collectgarbage("finalize"), 0, "drain the whole queue")
+local new = misc.getmetrics()
+test:is(new.gc_finalized - old.gc_finalized, 100, "finalizers are counted")
+
+-- Queued objects and their references survive the following cycles.
+local sum = 0
+local function proxies(n)
+  for i = 1, n do
+    local ref = {i}
+    getmetatable(newproxy(true)).__gc = function() sum = sum + ref[1] end
+  end
+end
+proxies(100)
+cycle()
+cycle()
+cycle()
+collectgarbage("finalize")
+test:is(sum, 5050, "queued objects are kept alive")
+
+-- Bounded batches are run by the GC steps, a full GC runs all of them.
+collectgarbage("setfinbatch", 5)
+ran = 0
+garbage(100)
+cycle()
+collectgarbage()
+test:is(ran, 100, "all finalizers are run")
+collectgarbage("setfinbatch", 16)
+
+os.exit(test:check() and 0 or 1)
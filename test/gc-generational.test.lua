@@ -0,0 +1,53 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("gc-generational")
+test:plan(7)
+
+-- Switching the collector kind returns the name of the previous one.
+test:is(collectgarbage("generational"), "incremental", "enter generational")
+test:is(collectgarbage("generational"), "generational", "stay generational")
+
+-- Allocate enough to run a few minor cycles.
+local function churn()
+  local ring = {}
+  for i = 1, 1e5 do ring[i % 100 + 1] = {i} end
+end
+
+-- Old objects survive minor cycles, even when new objects are stored into
+-- them (the write barriers must keep the new objects alive).
+local old = {}
+for i = 1, 1e4 do old[i] = {i} end
+local getuv, setuv
+do
+  local uv = {}
+  getuv = function() return uv end
+  setuv = function(v) uv = v end
+end
+collectgarbage()
+for i = 1, 1e4 do old[i][2] = {tostring(i)} end
+setuv({"upvalue"})
+churn()
+local ok = true
+for i = 1, 1e4 do
+  if old[i][1] ~= i or old[i][2][1] ~= tostring(i) then ok = false end
+end
+test:ok(ok, "old objects and their new references survive")
+test:is(getuv()[1], "upvalue", "new value of an old upvalue survives")
+
+-- Young garbage is collected by minor cycles.
+local weak = setmetatable({}, {__mode = "k"})
+weak[{}] = true
+churn()
+test:is(next(weak), nil, "young garbage is collected")
+
+-- Old garbage is collected by a full (major) cycle.
+weak[old] = true
+old = nil
+collectgarbage()
+test:is(next(weak), nil, "old garbage is collected")
+
+test:is(collectgarbage("incremental"), "generational", "leave generational")
+
+os.exit(test:check() and 0 or 1)
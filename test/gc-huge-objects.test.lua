@@ -0,0 +1,71 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("gc-huge-objects")
+test:plan(4)
+
+-- Huge tables and stacks are marked in chunks. Objects stored into the
+-- parts already marked must survive, even when the slots are moved around
+-- by a resize.
+local N = 1e5
+local t = {}
+for i = 1, N do t[i] = true; t["k"..i] = true end
+
+local function step_all(f)
+  collectgarbage()
+  collectgarbage("stop")
+  local i = 0
+  repeat
+    i = i + 1
+    f(i)
+  until collectgarbage("step", 0)
+  collectgarbage("restart")
+end
+
+step_all(function(i)
+  local j = i % N + 1
+  t[j] = {j}
+  t["k"..j] = {j}
+end)
+collectgarbage()
+local ok = true
+for i = 1, N do
+  if t[i] ~= true and t[i][1] ~= i then ok = false end
+  if t["k"..i] ~= true and t["k"..i][1] ~= i then ok = false end
+end
+test:ok(ok, "new values in a huge table survive")
+
+step_all(function(i)
+  if i % 10 == 0 then t[#t + 1] = {#t + 1} end  -- Grow the array part.
+  if i % 10 == 5 then t["n"..i] = {i} end  -- Grow the hash part.
+end)
+collectgarbage()
+ok = true
+for k, v in pairs(t) do
+  if v ~= true and v[1] ~= k and "n"..v[1] ~= k and "k"..v[1] ~= k then
+    ok = false
+  end
+end
+test:ok(ok, "new values in a resized huge table survive")
+
+-- A coroutine with a huge stack.
+local co = coroutine.wrap(function(...)
+  local n = select("#", ...)
+  local args = {...}
+  coroutine.yield()
+  local s = 0
+  for i = 1, n do s = s + args[i][1] end
+  return n, s
+end)
+local args = {}
+for i = 1, 5000 do args[i] = {i} end
+co(unpack(args))
+args = nil
+step_all(function() end)
+collectgarbage()
+local n, s = co()
+test:is(n, 5000, "huge stack survives")
+test:is(s, 5000 * 5001 / 2, "values on a huge stack survive")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,61 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("gc-memory-limit")
+test:plan(8)
+
+-- Errors can't be raised on a trace, keep the heap growth in the
+-- interpreter to hit the limit deterministically.
+jit.off()
+
+collectgarbage()
+test:is(collectgarbage("setlimit", 16 * 1024), 0, "no limit by default")
+
+local keep = {}
+local ok, err = pcall(function()
+  for i = 1, 1e7 do keep[i] = {i} end
+end)
+local count = collectgarbage("count")
+-- Nothing can be allocated until the memory is released.
+keep = nil
+collectgarbage()
+test:ok(not ok and err == "not enough memory", "allocation over the limit")
+test:ok(count <= 16 * 1024, "the limit holds")
+local m = misc.getmetrics()
+test:ok(m.gc_limit_errors > 0 and m.gc_emergency > 0,
+        "emergency collections precede the error")
+
+-- Garbage is collected on reaching the soft limit instead of failing.
+ok = pcall(function()
+  local t = {}
+  for i = 1, 100 do
+    local x = {}
+    for j = 1, 1e4 do x[j] = {j} end
+    t[i % 3 + 1] = x
+  end
+end)
+test:ok(ok, "churn below the limit")
+
+ok, err = pcall(string.rep, "x", 32 * 1024 * 1024)
+test:ok(not ok and err == "not enough memory", "huge string over the limit")
+
+test:is(collectgarbage("setlimit", 0), 16 * 1024, "limit removed")
+
+-- The garbage found by the last mark phase is freed before failing.
+collectgarbage()
+collectgarbage("stop")
+local garbage = {}
+for i = 1, 2e5 do garbage[i] = {i} end
+garbage = nil
+local atomic = misc.getmetrics().gc_steps_atomic
+repeat
+  collectgarbage("step", 0)
+until misc.getmetrics().gc_steps_atomic > atomic
+collectgarbage("setlimit", math.floor(collectgarbage("count")) + 1024)
+ok = pcall(string.rep, "x", 2 * 1024 * 1024)
+collectgarbage("setlimit", 0)
+collectgarbage("restart")
+test:ok(ok, "the sweep phase is finished on reaching the limit")
+
+os.exit(test:check() and 0 or 1)
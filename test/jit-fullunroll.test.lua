@@ -0,0 +1,63 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+local jutil = require('jit.util')
+local vmdef = require('jit.vmdef')
+
+local test = tap.test("jit-fullunroll")
+test:plan(6)
+
+local function f(n)
+  local out, acc = {}, 0
+  for i = 1, n do
+    for j = 1, 4 do
+      if i % 13 == j then break end
+      acc = acc + i * j
+      out[#out + 1] = j
+    end
+  end
+  return acc .. ":" .. table.concat(out)
+end
+
+local inner = jutil.funcinfo(f).linedefined + 3
+
+-- Runs f compiled with the given parameters. Returns whether the result
+-- matches the interpreter, whether a root trace was formed for the inner
+-- loop and how often its recording was left to the outer loop.
+local function run(ref, ...)
+  local innertrace, louter, start = false, 0, nil
+  jit.attach(function(what, _, func, pc, otr)
+    if what == "start" then
+      start = not otr and func == f and jutil.funcinfo(func, pc).currentline
+    elseif what == "stop" and start == inner then
+      innertrace = true
+    elseif what == "abort" and vmdef.traceerr[otr] ==
+           "short loop left to outer trace" then
+      louter = louter + 1
+    end
+  end, "trace")
+  jit.flush()
+  jit.opt.start("hotloop=1", ...)
+  local res = f(300)
+  jit.attach(function() end)
+  jit.opt.start("fullunroll=16", "unrollins=400")
+  return res == ref, innertrace, louter
+end
+
+jit.off(f)
+local ref = f(300)
+jit.on(f)
+
+local ok, innertrace, louter = run(ref)
+test:ok(ok, "fully unrolled loop with break")
+test:ok(not innertrace and louter > 0, "inner loop left to outer trace")
+
+ok, innertrace, louter = run(ref, "fullunroll=3")
+test:ok(ok, "trip count above fullunroll")
+test:ok(innertrace and louter == 0, "inner loop traced with fullunroll=3")
+
+ok, innertrace = run(ref, "unrollins=10")
+test:ok(ok, "loop body above unrollins")
+test:ok(innertrace, "inner loop traced with unrollins=10")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,80 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("jit-intdiv-const")
+test:plan(4)
+
+jit.opt.start("hotloop=1")
+
+local divisors = {
+  1, -1, 2, -2, 3, -3, 5, 7, -7, 10, 16, -16, 100, 641, 1000, 65537,
+  2^30, -2^30, 2^31-1, -2^31,
+}
+
+-- Integer dividends: the loop index, and values loaded from a table.
+local ranges = {
+  {-2^31, -2^31+70}, {-70, 70}, {2^31-71, 2^31-1},
+}
+local values = {-2^31, -2^31+1, -1234567, -641, -1, 0, 1, 641, 1234567,
+                2^31-2, 2^31-1}
+
+-- Compile a function applying the expression to all dividends. k is
+-- substituted as a constant, so the divisor is known to the compiler.
+local function gen(expr, k)
+  expr = expr:gsub("K", ("(%.17g)"):format(k))
+  return assert(load(([[
+    local ranges, values = ...
+    return function()
+      local r = {}
+      for j = 1, #ranges do
+        for i = ranges[j][1], ranges[j][2] do
+          r[#r+1] = %s
+        end
+      end
+      for j = 1, #values do
+        local i = values[j]
+        r[#r+1] = %s
+      end
+      return r
+    end
+  ]]):format(expr, expr)))(ranges, values)
+end
+
+-- Also tells -0 from 0.
+local function same(a, b)
+  return a == b and 1/a == 1/b or a ~= a and b ~= b
+end
+
+local function check(expr, ks)
+  local bad = {}
+  for _, k in ipairs(ks) do
+    local f = gen(expr, k)
+    jit.off(f)
+    local ref = f()
+    jit.on(f)
+    local res = f()
+    res = f()  -- Run the compiled side traces as well.
+    for j = 1, #ref do
+      if not same(res[j], ref[j]) then
+        bad[#bad+1] = ("%s, K = %s: %s ~= %s"):format(expr, k, res[j], ref[j])
+        break
+      end
+    end
+  end
+  return table.concat(bad, "; ")
+end
+
+local pow2 = {}
+for i = 1, 30 do pow2[#pow2+1] = 2^i end
+
+test:is(check("i % K", divisors), "", "modulo")
+test:is(check("math.floor(i / K)", divisors), "", "floor division")
+test:is(check("math.floor(i / K)", pow2), "", "floor division by 2^k")
+-- x / 2^k is turned into x * 2^-k first.
+test:is(check("math.floor(i * K)", {0.5, 0.25, 2^-10, 2^-30, 0.1, 1/3}), "",
+        "floor of a multiplication by 2^-k")
+
+jit.opt.start("hotloop=56")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,92 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("jit-mcode-pool")
+test:plan(5)
+
+-- Each function gets its own trace with a distinct constant.
+local function gen(k)
+  return assert(load(([[
+    return function(n)
+      local a, b = 0, %d
+      for i = 1, n do
+        a = a + i * b
+        b = (b + a) %% 1000003
+      end
+      return a + b
+    end
+  ]]):format(k)))()
+end
+
+local function mcode_size()
+  return misc.getmetrics().jit_mcode_size
+end
+
+-- Compile new functions until the mcode areas exceed lim bytes.
+local function fill(lim, from)
+  local ok, k = true, from
+  while mcode_size() <= lim and k < from + 20000 do
+    local f = gen(k)
+    local ref = f(100)
+    jit.off(f)
+    local r = f(100)
+    jit.on(f)
+    ok = ok and r == ref
+    k = k + 1
+  end
+  return ok, k
+end
+
+jit.flush()
+jit.opt.start("hotloop=1", "sizemcode=64", "maxmcode=64")
+gen(0)(100)
+test:ok(mcode_size() > 0, "first area allocated")
+
+-- The pool, if any, is sized by the old maxmcode. A larger area than
+-- that is allocated outside the pool.
+jit.opt.start("sizemcode=4096", "maxmcode=8192")
+local ok, k = fill(64 * 1024, 1)
+test:ok(ok and mcode_size() > 64 * 1024, "area beyond the pool")
+
+-- All areas are released on flush, both from the pool and outside of it.
+jit.flush()
+test:is(mcode_size(), 0, "flush releases all areas")
+
+jit.opt.start("sizemcode=64")
+ok = fill(64 * 1024, k)
+test:ok(ok and mcode_size() > 64 * 1024, "areas after flush")
+
+-- Side traces patch their parents in older areas, while the pool, if
+-- any, changes its protection as a whole.
+local function branchy(k)
+  return assert(load(([[
+    return function(n, m)
+      local a = %d
+      for i = 1, n do
+        if i > m then a = a + 2 * i else a = a + i end
+      end
+      return a
+    end
+  ]]):format(k)))()
+end
+jit.flush()
+jit.opt.start("hotexit=1", "sizemcode=16")
+local funcs = {}
+for i = 1, 100 do
+  funcs[i] = branchy(i)
+  funcs[i](100, 100)
+end
+ok = true
+for i = 1, 100 do
+  local f = funcs[i]
+  local r = f(100, 50)
+  r = f(100, 50)
+  jit.off(f)
+  ok = ok and r == f(100, 50)
+end
+test:ok(ok, "side traces of traces in older areas")
+
+jit.opt.start("hotloop=56", "hotexit=10", "sizemcode=64", "maxmcode=512")
+
+os.exit(test:check() and 0 or 1)
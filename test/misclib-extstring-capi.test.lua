@@ -0,0 +1,62 @@
+#!/usr/bin/env tarantool
+
+local path = arg[0]:gsub('%.test%.lua', '')
+local suffix = package.cpath:match('?.(%a+);')
+package.cpath = ('%s/?.%s;'):format(path, suffix)..package.cpath
+
+local tap = require('tap')
+
+local test = tap.test("clib-misc-extstring")
+test:plan(12)
+
+local ext = require("testextstring")
+
+local payload = ("x"):rep(4096)
+
+collectgarbage()
+local released = ext.released()
+local m0 = misc.getmetrics()
+local s, shared = ext.push(payload, "!")
+local m1 = misc.getmetrics()
+test:ok(shared, "the data is not copied")
+test:is(ext.released(), released, "the data is held by the string")
+test:ok(s == payload.."!", "the string is interned")
+test:is(#s, 4097, "length")
+
+local t = {[s] = true}
+test:ok(t[payload.."!"], "used as a table key")
+
+local s2, shared2 = ext.push(s)
+test:ok(not shared2 and s2 == s and ext.released() == released + 1,
+        "the data of an interned string is released right away")
+
+s, s2, t = nil, nil, nil
+collectgarbage()
+collectgarbage()
+test:is(ext.released(), released + 2, "the data is released on collection")
+local m2 = misc.getmetrics()
+test:ok(m1.gc_allocated - m0.gc_allocated > #payload and
+        m2.gc_freed - m1.gc_freed > #payload,
+        "the data is counted in gc_allocated and gc_freed")
+
+local e, eshared = ext.push("")
+test:ok(e == "" and not eshared and ext.released() == released + 3,
+        "empty string")
+
+-- Compares read up to 3 bytes past the terminating zero. The data is
+-- copied if they aren't mapped.
+released = ext.released()
+local head = ("y"):rep(2040)
+local p0, shared0 = ext.push_pageend(head.."abcdef", "z", 0)
+test:ok(not shared0 and ext.released() == released + 1 and
+        p0 == head.."abcdefz" and p0 < head.."abcdeg" and
+        head.."abcdeg" > p0, "the data is copied at a page end")
+local p3, shared3 = ext.push_pageend(head.."abc", "z", 3)
+test:ok(shared3 and ext.released() == released + 1 and
+        p3 == head.."abcz" and p3 < head.."abcz0" and head.."abd" > p3,
+        "the data is shared with 3 bytes after the terminator")
+p0, p3 = nil, nil
+
+test:ok(ext.close(), "the data is released on lua_close()")
+
+os.exit(test:check() and 0 or 1)
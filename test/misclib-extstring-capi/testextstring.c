@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <lmisclib.h>
+
+#undef NDEBUG
+#include <assert.h>
+
+/* The low 2GB keep the strings usable by VMs without GC64 on x64, too. */
+#ifdef MAP_32BIT
+#define EXT_MAPFLAGS	(MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT)
+#else
+#define EXT_MAPFLAGS	(MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+
+static int released;
+
+static void ext_release(void *ud, char *str, size_t len)
+{
+	uintptr_t mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+	char *p = (char *)((uintptr_t)(str - LUAM_EXTSTRHDR) & ~mask);
+	assert(ud == (void *)&released);
+	munmap(p, str + len + 1 - p);
+	released++;
+}
+
+/* Copy the data and the suffix to a new mapping and push them as an
+ * external string.
+ */
+static const char *ext_push(lua_State *L, const char *data, size_t len,
+			    const char *suffix, size_t slen, char **str)
+{
+	char *p = mmap(NULL, LUAM_EXTSTRHDR + len + slen + 1,
+		       PROT_READ | PROT_WRITE, EXT_MAPFLAGS, -1, 0);
+	if (p == MAP_FAILED)
+		luaL_error(L, "cannot map memory");
+	*str = p + LUAM_EXTSTRHDR;
+	memcpy(*str, data, len);
+	memcpy(*str + len, suffix, slen);
+	return luaM_pushextstring(L, *str, len + slen, ext_release, &released);
+}
+
+/* Push an external string with the concatenation of the arguments.
+ * Return it and whether its data is shared with the VM.
+ */
+static int push(lua_State *L)
+{
+	size_t len, slen;
+	const char *data = luaL_checklstring(L, 1, &len);
+	const char *suffix = luaL_optlstring(L, 2, "", &slen);
+	char *str;
+	const char *s = ext_push(L, data, len, suffix, slen, &str);
+	lua_pushboolean(L, s == str);
+	return 2;
+}
+
+/* Push an external string with the concatenation of the first two
+ * arguments, so that only pad bytes after its terminating zero are
+ * mapped. Return it and whether its data is shared with the VM.
+ */
+static int push_pageend(lua_State *L)
+{
+	size_t len, slen, pgsz = (size_t)sysconf(_SC_PAGESIZE);
+	const char *data = luaL_checklstring(L, 1, &len);
+	const char *suffix = luaL_checklstring(L, 2, &slen);
+	size_t pad = (size_t)luaL_checkinteger(L, 3);
+	size_t size = (LUAM_EXTSTRHDR + len + slen + 1 + pad + pgsz - 1) &
+		      ~(pgsz - 1);
+	char *p = mmap(NULL, size + pgsz, PROT_READ | PROT_WRITE, EXT_MAPFLAGS,
+		       -1, 0);
+	char *str;
+	const char *s;
+	if (p == MAP_FAILED)
+		luaL_error(L, "cannot map memory");
+	munmap(p + size, pgsz);
+	str = p + size - pad - 1 - slen - len;
+	assert(((uintptr_t)str & 7) == 0 && str - LUAM_EXTSTRHDR >= p);
+	memcpy(str, data, len);
+	memcpy(str + len, suffix, slen);
+	s = luaM_pushextstring(L, str, len + slen, ext_release, &released);
+	lua_pushboolean(L, s == str);
+	return 2;
+}
+
+static int nreleased(lua_State *L)
+{
+	lua_pushinteger(L, released);
+	return 1;
+}
+
+/* The data of the external strings is released on lua_close(). */
+static int close_state(lua_State *L)
+{
+	lua_State *L1 = luaL_newstate();
+	int n = released;
+	char *str;
+	if (L1 == NULL)
+		luaL_error(L, "cannot create a state");
+	ext_push(L1, "external string", 15, " on close", 9, &str);
+	lua_setglobal(L1, "s");
+	assert(released == n);
+	lua_close(L1);
+	lua_pushboolean(L, released == n + 1);
+	return 1;
+}
+
+static const struct luaL_Reg testextstring[] = {
+	{"push", push},
+	{"push_pageend", push_pageend},
+	{"released", nreleased},
+	{"close", close_state},
+	{NULL, NULL}
+};
+
+LUA_API int luaopen_testextstring(lua_State *L)
+{
+	luaL_register(L, "testextstring", testextstring);
+	return 1;
+}
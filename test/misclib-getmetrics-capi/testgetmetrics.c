@@ -32,9 +32,25 @@ static int base(lua_State *L)
 	(void)metrics.gc_steps_sweep;
 	(void)metrics.gc_steps_finalize;
 
+	(void)metrics.gc_pause_hist;
+	(void)metrics.gc_atomic_ns;
+	(void)metrics.gc_atomic_max_ns;
+
+	(void)metrics.gc_limit;
+	(void)metrics.gc_limit_errors;
+	(void)metrics.gc_emergency;
+
+	(void)metrics.gc_finalize_queue;
+	(void)metrics.gc_finalized;
+	(void)metrics.gc_finalize_ns;
+
+	(void)metrics.patcache_hit;
+	(void)metrics.patcache_miss;
+
 	(void)metrics.jit_snap_restore;
 	(void)metrics.jit_trace_abort;
 	(void)metrics.jit_mcode_size;
+	(void)metrics.jit_snap_size;
 	(void)metrics.jit_trace_num;
 
 	lua_pushboolean(L, 1);
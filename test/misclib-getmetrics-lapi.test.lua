@@ -7,7 +7,7 @@
 local tap = require('tap')
 
 local test = tap.test("lib-misc-getmetrics")
-test:plan(10)
+test:plan(15)
 
 local jit_opt_default = {
     3, -- level
@@ -18,7 +18,7 @@ local jit_opt_default = {
 
 -- Test Lua API.
 test:test("base", function(subtest)
-    subtest:plan(19)
+    subtest:plan(31)
     local metrics = misc.getmetrics()
     subtest:ok(metrics.strhash_hit >= 0)
     subtest:ok(metrics.strhash_miss >= 0)
@@ -39,9 +39,25 @@ test:test("base", function(subtest)
     subtest:ok(metrics.gc_steps_sweep >= 0)
     subtest:ok(metrics.gc_steps_finalize >= 0)
 
+    subtest:ok(type(metrics.gc_pause_hist) == "table")
+    subtest:ok(metrics.gc_atomic_ns >= 0)
+    subtest:ok(metrics.gc_atomic_max_ns >= 0)
+
+    subtest:ok(metrics.gc_limit >= 0)
+    subtest:ok(metrics.gc_limit_errors >= 0)
+    subtest:ok(metrics.gc_emergency >= 0)
+
+    subtest:ok(metrics.gc_finalize_queue >= 0)
+    subtest:ok(metrics.gc_finalized >= 0)
+    subtest:ok(metrics.gc_finalize_ns >= 0)
+
+    subtest:ok(metrics.patcache_hit >= 0)
+    subtest:ok(metrics.patcache_miss >= 0)
+
     subtest:ok(metrics.jit_snap_restore >= 0)
     subtest:ok(metrics.jit_trace_abort >= 0)
     subtest:ok(metrics.jit_mcode_size >= 0)
+    subtest:ok(metrics.jit_snap_size >= 0)
     subtest:ok(metrics.jit_trace_num >= 0)
 end)
 
@@ -171,6 +187,50 @@ test:test("gc-steps", function(subtest)
     subtest:is(newm.gc_steps_finalize, 0)
 end)
 
+test:test("gc-pause-hist", function(subtest)
+    subtest:plan(3)
+
+    local function nsteps(m)
+        local n = 0
+        for _, cnt in ipairs(m.gc_pause_hist) do n = n + cnt end
+        return n
+    end
+
+    local oldm = misc.getmetrics()
+    subtest:is(#oldm.gc_pause_hist, 20)
+    -- Only every 16th step is timed without a time budget.
+    for _ = 1, 16 do collectgarbage("step") end
+    local newm = misc.getmetrics()
+    subtest:ok(nsteps(newm) > nsteps(oldm), "incremental steps are timed")
+
+    -- The time budget is reported back when changed.
+    local old = collectgarbage("setbudget", 200)
+    subtest:is(collectgarbage("setbudget", old), 200)
+end)
+
+test:test("gc-atomic-time", function(subtest)
+    subtest:plan(3)
+
+    collectgarbage("collect")
+    local oldm = misc.getmetrics()
+    subtest:ok(oldm.gc_atomic_ns > 0)
+    subtest:ok(oldm.gc_atomic_max_ns <= oldm.gc_atomic_ns)
+    collectgarbage("collect")
+    local newm = misc.getmetrics()
+    subtest:ok(newm.gc_atomic_ns > oldm.gc_atomic_ns)
+end)
+
+test:test("gc-limit", function(subtest)
+    subtest:plan(3)
+
+    subtest:is(misc.getmetrics().gc_limit, 0)
+    collectgarbage("setlimit", 64 * 1024)
+    local m = misc.getmetrics()
+    collectgarbage("setlimit", 0)
+    subtest:is(m.gc_limit, 64 * 1024 * 1024)
+    subtest:is(misc.getmetrics().gc_limit, 0)
+end)
+
 test:test("objcount", function(subtest)
     subtest:plan(4)
     local ffi = require("ffi")
@@ -219,12 +279,13 @@ test:test("objcount", function(subtest)
     -- Check that amount of objects not increased.
     subtest:is(new_metrics.gc_strnum, old_metrics.gc_strnum,
                "strnum don't change")
-    -- When we call getmetrics, we create table for metrics first.
-    -- So, when we save old_metrics there are x + 1 tables,
-    -- when we save new_metrics there are x + 2 tables, because
-    -- old table hasn't been collected yet (it is still
+    -- When we call getmetrics, we create table for metrics first
+    -- and then the table with the GC pause histogram.
+    -- So, when we save old_metrics there are x + 2 tables,
+    -- when we save new_metrics there are x + 4 tables, because
+    -- old tables haven't been collected yet (they are still
     -- reachable).
-    subtest:is(new_metrics.gc_tabnum - old_metrics.gc_tabnum, 1,
+    subtest:is(new_metrics.gc_tabnum - old_metrics.gc_tabnum, 2,
                "tabnum don't change")
     subtest:is(new_metrics.gc_udatanum, old_metrics.gc_udatanum,
                "udatanum don't change")
@@ -362,26 +423,26 @@ test:test("strhash", function(subtest)
 
     local new_metrics = misc.getmetrics()
     -- Do not use test:ok to avoid extra strhash hits/misses.
-    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 19)
+    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 31)
     assert(new_metrics.strhash_miss - old_metrics.strhash_miss == 0)
     old_metrics = new_metrics
 
     local str1  = "strhash".."_hit"
 
     new_metrics = misc.getmetrics()
-    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 20)
+    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 32)
     assert(new_metrics.strhash_miss - old_metrics.strhash_miss == 0)
     old_metrics = new_metrics
 
     new_metrics = misc.getmetrics()
-    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 19)
+    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 31)
     assert(new_metrics.strhash_miss - old_metrics.strhash_miss == 0)
     old_metrics = new_metrics
 
     local str2 = "new".."string"
 
     new_metrics = misc.getmetrics()
-    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 19)
+    assert(new_metrics.strhash_hit - old_metrics.strhash_hit == 31)
     assert(new_metrics.strhash_miss - old_metrics.strhash_miss == 1)
     subtest:ok(true, "no assertion failed")
 end)
@@ -409,4 +470,45 @@ test:test("tracenum-base", function(subtest)
     subtest:is(metrics.jit_trace_num, 0)
 end)
 
+test:test("snap-size", function(subtest)
+    subtest:plan(3)
+
+    jit.flush()
+    collectgarbage("collect")
+    local metrics = misc.getmetrics()
+    subtest:is(metrics.jit_snap_size, 0)
+
+    -- Each guard in the loop body takes a snapshot.
+    local t = {}
+    for i = 1, 100 do
+        t[i] = i % 3 == 0 and i or -i
+    end
+
+    metrics = misc.getmetrics()
+    subtest:ok(metrics.jit_snap_size > 0)
+
+    jit.flush()
+    collectgarbage("collect")
+
+    metrics = misc.getmetrics()
+    subtest:is(metrics.jit_snap_size, 0)
+end)
+
+test:test("patcache", function(subtest)
+    subtest:plan(3)
+
+    -- A new pattern is compiled on the first use only.
+    local pat = "pat" .. "cache%d+"
+    local old = misc.getmetrics()
+    string.find("patcache1", pat)
+    local new = misc.getmetrics()
+    subtest:is(new.patcache_miss - old.patcache_miss, 1)
+    subtest:is(new.patcache_hit - old.patcache_hit, 0)
+
+    old = new
+    string.find("patcache2", pat)
+    new = misc.getmetrics()
+    subtest:is(new.patcache_hit - old.patcache_hit, 1)
+end)
+
 os.exit(test:check() and 0 or 1)
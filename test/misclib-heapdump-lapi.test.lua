@@ -0,0 +1,63 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("misc-heapdump-lapi")
+test:plan(11)
+
+local heapdump = require("jit.heapdump")
+
+local fname = os.tmpname()
+
+-- The only reference to the elements is held by the table.
+local holder = {}
+for i = 1, 1000 do holder[i] = {i} end
+
+test:ok(misc.heapdump.start(fname), "start")
+local ok, err = misc.heapdump.start(fname)
+test:ok(not ok and err:match("already in progress"), "no second start")
+-- The heap is walked by the GC steps.
+for i = 1, 1000 do local _ = {i} end
+test:ok(misc.heapdump.finish(), "finish")
+ok, err = misc.heapdump.finish()
+test:ok(not ok and err:match("not in progress"), "no second finish")
+
+local h = heapdump.dominators(heapdump.parse(fname))
+local node
+for v = 1, h.n do
+  if h.typ[v] == 11 and h.size[v] >= 1000 * 8 and h.retained[v] then
+    if not node or h.size[v] < h.size[node] then node = v end
+  end
+end
+test:ok(node, "the holder is dumped")
+local elems = 0
+for v = 1, h.n do
+  if h.idom[v] == node then elems = elems + 1 end
+end
+test:is(elems, 1000, "the holder dominates its elements")
+test:ok(h.retained[node] > h.size[node], "the holder retains its elements")
+
+-- Queued finalizers wait for the end of the heap walk. The objects
+-- finalized under the walk would be missing from the dump otherwise.
+local ran = 0
+collectgarbage()
+local finbatch = collectgarbage("setfinbatch", 0)
+for _ = 1, 100 do
+  getmetatable(newproxy(true)).__gc = function() ran = ran + 1 end
+end
+repeat until collectgarbage("step", 0)
+repeat until collectgarbage("step", 0)
+collectgarbage("setfinbatch", finbatch)
+misc.heapdump.start(fname)
+collectgarbage("step", 0)
+test:is(collectgarbage("finalize"), 100, "finalizers are held off")
+test:is(ran, 0, "no finalizer is run under the walk")
+misc.heapdump.finish()
+collectgarbage("finalize")
+test:is(ran, 100, "finalizers are run after the walk")
+os.remove(fname)
+
+ok, err = misc.heapdump.start("/nonexistent/heapdump.bin")
+test:ok(not ok and err:match("heapdump.bin"), "start fails on a bad path")
+
+os.exit(test:check() and 0 or 1)
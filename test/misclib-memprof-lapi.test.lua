@@ -0,0 +1,40 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("misc-memprof-lapi")
+test:plan(8)
+
+local memprof = require("jit.memprof")
+
+local fname = os.tmpname()
+
+local function payload()
+  local t = {}
+  for i = 1, 100 do t[i] = {i} end -- line 14
+  return t
+end
+
+jit.off(payload)
+
+test:ok(misc.memprof.start(fname), "start")
+local ok, err = misc.memprof.start(fname)
+test:is(ok, nil, "no second start")
+test:ok(err:match("already running"), "second start error message")
+payload()
+test:ok(misc.memprof.stop(), "stop")
+ok, err = misc.memprof.stop()
+test:ok(not ok and err:match("not running"), "no second stop")
+
+-- Every table from the payload loop is attributed to its line.
+local sources, total = memprof.parse(fname)
+local chunk = debug.getinfo(1, "S").source:sub(2)
+local src = sources[chunk..":14"]
+test:ok(src and src.alloc >= 100, "allocations are attributed to the line")
+test:ok(total.abytes >= src.abytes, "totals include the line")
+os.remove(fname)
+
+ok, err = misc.memprof.start("/nonexistent/memprof.bin")
+test:ok(not ok and err:match("memprof.bin"), "start fails on a bad path")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,82 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("misclib-numfmt")
+test:plan(9)
+
+test:is(misc.numfmt(), "%.14g", "default format")
+test:is(tostring(0.1 + 0.2), "0.3", "default is lossy")
+
+test:is(misc.numfmt("shortest"), "%.14g", "switch returns the old format")
+test:is(misc.numfmt(), "shortest", "query keeps the format")
+
+local cases = {
+  {0.1 + 0.2, "0.30000000000000004"},
+  {0.1, "0.1"},
+  {1/3, "0.3333333333333333"},
+  {-1.5, "-1.5"},
+  {100, "100"},
+  {2^53, "9007199254740992"},
+  {2^63, "9.223372036854776e+18"},
+  {1e16, "10000000000000000"},
+  {1e17, "1e+17"},
+  {1e21, "1e+21"},
+  {123456789012, "123456789012"},
+  {0.0001, "0.0001"},
+  {0.00001, "1e-05"},
+  {1.7976931348623157e308, "1.7976931348623157e+308"},
+  {5e-324, "5e-324"},
+  {2.2250738585072014e-308, "2.2250738585072014e-308"},
+  -- Exact ties round to an even last digit: ...554.25 and ...554.75.
+  {0x1.9564c97f27249p+50, "1782940346129554.2"},
+  {0x1.9564c97f2724bp+50, "1782940346129554.8"},
+  {-0.0, "-0"},
+  {1/0, "inf"},
+  {-1/0, "-inf"},
+}
+local function run_cases()
+  local bad = {}
+  for _, c in ipairs(cases) do
+    local s = tostring(c[1])
+    if s ~= c[2] then bad[#bad + 1] = c[2] .. " -> " .. s end
+  end
+  return table.concat(bad, "; ")
+end
+test:is(run_cases(), "", "shortest strings")
+
+-- Every conversion reads back to the same number.
+math.randomseed(42)
+local bad = 0
+for _ = 1, 20000 do
+  local x = math.random() * 10 ^ math.random(-30, 30)
+  if tonumber(tostring(x)) ~= x then bad = bad + 1 end
+  x = math.random(1, 100000) / math.random(1, 100000)
+  if tonumber(tostring(x)) ~= x then bad = bad + 1 end
+end
+test:is(bad, 0, "round-trip")
+
+test:is(("x" .. 0.1 + 0.2) .. table.concat({1/3, 2^53}, ","),
+        "x0.300000000000000040.3333333333333333,9007199254740992",
+        "concatenation")
+
+-- Traces constant-fold the conversion, so they must not keep the old
+-- format after a switch.
+local function f()
+  local s
+  for _ = 1, 100 do s = tostring(0.1 + 0.2) end
+  return s
+end
+misc.numfmt("%.14g")
+jit.flush()
+local s1 = f() .. f()
+misc.numfmt("shortest")
+local s2 = f() .. f()
+test:is(s1 .. " " .. s2, "0.30.3 0.300000000000000040.30000000000000004",
+        "JIT compiled conversion")
+
+misc.numfmt("%.14g")
+test:ok(tostring(0.1 + 0.2) == "0.3" and not pcall(misc.numfmt, "%g"),
+        "switch back, invalid format")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,49 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+local ffi = require('ffi')
+
+local test = tap.test("snap-restore-plan")
+test:plan(2)
+
+-- The exit below is taken over and over again, but never turns into a
+-- side trace. From the second exit on, it is restored by a plan. The
+-- constants it restores must survive full GC cycles in between.
+jit.opt.start("hotloop=1", "hotexit=100000")
+
+local flags = {}
+for i = 200, 2000, 3 do flags[i] = true end
+
+local function f(n)
+  local r = {}
+  for i = 1, n do
+    local c, d, s, e, t = 5LL, -1.5, "k", 2LL * 3, i % 2 == 0
+    r[#r + 1] = d
+    if flags[i] then
+      r[#r + 1] = tostring(c) .. s .. tostring(e) .. tostring(t)
+      -- Drop everything not referenced from the trace or the stack.
+      collectgarbage()
+      for _ = 1, 10 do local _ = ffi.new("int64_t[4]") end
+    end
+  end
+  return table.concat(r, ",")
+end
+
+jit.off(f)
+local ref = f(2000)
+jit.on(f)
+jit.flush()
+
+test:ok(f(2000) == ref, "same exit with GC in between")
+
+-- Run it again on different stacks, so stale slots don't keep the
+-- restored values alive.
+local ok = true
+for _ = 1, 4 do
+  local co = coroutine.wrap(function() return f(2000) end)
+  if co() ~= ref then ok = false end
+  collectgarbage()
+end
+test:ok(ok, "same exit in coroutines")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,98 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+local buffer = require('string.buffer')
+
+local test = tap.test("string-buffer")
+test:plan(8)
+
+local b = buffer.new()
+b:put("abc", 12, 1.5):putf("%d-%s", 3, "x")
+test:ok(b:tostring() == "abc121.53-x" and #b == 11 and
+        tostring(b) == "abc121.53-x", "put and putf")
+
+local s1, s2, s3 = b:get(2, 3, nil)
+test:ok(s1 == "ab" and s2 == "c12" and s3 == "1.53-x" and #b == 0 and
+        b:get() == "", "get")
+
+b:put("0123456789"):skip(4)
+local b2 = buffer.new(100):put("<")
+b2:put(b, b2):skip(1)
+test:ok(b:get(2) == "45" and b:tostring() == "6789" and
+        b2:tostring() == "456789<456789" and #b:reset() == 0,
+        "skip, put a buffer")
+
+-- The format is redone in full after a __tostring call.
+local mt = {__tostring = function(o)
+  b:putf("%d", o[1])
+  return "<" .. b:get() .. ">"
+end}
+b2:reset():put("["):putf("%s|%5.1f|%s", setmetatable({1}, mt), 2,
+                          setmetatable({2}, mt))
+test:is(b2:tostring(), "[<1>|  2.0|<2>", "putf with __tostring")
+
+local e = {}
+for _, f in ipairs({
+  function() b:get(-1) end,
+  function() b:skip() end,
+  function() b:put({}) end,
+  function() b:putf("%d", "x") end,
+  function() buffer.new(-1) end,
+  function() b.put(1) end,
+}) do
+  e[#e + 1] = select(2, pcall(f)):gsub("^.-: ", "")
+end
+test:is(table.concat(e, "; "),
+        "bad argument #1 to 'get' (index out of range); "..
+        "bad argument #1 to 'skip' (number expected, got no value); "..
+        "bad argument #1 to 'put' (string expected, got table); "..
+        "bad argument #2 to 'putf' (number expected, got string); "..
+        "bad argument #1 to 'new' (index out of range); "..
+        "bad argument #1 to 'put' (buffer expected, got number)", "errors")
+
+local ffi = require('ffi')
+b:reset()
+local p, n = b:reserve(10)
+ffi.copy(p, "frame", 5)
+b:commit(5):put("!")
+local q, m = b:ref()
+test:ok(n >= 10 and m == 6 and ffi.string(q, m) == "frame!" and
+        not pcall(b.commit, b, n), "reserve, commit and ref")
+
+-- The methods are compiled. A NYI fast function ends the trace with a
+-- stitch.
+local jutil = require('jit.util')
+local nyi = 0
+jit.attach(function(what, tr)
+  if what == "stop" and jutil.traceinfo(tr).linktype == "stitch" then
+    nyi = nyi + 1
+  end
+end, "trace")
+local function frames(n)
+  local buf = buffer.new()
+  local r = {}
+  for i = 1, n do
+    buf:put("k", i, ":"):putf("%d|%s;", i * 2, "v")
+    if i % 7 == 0 then
+      local a, c = buf:get(3, 2)
+      r[#r + 1] = a .. "/" .. c
+      buf:skip(1)
+      r[#r + 1] = buf:tostring()
+    end
+    if i % 50 == 0 then
+      r[#r + 1] = buf:get()
+      buf:reset()
+    end
+  end
+  return table.concat(r, "\n") .. buf:tostring()
+end
+jit.off(frames)
+local ref = frames(1000)
+jit.on(frames)
+jit.flush()
+local res = frames(1000)
+jit.attach(function() end)
+test:ok(res == ref, "compiled methods")
+test:is(nyi, 0, "no stitched traces")
+
+os.exit(test:check() and 0 or 1)
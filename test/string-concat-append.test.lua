@@ -0,0 +1,124 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("string-concat-append")
+test:plan(11)
+
+-- A trace appends to the result of the previous concatenation if it's
+-- the left operand of the next one. Run the checks with and without
+-- compiled code.
+local function build(n, piece)
+  local s = ""
+  for i = 1, n do s = s..piece..i end
+  return s
+end
+
+local function expected(n, piece)
+  local t = {}
+  for i = 1, n do t[i] = piece..i end
+  return table.concat(t)
+end
+
+jit.off(build)
+test:ok(build(3000, "abc") == expected(3000, "abc"), "appending in a loop")
+jit.on(build)
+test:ok(build(3000, "abc") == expected(3000, "abc"), "appending in a trace")
+
+-- A trace leaves the intermediate strings in the buffer. They are only
+-- created on a trace exit, in the interpreter or in a side trace.
+local function exits(n)
+  local s, lens = "", {}
+  for i = 1, n do
+    s = s..i..","
+    if i % 7 == 0 then lens[#lens + 1] = #s end
+    if i % 500 == 0 then collectgarbage() end
+  end
+  return s..table.concat(lens, ",")
+end
+local function fmt(n)
+  local s = ""
+  for i = 1, n do s = string.format("%s%d;", s, i) end
+  return s
+end
+local function keep(n)
+  local s, old = "", ""
+  for i = 1, n do
+    old = s
+    s = s..i
+    if i % 50 == 0 then s = old.."!" end
+  end
+  return s
+end
+-- A guard after the append still uses the snapshot taken before it.
+local function guard(n)
+  local s, t = "", {}
+  for i = 1, n do
+    s = s..i
+    t[i] = i
+  end
+  return s
+end
+jit.opt.start("hotloop=1", "hotexit=2")
+for _, c in ipairs({
+  { exits, "trace exits with a sunk string" },
+  { fmt, "string.format appending to a sunk string" },
+  { keep, "previous string still in use" },
+  { guard, "exit from a guard after the append" },
+}) do
+  local f = c[1]
+  jit.off(f)
+  local ref = f(2000)
+  jit.on(f)
+  jit.flush()
+  test:ok(f(2000) == ref and f(2000) == ref, c[2])
+end
+jit.opt.start("hotloop=56", "hotexit=10")
+
+-- Only the last result may be extended.
+local s = ("x"):rep(100)
+local a = s.."a"
+local b = s.."b"
+test:ok(a == ("x"):rep(100).."a" and b == ("x"):rep(100).."b",
+        "branching off the same string")
+
+-- A collection in between drops the buffered result.
+s = "q"
+for i = 1, 100 do
+  s = s..i
+  if i % 10 == 0 then collectgarbage() end
+end
+local t = { "q" }
+for i = 1, 100 do t[#t + 1] = i end
+test:ok(s == table.concat(t), "collections while appending")
+
+-- Two strings built at the same time.
+local c1 = coroutine.wrap(function()
+  local x = ""
+  for i = 1, 200 do x = x.."1"; coroutine.yield() end
+  return x
+end)
+local y = ""
+for _ = 1, 200 do c1(); y = y.."2" end
+test:ok(c1() == ("1"):rep(200) and y == ("2"):rep(200),
+        "interleaved concatenations")
+
+-- Numbers and metamethods on the right side.
+local mt = { __concat = function(l, r)
+  return (type(l) == "table" and "<T>" or l)..(type(r) == "table" and "<T>" or r)
+end }
+local obj = setmetatable({}, mt)
+s = "n"
+s = s..1 ..2.5
+s = s..obj
+s = s.."z"
+test:is(s, "n12.5<T>z", "numbers and __concat")
+
+-- The result is interned like any other string.
+local k = "key"
+k = k.."1"
+k = k.."2"
+local h = { key12 = true }
+test:ok(h[k], "appended strings are interned")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,63 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("string-find-plain")
+test:plan(4)
+
+-- Plain string.find() uses a SIMD search where the CPU has it. It must
+-- agree with a naive search for all lengths around the vector width.
+
+local function naive(s, p, init)
+  for i = init, #s - #p + 1 do
+    if s:sub(i, i + #p - 1) == p then return i end
+  end
+  return nil
+end
+
+-- A small alphabet makes the first and the last byte of the pattern
+-- frequent, so most candidates are false.
+local function rndstr(len, alphabet)
+  local t = {}
+  for i = 1, len do
+    local k = math.random(#alphabet)
+    t[i] = alphabet:sub(k, k)
+  end
+  return table.concat(t)
+end
+
+local function check(find)
+  local bad = 0
+  math.randomseed(42)
+  for slen = 0, 100 do
+    for _ = 1, 20 do
+      local s = rndstr(slen, "ab\r\n")
+      local plen = math.random(0, math.min(slen + 1, 40))
+      local p
+      if plen <= slen and math.random(2) == 1 then
+        local i = math.random(slen - plen + 1)
+        p = s:sub(i, i + plen - 1)  -- Known to be found.
+      else
+        p = rndstr(plen, "ab\r\n")
+      end
+      local init = math.random(1, math.max(slen, 1))
+      if find(s, p, init) ~= naive(s, p, init) then bad = bad + 1 end
+    end
+  end
+  return bad
+end
+
+jit.off()
+test:is(check(function(s, p, init) return (string.find(s, p, init, true)) end),
+        0, "interpreter")
+jit.on()
+jit.flush()
+test:is(check(function(s, p, init) return (string.find(s, p, init, true)) end),
+        0, "traces")
+
+-- A match in the last positions, after many false candidates.
+local s = ("\r\nab"):rep(5000).."\r\n\r\n"
+test:is(s:find("\r\n\r\n", 1, true), 20001, "end of HTTP headers")
+test:is(s:find("\r\n\r\n\r", 1, true), nil, "no match")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,85 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("string-format-cache")
+test:plan(6)
+
+-- Format strings are parsed on the first use and the parsed items are
+-- cached. The second run of each case uses the cached items.
+local t = {}
+local cases = {
+  {"", {}, ""},
+  {"plain", {}, "plain"},
+  {"%%", {}, "%"},
+  {"a%%b%%%dc", {42}, "a%b%42c"},
+  {"%s=%d\n", {"k", 7}, "k=7\n"},
+  {"[%5.2f|%-4s|%04x]", {3.14159, "x", 255}, "[ 3.14|x   |00ff]"},
+  {"%q", {"a\0b\n"}, "\"a\\0b\\\n\""},
+  {"%s %s %s %s", {nil, true, false, 1.5}, "nil true false 1.5"},
+  {"%.3s|%5s|%q", {12345, 1, 2}, "123|    1|\"2\""},
+  {"%s\0%s", {"a", "b"}, "a\0b"},
+  {"%s %p", {t, t}, string.format("table: %p %p", t, t)},
+}
+local function run_cases()
+  local bad = {}
+  for _, c in ipairs(cases) do
+    local r = string.format(c[1], unpack(c[2], 1, 4))
+    if r ~= c[3] then bad[#bad + 1] = c[1] .. " -> " .. r end
+  end
+  return table.concat(bad, "; ")
+end
+jit.off()
+test:is(run_cases(), "", "first use")
+test:is(run_cases(), "", "cached")
+jit.on()
+
+-- Errors must be raised in the same order as with a parse on each call.
+local function errs()
+  local r = {}
+  r[1] = select(2, pcall(string.format, "%d %y", "z"))
+  r[2] = select(2, pcall(string.format, "%d %y", 1))
+  r[3] = select(2, pcall(string.format, "%d %d", 1))
+  return table.concat(r, "; ")
+end
+local e = errs()
+test:ok(e:match("number expected") and e:match("invalid option '%%y'") and
+        e:match("bad argument #3") and errs() == e, "errors")
+
+-- __tostring using many other formats evicts the outer one.
+local mt = {__tostring = function(o)
+  for i = 1, 200 do string.format("%d" .. i, i) end
+  collectgarbage()
+  return "<" .. o[1] .. ">"
+end}
+test:is(string.format("%s|%5s|%d|%s", setmetatable({1}, mt), "ab", 3,
+                      setmetatable({2}, mt)), "<1>|   ab|3|<2>",
+        "__tostring with eviction")
+
+-- Non-string arguments of %s and %q and all arguments of %p are compiled.
+local jutil = require("jit.util")
+local nyi = 0
+jit.attach(function(what, tr)
+  if what == "stop" and jutil.traceinfo(tr).linktype == "stitch" then
+    nyi = nyi + 1  -- A NYI fast function ends the trace with a stitch.
+  end
+end, "trace")
+local function fmtloop(n)
+  local r = {}
+  for i = 1, n do
+    local x = i % 2 == 0 and 1.5 or i
+    r[#r + 1] = string.format("%s|%5s|%q|%s|%s|%x|%c", x, x, x, nil, true, i, 65)
+    r[#r + 1] = string.format("%s %p %p %p", t, t, "s", 1)
+  end
+  return table.concat(r, "\n")
+end
+jit.off(fmtloop)
+local ref = fmtloop(300)
+jit.on(fmtloop)
+jit.flush()
+local res = fmtloop(300)
+jit.attach(function() end)
+test:ok(res == ref, "compiled formats")
+test:is(nyi, 0, "no stitched traces")
+
+os.exit(test:check() and 0 or 1)
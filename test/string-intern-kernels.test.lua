@@ -0,0 +1,48 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("string-intern-kernels")
+test:plan(3)
+
+-- Strings are interned with SIMD compare and hash kernels where the CPU
+-- has them. Every string built at runtime must be found again, and no
+-- two different strings may be merged.
+
+-- Strings of all lengths around the vector width, differing in a single
+-- byte at each position.
+local bad = 0
+for len = 1, 70 do
+  local base = ("a"):rep(len)
+  local t = { [base] = 0 }
+  for pos = 1, len do
+    local s = base:sub(1, pos - 1).."b"..base:sub(pos + 1)
+    if t[s] ~= nil then bad = bad + 1 end
+    t[s] = pos
+  end
+  for pos = 1, len do
+    local s = base:sub(1, pos - 1).."b"..base:sub(pos + 1)
+    if t[s] ~= pos then bad = bad + 1 end
+  end
+  if t[("a"):rep(len)] ~= 0 then bad = bad + 1 end
+end
+test:is(bad, 0, "strings differing in a single byte")
+
+-- Long strings which only differ in bytes the fast hash doesn't sample
+-- collide, so they are interned by the full hash.
+local function collider(i)
+  return ("x"):rep(8)..("%05d"):format(i)..("y"):rep(87)
+end
+local t = {}
+for i = 1, 2000 do t[collider(i)] = i end
+bad = 0
+for i = 1, 2000 do
+  if t[collider(i)] ~= i then bad = bad + 1 end
+end
+test:is(bad, 0, "lookups of colliding long strings")
+
+local n = 0
+for _ in pairs(t) do n = n + 1 end
+test:is(n, 2000, "colliding long strings are distinct")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,114 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("string-pattern-cache")
+test:plan(6)
+
+-- Lua patterns are compiled on the first use and the programs are
+-- cached. Each case is run twice, so the second run uses the cached
+-- program, and must give the same results as the original matcher.
+
+local function pack(...)
+  local t = {select('#', ...), ...}
+  for i = 2, t[1] + 1 do t[i] = tostring(t[i]) end
+  return table.concat(t, ",")
+end
+
+local cases = {
+  -- Subject, pattern, string.find() results.
+  {"hello world", "o w", "2,5,7"},
+  {"hello world", "l+", "2,3,4"},
+  {"hello world", "(l+)(o)", "4,3,5,ll,o"},
+  {"hello world", "()ll()", "4,3,4,3,5"},
+  {"hello world", "^h.-o", "2,1,5"},
+  {"hello world", "^e", "1,nil"},
+  {"hello world", "d$", "2,11,11"},
+  {"hello world", "o$", "1,nil"},
+  {"hello world", "a$b", "1,nil"},
+  {"hello world", "%a+$", "2,7,11"},
+  {"hello world", "[^%s]*", "2,1,5"},
+  {"hello world", "[%]x-z]", "1,nil"},
+  {"hello world", "[a-f]%a?", "2,2,3"},
+  {"hello world", "%s%w%w", "2,6,8"},
+  {"x = f(a, (b)) + 1", "%b()", "2,6,13"},
+  {"THE (quick) fox", "%f[%a]%a+", "2,1,3"},
+  {"THE (quick) fox", "%f[%l]%a+", "2,6,10"},
+  {"THE (quick) fox", "%f[%z]", "2,16,15"},
+  {"say 'hi' and \"yo\"", "([\"'])(.-)%1", "4,5,8,',hi"},
+  {"abcabc", "(a(b)c)%1", "4,1,6,abc,b"},
+  {"abc", "", "2,1,0"},
+  {"a.b.c", "%.", "2,2,2"},
+  {"aaa", "a-b", "1,nil"},
+  {"aaab", "a-b", "2,1,4"},
+  {"key=value", "(%w+)=(%w+)", "4,1,9,key,value"},
+  {"\0a\0", "%z", "2,1,1"},
+}
+
+local function run_cases()
+  local bad = {}
+  for _, c in ipairs(cases) do
+    local r = pack(string.find(c[1], c[2]))
+    if r ~= c[3] then bad[#bad + 1] = c[2] .. " -> " .. r end
+  end
+  return table.concat(bad, "; ")
+end
+
+jit.off()
+test:is(run_cases(), "", "first use")
+test:is(run_cases(), "", "cached")
+jit.on()
+
+-- Patterns which are malformed only after the matched part must still
+-- fail lazily, and the errors must not change with the cache.
+local lazy = {
+  {"", "x%", "1,nil"},
+  {"abc", "z%b", "1,nil"},
+  {"abc", "z[a", "1,nil"},
+  {"abc", "z%f", "1,nil"},
+}
+local errs = {
+  {"ab", "a%"},
+  {"ab", "a(%1)"},
+  {"ab", "a.)"},
+  {"ab", "a%b"},
+  {"ab", "a%fx"},
+  {"ab", "a[b"},
+  {"ab", "a(b"},
+}
+local function run_lazy()
+  local bad = {}
+  for _, c in ipairs(lazy) do
+    local r = pack(string.find(c[1], c[2]))
+    if r ~= c[3] then bad[#bad + 1] = c[2] .. " -> " .. r end
+  end
+  for _, c in ipairs(errs) do
+    if pcall(string.find, c[1], c[2]) then bad[#bad + 1] = c[2] end
+  end
+  return table.concat(bad, "; ")
+end
+test:is(run_lazy(), "", "lazy errors")
+test:is(run_lazy(), "", "lazy errors, cached")
+
+-- gsub() with a callback using many other patterns, which evicts the
+-- program of the outer pattern from the cache.
+local s = ("key=value; "):rep(100)
+local n = 0
+local r = s:gsub("(%w+)=(%w+)", function(k, v)
+  for i = 1, 100 do
+    n = n + #(("k" .. i .. "v"):match("%a(" .. i .. ")%a"))
+  end
+  collectgarbage("step")
+  return v .. "=" .. k
+end)
+test:is(r, ("value=key; "):rep(100), "gsub with eviction")
+
+-- gmatch() and gsub() with a prefix skip.
+local t = {}
+for k, v in ("a=1, bb=22, ccc=333"):gmatch(", (%a+)=(%d+)") do
+  t[#t + 1] = k .. v
+end
+test:is(table.concat(t, " ") .. " " ..
+        (("x.y.z"):gsub("%.", "::")), "bb22 ccc333 x::y::z", "gmatch, gsub")
+
+os.exit(test:check() and 0 or 1)
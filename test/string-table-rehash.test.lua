@@ -0,0 +1,59 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("string-table-rehash")
+test:plan(4)
+
+-- The string table grows while the keys are interned and shrinks when
+-- most of them are collected. The strings are moved to the resized table
+-- incrementally, so the lookups are done while it's half-way done.
+local N = 100000
+local t = {}
+for i = 1, N do
+  t["k"..i] = i
+  if i % 1000 == 0 then collectgarbage("step", 1) end
+end
+local bad = 0
+for i = 1, N do
+  if t["k"..i] ~= i then bad = bad + 1 end
+end
+test:is(bad, 0, "lookups while the string table grows")
+
+for i = 1, N do
+  if i % 10 ~= 0 then t["k"..i] = nil end
+end
+local u = {}
+for k, v in pairs(t) do u[k] = v end
+t = u
+collectgarbage()
+collectgarbage()
+bad = 0
+for i = 10, N, 10 do
+  if t["k"..i] ~= i then bad = bad + 1 end
+end
+test:is(bad, 0, "lookups after the string table shrinks")
+
+-- Long strings are interned by a sparse hash first.
+local x, y = ("x"):rep(40), ("y"):rep(40)
+u = {}
+for i = 1, 5000 do u[x..i..y] = i end
+bad = 0
+for i = 1, 5000 do
+  if u[x..i..y] ~= i then bad = bad + 1 end
+end
+test:is(bad, 0, "lookups of long strings")
+
+-- Interning while the heap is dumped.
+local fname = os.tmpname()
+assert(misc.heapdump.start(fname))
+for i = N + 1, 2 * N do t["k"..i] = i end
+misc.heapdump.finish()
+os.remove(fname)
+bad = 0
+for i = N + 1, 2 * N do
+  if t["k"..i] ~= i then bad = bad + 1 end
+end
+test:is(bad, 0, "lookups after a heap dump")
+
+os.exit(test:check() and 0 or 1)
@@ -0,0 +1,76 @@
+#!/usr/bin/env tarantool
+
+local tap = require('tap')
+
+local test = tap.test("tonumber-decimal")
+test:plan(5)
+
+-- Decimals are converted with a fast path, which falls back to the exact
+-- conversion for the hard cases. Both must round correctly. The expected
+-- values are given as hex floats, which take a different path.
+local cases = {
+  {"0.1", "0x1.999999999999ap-4"},
+  {"1e23", "0x1.52d02c7e14af6p+76"},
+  {"3.0e-5", "0x1.f75104d551d69p-16"},
+  {"0.30000000000000004", "0x1.3333333333334p-2"},
+  {"12345678.87654321", "0x1.78c29dc0ca459p+23"},
+  {"7.2057594037927933e16", "0x1p+56"},
+  {"8.98846567431158e307", "0x1p+1023"},
+  {"1.7976931348623157e308", "0x1.fffffffffffffp+1023"},
+  {"2.2250738585072014e-308", "0x1p-1022"},
+  -- Denormals.
+  {"2.2250738585072011e-308", "0x0.fffffffffffffp-1022"},
+  {"4.9406564584124654e-324", "0x0.0000000000001p-1022"},
+  -- Halfway cases.
+  {"9007199254740993", "0x1p+53"},
+  {"1.00000000000000011102230246251565404236316680908203125", "0x1p+0"},
+  {"1.00000000000000011102230246251565404236316680908203124", "0x1p+0"},
+  {"1.00000000000000011102230246251565404236316680908203126",
+   "0x1.0000000000001p+0"},
+  -- More than 19 digits.
+  {"123456789012345678901234567890", "0x1.8ee90ff6c373ep+96"},
+  {"-98765432109876543210.5", "-0x1.56a9534e3949ap+66"},
+  {"1.000000000000000000000000000000", "0x1p+0"},
+}
+local function run_cases()
+  local bad = {}
+  for _, c in ipairs(cases) do
+    if tonumber(c[1]) ~= tonumber(c[2]) then bad[#bad + 1] = c[1] end
+  end
+  return table.concat(bad, "; ")
+end
+test:is(run_cases(), "", "correct rounding")
+
+test:ok(tonumber("1e400") == math.huge and tonumber("-1e-400") == 0 and
+        1/tonumber("-1e-400") == -math.huge and tonumber("-0.0") == 0,
+        "overflow, underflow and zeros")
+
+-- Digit runs are scanned 8 at a time. Malformed strings must still be
+-- rejected wherever the bad character is.
+local bad = 0
+local s = "12345678901234567890.12345678901234567890"
+for i = 2, #s do
+  for _, c in ipairs({"x", ".", " 1", "\0"}) do
+    if tonumber(s:sub(1, i - 1) .. c .. s:sub(i + 1)) ~= nil and
+       not (c == "." and s:sub(i, i) == ".") then
+      bad = bad + 1
+    end
+  end
+end
+test:is(bad, 0, "malformed strings")
+
+test:is(tonumber("  00012345678.8765432100000e2  "), 1234567887.654321,
+        "leading and trailing zeros")
+
+-- Random numbers must read back from their 17 digit representation.
+math.randomseed(42)
+bad = 0
+for _ = 1, 20000 do
+  local x = math.random() * 10 ^ math.random(-300, 300)
+  if tonumber(string.format("%.17g", x)) ~= x then bad = bad + 1 end
+  x = math.random(1, 2^30) / 2^math.random(0, 60)
+  if tonumber(string.format("%.40g", x)) ~= x then bad = bad + 1 end
+end
+test:is(bad, 0, "round-trip")
+
+os.exit(test:check() and 0 or 1)